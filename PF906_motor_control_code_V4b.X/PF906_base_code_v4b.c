@@ -112,6 +112,7 @@
 */
  
 #include "PF906header.h"
+#include "PF906math.h"
 
 
 /* 
@@ -180,27 +181,236 @@
 #define UserPowerOn_input     PORTCbits.RC7 
 
 /* Global constants */
-const int TestVoltage = 0x214; // min voltage to be measured before closing the relay
-const int minimumVoltage = 0x10E; // voltage to me measured during run time
+/*
+ * Parameters - the defaults, LoadParams() replaces them with the block in 
+ * the data EEPROM if it is good (see PF906header.h)
+ */
+const params_t paramDefaults = {
+    PARAM_VERSION, sizeof(params_t), {
+    // these are arbitrary but convenient speeds - see spreadsheet extract col I.  
+    // They are duty counts at PR2 0x65, ScaleDuty() makes them any other
+    {0x0,0x31,0x42,0x53,0x64,0x75,0x86,0x97,0xA8,0xBA,0xCB,0xDC},
+    // and the pulse count per 0.1s each speed should give - col B
+    {0,60,81,102,123,144,165,186,207,228,249,270},
+    0x214, // TestVoltage - min voltage to be measured before closing the relay
+    0x10E, // minimumVoltage - voltage to me measured during run time
+    FAULT_OC_IV, PID_KP_SHIFT, PID_KI_SHIFT, PID_KD_SHIFT},
+    PWM_PR2, 0 // the CRC is worked out when LoadParams() writes them
+};
 
 /* Global variables */
 // analog voltage conversions
-int HV = 0, IV = 0, MV = 0; // 16 bits each
+int HV = 0; // 16 bits
+
+// ADC sequencer: ADCON0 for each channel in the order they are converted
+// right justified, VDD volt ref, not in progress, ADC on
+#define ADC_MV 0
+#define ADC_IV 1
+#define ADC_HV 2
+#define ADC_CHANNELS 3
+const uint8_t adcChannelSel[ADC_CHANNELS] = {
+    0b10001001, // AN2 on RA2 - MV
+    0b10010001, // AN4 on RC0 - IV
+    0b10010101  // AN5 on RC1 - HV
+};
+// updated in the ISR:
+volatile uint16_t adcSample[ADC_CHANNELS]; // latest result for each channel
+volatile uint8_t adcCount[ADC_CHANNELS]; // results so far, wraps
+volatile uint16_t adcSum[ADC_CHANNELS]; // adding up towards the next
+volatile uint16_t adcDecimated[ADC_CHANNELS]; // ADC_BITS from the last sum
+// main loop side - see ADC_OVERSAMPLE_SHIFT
+uint8_t adcDecimatedSeen[ADC_CHANNELS]; // adcCount of the last one filtered
+uint16_t ivFilt = 0, mvFilt = 0; // IIR of adcDecimated, ADC_IIR_FRAC bits
+volatile uint8_t adcChannel = 0; // the channel being acquired/converted
 
-uint8_t button_history_speedUP = 0b11111111; // look for a low input so start with all 1's
-uint8_t button_history_speedDN = 0b11111111;
-uint8_t button_history_UserPowerOn_input = 0b00000000; // looks for a high input
-// these are arbitrary but convenient speeds - see spreadsheet extract col I
-uint8_t desiredSpeed[] = {0x0,0x31,0x42,0x53,0x64,0x75,0x86,0x97,0xA8,0xBA,0xCB,0xDC};
+// debounced buttons, 1 = pressed, in the same bit as their port pin
+#if OC_TRIP
+#define BTN_LIFT_DOWN  0          // RC2 carries IV for the overcurrent trip
+#else
+#define BTN_LIFT_DOWN  0b00000100 // RC2 FR4
+#endif
+#define BTN_LIFT_UP    0b00010000 // RB4 FR3
+#define BTN_SPEED_DOWN 0b00100000 // RB5 FR2
+#define BTN_SPEED_UP   0b01000000 // RB6 FR1
+#define BTN_POWER      0b10000000 // RC7 FR7 user power on
+#define BTN_ACTIVE_LOW (BTN_LIFT_DOWN | BTN_LIFT_UP | BTN_SPEED_DOWN | BTN_SPEED_UP)
+uint8_t buttonState = 0; // debounced
+uint8_t buttonCnt0 = 0, buttonCnt1 = 0; // vertical counters, bit 0 and 1
+// events, ORed in by TaskButtons and cleared by whatever acts on them
+uint8_t buttonPressed = 0;
+uint8_t buttonReleased = 0;
+uint8_t buttonHeld = 0;
+uint8_t buttonHoldCount = 0; // samples since any button changed
+tuning_t params; // from the data EEPROM, or paramDefaults
 
-//where the index is desiredSpeedCtr - see spreadsheet extract above
+//where the index is desiredSpeedCtr into params.desiredSpeed - see 
+//spreadsheet extract above
 uint8_t desiredSpeedCtr = 0;
-int8_t speedError = 0; // can be both pos or neg
+// what the speed control works to, whichever mode set it
+uint16_t setpoint = 0; // pulses per 0.1s x16 like measuredSpeed, 0 = off
+uint16_t setpointDuty = 0; // open loop duty for the setpoint
+uint8_t speedMode = SPEED_MODE_DEFAULT; // SPEED_MODE_PRESET or _FINE
+uint16_t setpointBefore = 0; // setpoint when the speed buttons were first pressed
+uint8_t repeatTicks = 0; // ticks till the next auto repeat
+uint8_t repeatCount = 0; // repeats since the step size last doubled
+uint16_t repeatStep = 0; // auto repeat step in fine mode
+int speedIntegral = 0; // PID integral term, with PID_I_FRAC fraction bits
+uint16_t lastSpeed = 0; // previous measurement for the PID D term
+uint16_t dutyCycle = 0; // 10 bit PWM duty cycle wanted, RampDuty gets there
+uint16_t dutyApplied = 0; // and what was last sent to CCPR1L:DC1B
+// the duty constants at the PWM frequency in use - see SetupDuty()
+#if PWM_PR2_EE
+#define PWM_PR2_USED    pwmPr2
+uint8_t pwmPr2 = PWM_PR2; // from the data EEPROM parameters
+uint8_t dutyScale = 64; // duty counts per count at 19.6kHz, x64
+uint16_t dutyMax = DUTY_MAX;
+uint8_t dutyStall = FAULT_STALL_DUTY;
+uint8_t rampAccel = RAMP_ACCEL, rampDecel = RAMP_DECEL;
+#else
+#define PWM_PR2_USED    PWM_PR2
+#define dutyScale       DUTY_SCALE
+#define dutyMax         DUTY_CEILING
+#define dutyStall       DUTY_AT(FAULT_STALL_DUTY)
+#define rampAccel       RAMP_AT(RAMP_ACCEL)
+#define rampDecel       RAMP_AT(RAMP_DECEL)
+#endif
+uint16_t motorPower = 0; // latest MV x IV, 0.0697W units - see POWER_LIMIT
+uint8_t powerLimited = 0; // the power ceiling held the duty since the PID ran
+#if POWER_LIMIT
+uint16_t powerDuty = DUTY_CEILING; // the power limit's duty ceiling, from dutyMax
+#endif
+uint8_t irComp = 0; // duty added for the IR drop - see IR_COMP
+#if IR_COMP
+uint16_t irIv = 0; // IV filtered for IRComp(), x16
+uint8_t irHold = 0; // irComp held since the setpoint changed
+#endif
+// duty cycle actually sent to CCPR1L:DC1B, x64 (RAMP_FRAC fraction bits)
+uint16_t dutyRamp = 0; 
+uint8_t rampBusy = 0; // still moving towards dutyCycle
+#if RAMP_S_CURVE
+uint8_t rampRate = 0; // present slope, x64 counts per tick
+uint8_t rampJerk = 0; // ticks since the slope last changed
+int8_t rampDir = 0; // 1 going up, -1 going down
+#endif
+// latest speed as pulses per 0.1s with 4 fraction bits (x16) - both methods
+uint16_t measuredSpeed = 0; 
 // updated in the ISR:
-volatile int actualSpeedPulses = 0;  // count of the actual pulses 
+volatile uint16_t actualSpeedPulses = 0;  // count of the actual pulses 
+volatile uint8_t speedSeq = 0; // bumped each window (each overflow for M/T)
+#if !SPEED_MEASURE_MT
+// the last 2 window counts, speedSeq & 1 is the newest - see ReadSpeedSnap()
+volatile uint8_t speedSnapL[2], speedSnapH[2];
+#endif
+// main loop side
+uint8_t speedSeqSeen = 0; // speedSeq the PID last ran for
+uint8_t speedMissed = 0; // times a window closed unseen by the PID, stops at 255
+uint16_t speedSnap = 0; // count from the newest window, from ReadSpeedSnap()
+#if SPEED_MEASURE_MT
+volatile uint8_t tmr1Overflows = 0; // extends Timer 1 to 24 bits
+volatile uint16_t mtEdgeCount = 0; // slots seen, wraps
+volatile uint16_t mtEdgeTicks = 0; // Timer 1 when the last slot was seen
+volatile uint8_t mtEdgeExt = 0;    // and tmr1Overflows at that time
+// start of the estimate being built up by MeasureSpeedMT()
+uint16_t mtStartCount = 0;
+uint32_t mtStartTime = 0;
+uint8_t mtRestart = 1; // the next slot starts a new estimate
+#endif
+
+#if ISR_PROFILE
+// interrupt profile, see ISR_PROFILE in PF906header.h
+uint16_t isrCount[ISR_PATHS]; // times each path ran, wraps
+uint8_t isrMax[ISR_PATHS]; // its worst case in cycles
+uint32_t isrCycles[ISR_PATHS]; // and all the cycles it has used
+uint8_t isrLatencyMax = 0; // worst TMR2IF to its path starting, cycles
+#endif
+
+// scheduler: updated in the ISR:
+volatile uint8_t tickCount = 0; // 1ms Timer 0 ticks, wraps
+uint8_t lastTick = 0; // the tick Schedule() last ran
+// for each task - see the task table below
+uint8_t taskDue[TASKS]; // the tick it runs next
+#if RUN_STATS
+uint16_t taskWcet[TASKS]; // worst case run time in 4us Timer 0 steps
+uint16_t taskJitter[TASKS]; // worst case start after its tick, 4us steps
+uint8_t taskOverruns[TASKS]; // times it was a whole period late
+#endif
+// overcurrent trip - see setupOvercurrent
+uint16_t ocTrips = 0; // ticks in which C2 saw an overcurrent
+uint8_t ocTripSeen = 0; // a trip since the PID last ran
+uint8_t ocLatched = 0; // tripped too often, the motor stays off
+#if OC_TRIP && !OC_CYCLE_LIMIT
+uint8_t ocRetries = 0; // restarts since it last ran clean for OC_CLEAN_TICKS
+uint8_t ocWait = 0; // ticks till the next restart, 0 when running
+uint16_t ocClean = 0; // ticks since the last trip
+#endif
+// LED1 flash pattern stepped by TaskLED
+uint8_t ledPeriod = 0; // 50ms steps in each half of a flash
+uint8_t ledCount = 0; // 50ms steps left in this half
+uint8_t ledHalves = 0; // halves left, odd is on, 0 when done
+uint8_t ledRepeat = 0; // flashes to start again with when done, 0 stops
+uint8_t ledPause = 0; // extra off halves between repeats
+uint8_t ledGap = 0; // off halves left of the pause
+
+uint8_t faultCode = FAULT_NONE; // why the motor was shut down
+uint8_t faultCount[FAULTS]; // ticks each condition has held in a row
+uint8_t powerState = POWER_PRECHARGE;
+uint8_t relaySettle = 0; // ticks since the user power request in RELAY_SETTLE
+#if RUN_STATS
+uint16_t stateTime = 0; // ms in the present state, stops at 65.5s
+uint16_t stateLast[POWER_STATES]; // ms spent in each state the last time
+uint8_t stateEntries[POWER_STATES] = {1}; // times each state was entered
+#endif
+
+// data EEPROM - see EE_RESUME in PF906header.h
+log_t runLog; // the log as it is now, and the record the ISR writes
+uint8_t logAddr = EE_LOG; // where the newest record is
+uint8_t logWanted = 0; // LOG_xx, done once the ISR is free
+#define LOG_WRITE 0x01 // runLog has changed
+#define LOG_FAULT 0x02 // faultCode to go in it
+uint16_t logHeld = 0; // ticks logNext has been the setpoint
+uint16_t logNext = 0; // setpoint waiting to be logged
+uint16_t logTicks = 0; // ms of running towards the next second
+uint16_t logSeconds = 0; // and seconds towards the next 0.1h
+// updated in the ISR:
+volatile uint8_t eeLeft = 0; // bytes still to write
+volatile uint8_t eeAddr; // where the next goes
+uint8_t * volatile eeSrc; // and what it is
+
+#if TELEMETRY
+uint8_t txFrame[TELEMETRY_BYTES]; // the frame being sent
+uint8_t txIndex = TELEMETRY_BYTES; // next byte of it to send
+uint8_t txWait = 1; // ticks till the next frame
+uint8_t txSeq = 0;
+volatile uint16_t txShift; // start, 8 data and stop bits, next one at bit 0
+volatile uint8_t txBits = 0; // bits left in txShift, the ISR sends them
+#endif
+
+#if TACH_OUT
+// updated in the ISR, and only changed with T0IE clear:
+volatile uint16_t tachStep = 0; // measuredSpeed x TACH_OUT_PPR, added every tick
+volatile uint16_t tachPhase = 0; // towards the next FR6 change at TACH_OUT_HALF
+#endif
+
+#if PRECHARGE_FIT
+uint24_t chargeSum = 0; // HV over the present window, 22 bits
+uint16_t chargeTicks = 0;
+uint24_t chargeMean[3]; // the last 3 window averages, counts x256, oldest first
+uint8_t chargeWindows = 0; // windows averaged so far, up to 3
+uint16_t chargeFinal = 0; // fitted HV the caps are heading for
+uint16_t chargeRatio = 0; // fitted e^-(window/tau) x4096
+uint8_t chargeTau = 0; // fitted time constant, s
+#endif
+
+const uint8_t faultTicks[FAULTS] = {
+    FAULT_UV_TICKS, FAULT_OC_TICKS, FAULT_OVERSPEED_TICKS, FAULT_STALL_TICKS, 
+    FAULT_TACH_TICKS
+};
 
 //Function Prototypes...
+//start LED1 flashing, it carries on in TaskLED while other things run
 void FlashLED1 (uint8_t times, uint8_t period);
+
+void FlashCode (uint8_t code);
 //void FlashLED5 (uint8_t times, uint8_t period);
 
 //set up the chip features
@@ -213,10 +423,130 @@ int CheckIV (void);
 int CheckHV (void);
 //set up the comparator to measure rpm
 void setupactualSpeedPulses(void);
+//start the interrupt driven ADC sequencer
+void setupADC(void);
+//comparator 2 and ECCP auto-shutdown on motor overcurrent
+void setupOvercurrent(void);
+//count overcurrent trips and restart after them
+void CheckOvercurrent(void);
+//motor power into motorPower, and the POWER_LIMIT duty ceiling
+void CheckPower(void);
+//latest sample of an ADC channel, does not wait
+uint16_t ReadADC(uint8_t channel);
+//the last oversampled value of a channel, ADC_BITS
+uint16_t ReadDecimated(uint8_t channel);
+//step the IIR on a channel's new decimated value, 1 if there was one
+uint8_t FilterADC(uint8_t channel, uint16_t *filt);
 
 void startPWM(void);
+#if PWM_PR2_EE
+//the duty constants for the PWM frequency in params
+void SetupDuty(void);
+#endif
+//duty counts at the PWM frequency in use from counts at 19.6kHz
+int ScaleDuty(int duty);
+//write a 10 bit duty cycle to CCPR1L:DC1B
+void SetDuty(uint16_t duty);
+//duty to make up the IR drop from the motor current
+void IRComp(void);
+//limit a duty cycle to 0..dutyMax
+uint16_t ClampDuty(int duty);
+//move the output duty one tick closer to the wanted duty
+uint16_t RampDuty(uint16_t target);
+//change the speed setpoint and its open loop duty
+void NewSetpoint(uint16_t speed, uint16_t duty);
+//open loop duty for any speed, from the preset table
+uint16_t FeedForward(uint16_t speed);
+//one preset step or fine step up (dir 1) or down (dir -1)
+void StepPreset(int8_t dir, uint8_t repeat);
+void StepFine(int8_t dir, uint16_t step, uint8_t repeat);
+//closed loop speed control, run once per window with the speed x16
+uint16_t SpeedPID(uint16_t speed);
+//M/T speed estimate from the slot timestamps
+void MeasureSpeedMT(void);
+//copy the newest window count into speedSnap, returns its speedSeq
+uint8_t ReadSpeedSnap(void);
+//start the 1ms Timer 0 tick
+void setupScheduler(void);
+//wait for the next tick and run the tasks that are due
+void Schedule(uint8_t tasks);
+#if RUN_STATS
+//time since a tick in 4us Timer 0 steps
+uint16_t TickSteps(uint8_t from);
+#endif
+//the tasks
+void TaskButtons(void);
+void TaskSpeed(void);
+void TaskPWM(void);
+void TaskADC(void);
+void TaskLED(void);
+void TaskFault(void);
+void TaskPower(void);
+void TaskTelemetry(void);
+
+void EnterState(uint8_t next);
+
+void StopTach(void);
+//FR6 tach output from a speed reading
+void SetTachOut(uint16_t speed);
+
+uint8_t PrechargeFit(uint8_t charging);
+//CRC-8 of the data EEPROM blocks, one byte at a time
+uint8_t Crc8(uint8_t crc, uint8_t data);
+//read a data EEPROM byte - not while the ISR is writing
+uint8_t EERead(uint8_t addr);
+//hand the ISR n bytes to write, 0 if it is still busy
+uint8_t EEWrite(uint8_t addr, uint8_t *src, uint8_t n);
+//0 if params and pr2 have values the code cannot run with
+uint8_t ParamsUsable(uint8_t pr2);
+//params from the data EEPROM, or the defaults written back
+void LoadParams(void);
+//the newest good run log record into runLog
+void LoadLog(void);
+//keep the run log, from TaskPower
+void RunLog(void);
+//write runLog as the next record in the ring, 0 if the ISR is busy
+uint8_t LogWrite(void);
+//go to a logged setpoint, in preset mode if it is one of the steps
+void ResumeSpeed(uint16_t speed);
+
+void Shutdown(void);
 // All interrupt routines
 void __interrupt() Isr(void);
+
+/*
+ * Task table - the bit for each task is its position, pass a mask of the 
+ * tasks wanted to Schedule().  Kept as const arrays so only the run time 
+ * stats take RAM
+ */
+#define TASK_BUTTONS 0b00000001
+#define TASK_SPEED   0b00000010
+#define TASK_PWM     0b00000100
+#define TASK_ADC     0b00001000
+#define TASK_LED     0b00010000
+#define TASK_FAULT   0b00100000
+#define TASK_POWER   0b01000000
+#if TELEMETRY
+#define TASK_TELEMETRY 0b10000000
+#else
+#define TASK_TELEMETRY 0 // never runs
+#endif
+#define TASKS_IDLE   (TASK_BUTTONS | TASK_ADC | TASK_LED | TASK_POWER | \
+                      TASK_TELEMETRY) // motor not started
+#define TASKS_RUN    (0b01111111 | TASK_TELEMETRY)
+void (* const taskRun[TASKS])(void) = {
+    TaskButtons, TaskSpeed, TaskPWM, TaskADC, TaskLED, TaskFault, TaskPower, 
+    TaskTelemetry
+};
+const uint8_t taskPeriod[TASKS] = {
+    TASK_BUTTONS_TICKS, TASK_SPEED_TICKS, TASK_PWM_TICKS, TASK_ADC_TICKS, 
+    TASK_LED_TICKS, TASK_FAULT_TICKS, TASK_POWER_TICKS, TASK_TELEMETRY_TICKS
+};
+// the tasks that run in each power state
+const uint8_t powerTasks[POWER_STATES] = {
+    TASKS_IDLE, TASKS_IDLE, TASKS_RUN, TASKS_RUN, TASKS_RUN, 
+    TASK_LED | TASK_POWER | TASK_TELEMETRY
+};
    
     
 void main(void) {
@@ -225,7 +555,8 @@ void main(void) {
 
     // set up LED output (active low) on RC4 
     // flash the LED then leave it on to indicate all ok.  If it turns off 
-    // then something is wrong.  It flashes regularly when the loop ends  
+    // then something is wrong.  It flashes the fault code if a fault 
+    // stops the motor  
     LED1 = LOW;
 
     // set up the lift motor to do nothing
@@ -237,106 +568,44 @@ void main(void) {
     TotemControl_output = LOW; 
 
     /* 
-     * Now wait for the caps to charge 
-     * The question is what voltage to let the caps change to.  It takes about
-     * 3 minutes to fully charge the caps via the R55 resistor (47k) but its 
-     * probably enough to trigger the relay at say 90s.  The NGSpice model says 
-     * the HV measurement point will be (scaled to) about 3.37V in 90s. 
-     * This is mostly arbitrary but if your voltage is too low the relay 
-     * contacts will burn over time due to the surge current.
-     * 
-     * Remember this is a treadmill so its probably left on all day in the gym, 
-     * so the caps remain charged so a user doesn't see the delay.  In a 
-     * workshop its a bit painful to wait 3 minutes.  Reduce the resistor 
-     * value if you cant live with the time delay. 
-     * 
-     * Max value HV gets to is about 4.2V allowing for errors in my NGSpice 
-     * models in Kicad
-     * 
-     * I dont know if this is right, but lets attempt to put some math to it.
+     * From here everything runs as tasks on the 1ms tick.  TaskPower steps 
+     * the power sequence - precharge, relay, armed, run, stopping or fault 
+     * - and which tasks run depends on the state, see powerTasks.
      * 
-     * The relay is a 953-1A and is TUV rated at 2HP/250VAC PF=0.6
-     * Assuming a 2HP motor starts up in say 1s and has 6x FLA at start 
-     * P=2.5hp => 10.5A FLA. so I=6x10.6 and  I^2t=(6*10.5)^2x1=3969A^2t 
-     * assuming i takes 0.055s to charge the caps when the relay closes peak 
-     * charging current is sqrt(3969/0.055)=sqrt(72164)=269A
-     * 
-     * So roughly speaking the relay will handle about 270A peak current for 
-     * 55ms and experience the same heating as a allowed 2hp motor start taking 
-     * 6xFLA for 1s
-     *    
-     */ 
-
-    HV = CheckHV();    
-    while (HV <= TestVoltage) {// wait for cap charging - takes about 40s 
-        __delay_ms(250);
-        HV = CheckHV();
+     * When "main(){};" ends, the compiler adds code to soft reset the code, 
+     * so to stop the device it must stay in this loop.  Microchip recommends 
+     * to never let the device exit the main loop
+     */
+    while (1) {
+        SIM_MARK(SIM_MARK_LOOP);
+        Schedule(powerTasks[powerState]);
     };
-    // ... when caps charged then...
-    FR6out = LOW; 
-    PowerPermissive_output = HIGH;
+};    
 
-    // energise RLA2 to apply mains voltage.  Drop PowerPermissive_output 
-    // if something is wrong
-    
-    /* 
-     * Now wait for the user to request motor power on
-     * Polling is generally considered wasteful as the processor does nothing
-     * other than poll.  In this case it really doesn't matter as we wont do 
-     * anything else anyway
-     * 
-     * The User power on must stay on to ensure that the RLA2 stays closed.  
-     * If it drops off then the power circuit opens cutting off the motor supply
-     * 
-     * The button is debounced by the OPTO and the capacitor on the output side
-     * before Q8 but I want more debounce for my button input.  When it has an 
-     * upstream driver I can remove this debounce
-     * 
-     * 
-    */
 
-    while (button_history_UserPowerOn_input != 0b01111111) { 
-       // Poll the input pin using debounce
-       button_history_UserPowerOn_input = button_history_UserPowerOn_input << 1;
-       button_history_UserPowerOn_input |= UserPowerOn_input;
-    };
-    
-    /* 
-     * To get here the user power input must have been triggered and the caps 
-     * are charged so by the design of the circuit, RLA2 will close its 
-     * contacts provided PowerPermissive_output is true (HIGH) 
-     * 
-     * We are now ready to start turning the belt motor 
-     * (and/or the incline motor)
-     * 
-    */     
 
-    INTCON = 0b11000000; 
+/*** end of main code *****************************/
 
-    // turn on the totemcontrol to allow PWM to run the motor
-    TotemControl_output = HIGH;   
- 
-    /*******************************************************
-     *                                                     *
-     * From here everything happens in the operating loop  *
-     *                                                     *
-     *******************************************************/        
-    
-    while (UserPowerOn_input && PowerPermissive_output) {   
-      
 /*
  * Since all is OK, set the speed the user wants when the user 
  * pushes the "speed" button.
  * 
- * Speed up and down buttons work by polling
  * Note that the motor does nothing after power on as the speed = 0.  
- * To do this apply a debounce routine to the speed buttons and just 
- * read the port pins
- * This is the users speed selection between 1000 and 4500rpm 
+ * The speed buttons come debounced from TaskButtons as press events.
+ * This is the users speed selection, in one of 2 modes:
  * 
- *  
- * desiredSpeedCtr is a counter for the user to select the speed steps 
- * -> the desired speed step.
+ * Preset - the original 11 steps from 1000 to 4500rpm.  desiredSpeedCtr 
+ *   is a counter for the user to select the speed steps -> the desired 
+ *   speed step.
+ * Fine - a press moves the setpoint SPEED_FINE_RPM between 
+ *   SPEED_MIN_RPM and SPEED_MAX_RPM, and the open loop duty is interpolated 
+ *   from the preset table, so any speed can be set.
+ * 
+ * Holding a button auto repeats - in fine mode the step doubles every 
+ * SPEED_REPEAT_DOUBLE repeats so it gets across the range quickly.  
+ * Holding both buttons swaps modes, and puts the setpoint back to where it 
+ * was before the first of the 2 was pressed.  While one speed button is 
+ * held the other does nothing else.
  * 
  * actualSpeedPulses is the counted pulses for speed feedback 
  * 
@@ -347,124 +616,874 @@ void main(void) {
  * *********************************************************************
  * (see PWM setup)
  *
- * In this loop we must start the timer 1 for 0.1s so we can do pulse 
- * counts and PID....
- * 
- * Now poll for the speed buttons - remember to debounce
+ * Timer 1 times 0.1s windows in which the ISR counts the tach pulses.  
+ * Each time a window closes the PID compares the count with the setpoint 
+ * and trims the duty cycle around the open loop value so the speed holds 
+ * under load
  * 
- * Debounce works as follows:
- * https://hackaday.com/2015/12/10/embed-with-elliot-debounce-your-noisy-buttons-part-ii/#more-180185
+*/
+void TaskSpeed(void) {
+    uint8_t pressed, held, seq;
+    
+#if !TELEMETRY && !TACH_OUT
+    FR6out = HIGH;  //turn it off
+#endif
+    
+    // act on the speed buttons pressed since the last tick
+    pressed = buttonPressed & (BTN_SPEED_UP | BTN_SPEED_DOWN);
+    buttonPressed &= ~pressed;
+    held = buttonState & (BTN_SPEED_UP | BTN_SPEED_DOWN);
+    if (pressed && !(held & ~pressed)) { // first of the buttons
+        setpointBefore = setpoint;
+        repeatTicks = 0;
+        repeatCount = 0;
+        repeatStep = RPM_TO_SPEED(SPEED_FINE_RPM);
+        if (pressed == BTN_SPEED_UP) { //RB6 - speed up triggered
+            if (speedMode == SPEED_MODE_FINE) StepFine(1, repeatStep, 0);
+            else StepPreset(1, 0);
+        };
+        if (pressed == BTN_SPEED_DOWN) { //RB5 - speed down triggered
+            if (speedMode == SPEED_MODE_FINE) StepFine(-1, repeatStep, 0);
+            else StepPreset(-1, 0);
+        };
+    };
+    
+    // both held - swap modes
+    if ((buttonHeld & (BTN_SPEED_UP | BTN_SPEED_DOWN)) == 
+        (BTN_SPEED_UP | BTN_SPEED_DOWN)) {
+        if (speedMode == SPEED_MODE_FINE) {
+            speedMode = SPEED_MODE_PRESET;
+            // the nearest preset step to where it was
+            desiredSpeedCtr = 0;
+            while (desiredSpeedCtr < 11 && setpointBefore > 
+                   (uint16_t)(params.desiredPulses[desiredSpeedCtr] + 
+                              params.desiredPulses[desiredSpeedCtr + 1]) << 3) {
+                ++desiredSpeedCtr;
+            };
+            StepPreset(0, 0);
+        } else {
+            speedMode = SPEED_MODE_FINE;
+            NewSetpoint(setpointBefore, FeedForward(setpointBefore));
+        };
+    };
+    buttonHeld &= ~(BTN_SPEED_UP | BTN_SPEED_DOWN);
+    
+    // one held - auto repeat once it has been held long enough
+    if ((held == BTN_SPEED_UP || held == BTN_SPEED_DOWN) && 
+        buttonHoldCount >= BUTTON_HOLD_SAMPLES && ++repeatTicks >= 
+        (speedMode == SPEED_MODE_FINE ? SPEED_REPEAT_TICKS : SPEED_REPEAT_PRESET_TICKS)) {
+        repeatTicks = 0;
+        if (speedMode == SPEED_MODE_FINE) {
+            StepFine(held == BTN_SPEED_UP ? 1 : -1, repeatStep, 1);
+            if (++repeatCount >= SPEED_REPEAT_DOUBLE && 
+                repeatStep < RPM_TO_SPEED(SPEED_FINE_MAX_RPM)) {
+                repeatCount = 0;
+                repeatStep <<= 1;
+            };
+        } else {
+            StepPreset(held == BTN_SPEED_UP ? 1 : -1, 1);
+        };
+    };
+    
+#if SPEED_MEASURE_MT
+    MeasureSpeedMT();
+    seq = speedSeq;
+#else
+    seq = ReadSpeedSnap();
+#endif
+    // a window has closed so correct the speed
+    if (seq != speedSeqSeen) {
+        if ((uint8_t)(seq - speedSeqSeen) > 1 && speedMissed != 255) ++speedMissed;
+        speedSeqSeen = seq;
+#if !SPEED_MEASURE_MT
+        measuredSpeed = speedSnap << 4;
+        SIM_MARK(SIM_MARK_SPEED);
+#endif
+        dutyCycle = SpeedPID(measuredSpeed);
+    };
+    SetTachOut(measuredSpeed);
+};
+
+#if !SPEED_MEASURE_MT
+/*
+ * The newest window count without masking the interrupt.  The ISR only 
+ * writes the buffer that is not the newest and bumps speedSeq after, so a 
+ * window closing part way through does not touch the bytes being read - 
+ * but 2 closing would, so if speedSeq has moved at all read again.  Windows 
+ * are 0.1s apart so it never goes round more than twice.
+ */
+uint8_t ReadSpeedSnap(void) {
+    uint8_t seq, i, lo, hi;
+    
+    do {
+        seq = speedSeq;
+        SIM_PREEMPT(1);
+        i = seq & 1;
+        lo = speedSnapL[i];
+        SIM_PREEMPT(2);
+        hi = speedSnapH[i];
+        SIM_PREEMPT(3);
+    } while (seq != speedSeq);
+    speedSnap = lo | (uint16_t)hi << 8;
+    return seq;
+};
+#endif
+
+/*
+ * Set the speed the control works to, with the open loop duty for it.  The 
+ * duty jumps straight to the new open loop value plus what the PID has 
+ * learnt about the load, rather than waiting for the next window.  0 stops 
+ * the motor and forgets the load.
+ */
+void NewSetpoint(uint16_t speed, uint16_t duty) {
+    setpoint = speed;
+    setpointDuty = duty;
+#if IR_COMP
+    irHold = 1;
+#endif
+    if (speed == 0) {
+        speedIntegral = 0;
+        dutyCycle = 0;
+        return;
+    };
+    dutyCycle = ClampDuty(duty + ScaleDuty(speedIntegral >> PID_I_FRAC));
+};
+
+/*
+ * Move desiredSpeedCtr a step and use that preset.  An auto repeat going 
+ * down stops at step 1 so holding the button does not stop the motor.
+ */
+void StepPreset(int8_t dir, uint8_t repeat) {
+    if (dir > 0 && desiredSpeedCtr < 11) ++desiredSpeedCtr; 
+    if (dir < 0 && desiredSpeedCtr > (repeat ? 1 : 0)) --desiredSpeedCtr;
+    NewSetpoint(params.desiredPulses[desiredSpeedCtr] << 4, 
+                ScaleDuty(params.desiredSpeed[desiredSpeedCtr]));
+};
+
+/*
+ * Move the fine setpoint by step.  Up from stopped starts at SPEED_MIN_RPM, 
+ * and a press down from there stops - an auto repeat does not.
+ */
+void StepFine(int8_t dir, uint16_t step, uint8_t repeat) {
+    uint16_t speed = setpoint;
+    if (dir > 0) {
+        if (speed < RPM_TO_SPEED(SPEED_MIN_RPM)) speed = RPM_TO_SPEED(SPEED_MIN_RPM);
+        else if (speed < RPM_TO_SPEED(SPEED_MAX_RPM) - step) speed += step;
+        else speed = RPM_TO_SPEED(SPEED_MAX_RPM);
+    } else {
+        if (speed > RPM_TO_SPEED(SPEED_MIN_RPM) + step) speed -= step;
+        else if (speed > RPM_TO_SPEED(SPEED_MIN_RPM) || repeat) 
+            speed = RPM_TO_SPEED(SPEED_MIN_RPM);
+        else speed = 0;
+    };
+    NewSetpoint(speed, FeedForward(speed));
+};
+
+/*
+ * Open loop duty for any speed - straight line between the 2 preset steps 
+ * either side of it (from 0 below step 1, and carrying on past step 11), 
+ * scaled to the PWM frequency.  The divide is slow on the 16F690 but it 
+ * only runs when the setpoint changes.
+ */
+uint16_t FeedForward(uint16_t speed) {
+    uint8_t i = 1;
+    uint16_t lo, span;
+    
+    if (speed == 0) return 0;
+    while (i < 11 && speed > (uint16_t)params.desiredPulses[i] << 4) ++i;
+    lo = params.desiredPulses[i - 1] << 4;
+    span = (params.desiredPulses[i] - params.desiredPulses[i - 1]) << 4;
+    return ClampDuty(ScaleDuty(params.desiredSpeed[i - 1] + (int)(((uint32_t)(speed - lo) * 
+           (params.desiredSpeed[i] - params.desiredSpeed[i - 1]) + (span >> 1)) / span)));
+};
+
+/*
+ * Button debounce - every input at once with vertical counters
  * 
  * Keep in mind that the board has a small cap across the OPTO LED.  
  * This somewhat forms a hardware debouncer but I think we need 
  * more debounce
  * 
- * We are in a fast loop, so it will read the 2 speed buttons
- * every cycle to keep a history.
+ * Each time the task runs PORTB and PORTC are read once and the 5 inputs 
+ * packed into a byte, each in the bit it has on its port (RC2, RB4, RB5, 
+ * RB6, RC7), and flipped where needed so 1 always means pressed.
  * 
- * We are looking for an active LOW signal so opposite to the website
- * description...
+ * Every input has a 2 bit counter, but the counters are stored 
+ * "vertically" - bit n of buttonCnt0 and buttonCnt1 make up the counter for 
+ * input n - so a few byte wide operations count all 8 bits at once:
  * 
- * We look for a 0b10000000 pattern which means a button is 
- * pressed.  Pressed means a low input (0x00)
+ *   delta = inputs that differ from the debounced state
+ *   the counters of those inputs count up, all the others reset to 0
+ *   a counter that wraps back to 0 (4 samples) flips its debounced bit
  * 
- * If the pattern matches then update a variable, if not then do 
- * nothing till the next read.
+ * So a change has to be steady for 4 samples, 4 x TASK_BUTTONS_TICKS, to 
+ * be accepted and any bounce just starts the count again.  It is the same 
+ * few instructions however many buttons are wired up.
  * 
- * As the history starts at 0b11111111, it takes 7 loops with a button 
- * pressed before it is registered as a press on the 8th
+ * Debounced bits that flip to 1 are press events and to 0 release events.  
+ * BUTTON_HOLD_SAMPLES with no change while something is pressed gives a 
+ * held event.  Events are ORed into buttonPressed/Released/Held so none are 
+ * lost if a task runs less often.
  * 
- * the entire routine just checks to see if button_history is 
- * 0b10000000. Detecting a release is then a test for 0b00000001 
- * and the button up and down states are 0b11111111 and 0b00000000
- * respectively. 
+ * This replaces the shift register histories from
+ * https://hackaday.com/2015/12/10/embed-with-elliot-debounce-your-noisy-buttons-part-ii/#more-180185
+ * which were sampled every pass of the main loop, so their debounce time 
+ * changed whenever the loop did.
+ */
+void TaskButtons(void) {
+    uint8_t sample, delta, toggle;
+    
+    // read the ports once, 1 = pressed
+    sample = (PORTB & (BTN_LIFT_UP | BTN_SPEED_DOWN | BTN_SPEED_UP)) | 
+             (PORTC & (BTN_LIFT_DOWN | BTN_POWER));
+    sample ^= BTN_ACTIVE_LOW;
+    
+    delta = sample ^ buttonState;
+    buttonCnt1 = (buttonCnt1 ^ buttonCnt0) & delta;
+    buttonCnt0 = ~buttonCnt0 & delta;
+    toggle = delta & ~(buttonCnt0 | buttonCnt1);
+    buttonState ^= toggle;
+    
+    buttonPressed |= toggle & buttonState;
+    buttonReleased |= toggle & ~buttonState;
+    if (toggle) buttonHoldCount = 0;
+    else if (buttonHoldCount != 0xFF) ++buttonHoldCount;
+    if (buttonHoldCount == BUTTON_HOLD_SAMPLES) buttonHeld |= buttonState;
+};
+
+void TaskPWM(void) {
+    uint16_t duty = dutyCycle;
+    
+#if OC_TRIP
+    CheckOvercurrent();
+#endif
+    CheckPower();
+#if POWER_LIMIT
+    if (duty > powerDuty) {
+        duty = powerDuty;
+        powerLimited = 1;
+    };
+#endif
+    // Set the PWM speed... by adjusting the PWM duty cycle, gently
+    dutyApplied = RampDuty(duty);
+#if IR_COMP
+    IRComp();
+    dutyApplied = ClampDuty(dutyApplied + irComp);
+#if POWER_LIMIT
+    if (dutyApplied > powerDuty) {
+        dutyApplied = powerDuty;
+        powerLimited = 1;
+    };
+#endif
+#endif
+    SetDuty(dutyApplied);
+};
+
+void TaskADC(void) {
+    HV = CheckHV();
+    FilterADC(ADC_IV, &ivFilt);
+    FilterADC(ADC_MV, &mvFilt);
+};
+
+void TaskLED(void) {
+    if (ledHalves == 0) return; // nothing to flash
+    if (--ledCount) return;
+    ledCount = ledPeriod;
+    if (ledGap) { // pausing between repeats with the LED off
+        --ledGap;
+        return;
+    };
+    if (--ledHalves == 0) {
+        if (!ledRepeat) {
+            LED1 = HIGH;  //always finish with the LED OFF
+            return;
+        };
+        ledHalves = ledRepeat << 1;
+        ledGap = ledPause;
+    };
+    if (ledHalves & 1) LED1 = LOW; // Turn LED on
+    else LED1 = HIGH; // Turn LED off
+};
+
+/*
+ * Flash LED1 without waiting - the pattern starts here and TaskLED steps 
+ * it every 50ms.  Off then on for period x 50ms each, times over, then off.  
+ * times = 0 flashes until another pattern is started.
+ */
+void FlashLED1 (uint8_t times, uint8_t period) {  
+    //period in multiples of 50ms    
+    if (times > 5) {times = 5;} // limit to 5 flashes
+    if (period > 10) {period = 10;} // limit the delay length to 1s
+    if (period == 0) {period = 1;}
+    ledRepeat = (times == 0);
+    if (ledRepeat) {times = 1;}
+    ledPause = 0;
+    ledGap = 0;
+    ledPeriod = period;
+    ledCount = period;
+    ledHalves = times << 1;
+    LED1 = HIGH;    // Turn LED off as its already on
+};
+
+/*
+ * Flash a fault code on LED1 - code flashes, a pause, and again until 
+ * another pattern is started.
+ */
+void FlashCode (uint8_t code) {
+    FlashLED1(1, LED_CODE_PERIOD);
+    ledHalves = code << 1; // FlashLED1 stops at 5
+    ledRepeat = code;
+    ledPause = LED_CODE_GAP;
+};
+
+/*
+ * Fault supervisor - runs every tick while the motor runs.  Each check 
+ * sets its bit in 'seen', and a bit has to stay set for that fault's 
+ * faultTicks in a row before it counts, so a single odd reading does 
+ * nothing.  The first fault to count shuts the motor down on the spot and 
+ * is kept in faultCode.  See FAULT_xx in PF906header.h for the limits and 
+ * the worst case time each one takes.
  * 
-*/
-        // setup for FR6 to output RPM pulses
-        FR6out = HIGH;  //turn it off
-        
-        //read the speed buttons
-        button_history_speedUP = button_history_speedUP << 1;
-        button_history_speedUP |= SpeedUp_input;
-        button_history_speedDN = button_history_speedDN << 1;
-        button_history_speedDN |= SpeedDown_input;
-        //act on button pressed
-        if (button_history_speedUP == 0b10000000)   { //RB6 - speed up triggered
-            if (desiredSpeedCtr < 11) ++desiredSpeedCtr; 
-            //do we need to reset the timer1 and the speed test counter????
-            //button_history_speedUP = 0b11111111;
+ * HV, IV and MV are read from the ADC sequencer here rather than taken 
+ * from TaskADC, which only runs every 5ms.  The speed checks go on 
+ * measuredSpeed, which TaskSpeed updates from the handed over count as 
+ * each window closes - the count still going up in the ISR is not read.
+ */
+void TaskFault(void) {
+    uint8_t i, seen, bit;
+    uint16_t hv, iv, mv;
+    int emf;
+    uint8_t stopped;
+    uint16_t stallDuty = dutyStall;
+
+    if (faultCode != FAULT_NONE) return;
+    hv = CheckHV();
+    iv = CheckIV();
+    mv = CheckMV();
+    emf = (int)mv - (int)(MULC(iv, FAULT_IR_K) >> 8);
+    stopped = measuredSpeed < RPM_TO_SPEED(FAULT_STALL_RPM);
+    seen = 0;
+    
+    if (hv < (uint16_t)params.minimumVoltage) seen |= 1 << (FAULT_UNDERVOLTAGE - 1);
+    if (iv > params.faultOcIv || ocLatched) seen |= 1 << (FAULT_OVERCURRENT - 1);
+    if (measuredSpeed > RPM_TO_SPEED(FAULT_OVERSPEED_RPM)) 
+        seen |= 1 << (FAULT_OVERSPEED - 1);
+#if POWER_LIMIT
+    // held at the current limit a stall only takes a few % duty
+    if (dutyCycle > powerDuty) stallDuty = 0;
+#endif
+    if (stopped && emf < FAULT_TACH_EMF && dutyApplied > stallDuty) 
+        seen |= 1 << (FAULT_STALL - 1);
+    if (stopped && emf >= FAULT_TACH_EMF) seen |= 1 << (FAULT_TACH - 1);
+    
+    bit = 0b00000001;
+    for (i = 0; i < FAULTS; i++, bit <<= 1) {
+        if (!(seen & bit)) {
+            faultCount[i] = 0;
+        } else if (++faultCount[i] >= faultTicks[i]) {
+            Shutdown();
+            faultCode = i + 1;
+            return;
         };
-        if (button_history_speedDN == 0b10000000) { //RB5 - speed down triggered
-            if (desiredSpeedCtr > 0) --desiredSpeedCtr;
-            //do we need to reset the timer1 and the speed test counter????
-            //button_history_speedDN = 0b11111111;
+    };
+};
+
+/*
+ * Power sequence - stepped every tick.  The states are in PF906header.h.
+ * 
+ * PRECHARGE     PowerPermissive is low so RLA2 stays open and the caps 
+ *               charge through R55 while the user holds power on.  Waits 
+ *               for PrechargeFit() to say the inrush will be in the relay 
+ *               rating, or for HV over TestVoltage without PRECHARGE_FIT.
+ * RELAY_SETTLE  PowerPermissive high, so RLA2 closes as soon as the user 
+ *               holds power on.  Waits RELAY_SETTLE_TICKS of the request 
+ *               for the contacts to stop bouncing and the caps to top up.
+ * ARMED         tach and gate drive on, speed buttons live, setpoint 0
+ * RUN           a speed has been set
+ * STOPPING      setpoint 0, duty coming down the ramp.  Back to ARMED once 
+ *               it is at 0, or if power was let go open RLA2 and go back to 
+ *               PRECHARGE - the caps are still charged so the next power 
+ *               request re-arms without a power cycle.
+ * FAULT         TaskFault shut the motor down - flash the code till the 
+ *               power is cycled
+ * 
+ * With RUN_STATS, stateTime, stateLast and stateEntries record how long 
+ * each state took the last time and how often it was entered.
+ * 
+ * PRECHARGE: the question is what voltage to let the caps charge to.  It takes about
+ * 3 minutes to fully charge the caps via the R55 resistor (47k) but its 
+ * probably enough to trigger the relay at say 90s.  The NGSpice model says 
+ * the HV measurement point will be (scaled to) about 3.37V in 90s. 
+ * This is mostly arbitrary but if your voltage is too low the relay 
+ * contacts will burn over time due to the surge current.
+ * 
+ * Remember this is a treadmill so its probably left on all day in the gym, 
+ * so the caps remain charged so a user doesn't see the delay.  In a 
+ * workshop its a bit painful to wait 3 minutes.  Reduce the resistor 
+ * value if you cant live with the time delay. 
+ * 
+ * Max value HV gets to is about 4.2V allowing for errors in my NGSpice 
+ * models in Kicad
+ * 
+ * I dont know if this is right, but lets attempt to put some math to it.
+ * 
+ * The relay is a 953-1A and is TUV rated at 2HP/250VAC PF=0.6
+ * Assuming a 2HP motor starts up in say 1s and has 6x FLA at start 
+ * P=2.5hp => 10.5A FLA. so I=6x10.6 and  I^2t=(6*10.5)^2x1=3969A^2t 
+ * assuming i takes 0.055s to charge the caps when the relay closes peak 
+ * charging current is sqrt(3969/0.055)=sqrt(72164)=269A
+ * 
+ * So roughly speaking the relay will handle about 270A peak current for 
+ * 55ms and experience the same heating as a allowed 2hp motor start taking 
+ * 6xFLA for 1s
+ *    
+ */
+void TaskPower(void) {
+    uint8_t next = powerState;
+    uint8_t power = buttonState & BTN_POWER;
+
+#if RUN_STATS
+    if (stateTime != 0xFFFF) ++stateTime;
+#endif
+    switch (powerState) {
+    case POWER_PRECHARGE:
+        // wait for cap charging - takes about 40s
+        HV = CheckHV();
+#if PRECHARGE_FIT
+        if (PrechargeFit(power)) next = POWER_RELAY_SETTLE;
+#else
+        if (HV > params.TestVoltage) next = POWER_RELAY_SETTLE;
+#endif
+        break;
+    case POWER_RELAY_SETTLE:
+        if (!power) relaySettle = 0;
+        else if (++relaySettle >= RELAY_SETTLE_TICKS) next = POWER_ARMED;
+        break;
+    case POWER_ARMED:
+        if (!power) next = POWER_STOPPING;
+        else if (setpoint != 0) next = POWER_RUN;
+        break;
+    case POWER_RUN:
+        if (!power || setpoint == 0) next = POWER_STOPPING;
+        break;
+    case POWER_STOPPING:
+        if (!power) { // and keep it stopped whatever the speed buttons say
+            desiredSpeedCtr = 0;
+            NewSetpoint(0, 0);
+        } else if (setpoint != 0) {
+            next = POWER_RUN;
+            break;
         };
-        
-        // enable the port interrupts if needed       
-        // INTCONbits.RABIE = 0x01; 
-        
-        // Set the PWM speed... by adjusting the PWM duty cycle
-        // Get the lowest 2 bits
-        CCP1CONbits.DC1B = (desiredSpeed[desiredSpeedCtr] & 0x3); 
-        // Get the rest of the bits and set the register
-        CCPR1L = (desiredSpeed[desiredSpeedCtr] >> 2);      
-   
-        //check that everything is OK...       
-//        HV = CheckHV();
-//        if ((HV < minimumVoltage)) { // add in other safety tests 
-//            // HV is measured across the IGBTs so it reads different 
-//            // when they are switching
-//            // something has gone wrong or user power off: turn off everything
-//            // changes to the pin state will make electronics shut down
-//            // ...cycle power to reset
-//            CCP1CONbits.DC1B = 0; // set the RPM to 0
-//            CCPR1L = 0;
-//            TotemControl_output = LOW;
-//            PowerPermissive_output = LOW;
-//            FlashLED5(2,5);
-//        };
+        if (dutyApplied == 0) next = power ? POWER_ARMED : POWER_PRECHARGE;
+        break;
+    default: // POWER_FAULT
+        break;
+    };
+    if (faultCode != FAULT_NONE) next = POWER_FAULT;
+    if (next != powerState) EnterState(next);
+    RunLog();
+};
+
+/*
+ * Leave the present state for 'next' - whatever the new state needs 
+ * switching on or off happens here, once
+ */
+void EnterState(uint8_t next) {
+    switch (next) {
+    case POWER_PRECHARGE:
+        Shutdown(); // opens RLA2
+        StopTach();
+        LED1 = LOW; // on, all ok
+        break;
+    case POWER_RELAY_SETTLE:
+#if !TELEMETRY && !TACH_OUT
+        FR6out = LOW; 
+#endif
+        // energise RLA2 to apply mains voltage
+        PowerPermissive_output = HIGH;
+        relaySettle = 0;
+        break;
+    case POWER_ARMED:
+        if (powerState != POWER_RELAY_SETTLE) break;
+        buttonPressed = 0; // forget speed presses made before now
+        // start counting tach pulses in 0.1s windows for the speed control
+        actualSpeedPulses = 0;
+        CM1CON0bits.C1ON = HIGH;
+        T1CONbits.TMR1ON = HIGH;
+        // turn on the totemcontrol to allow PWM to run the motor
+        TotemControl_output = HIGH;   
+#if EE_RESUME
+        // and carry on at the speed it was running at when the power went
+        if (runLog.setpoint) ResumeSpeed(runLog.setpoint);
+#endif
+        break;
+    case POWER_FAULT:
+        StopTach();
+        FlashCode(faultCode); // till the power is cycled
+        // log it, and that it stopped so it does not restart on its own
+        logWanted |= LOG_FAULT;
+        break;
+    };
+#if RUN_STATS
+    stateLast[powerState] = stateTime;
+    stateTime = 0;
+    if (stateEntries[next] != 0xFF) ++stateEntries[next];
+#endif
+    powerState = next;
+};
+
+#if PRECHARGE_FIT
+/*
+ * Called every PRECHARGE tick with HV just read.  Returns 1 when the 
+ * relay can close, and sets faultCode to FAULT_CHARGE if the caps are not 
+ * charging like an RC circuit should.  See PF906header.h.
+ * 
+ * For a charging RC the HV averages m0, m1, m2 of 3 windows in a row are 
+ * on the same exponential, so with d1 = m1 - m0 and d2 = m2 - m1:
+ * 
+ *   d2 / d1 = e^-(window/tau)               the ratio r
+ *   final   = m2 + d2 x d2 / (d1 - d2)      where it is heading
+ *   tau     = window x (1 + r) / (2 (1 - r))   close enough to -window/ln r 
+ *                                               for r near 1, and no log
+ * 
+ * This runs on every window so the fit follows the mains if it moves.  
+ * Until the first fit HV over TestVoltage still closes the relay, so with 
+ * the caps already charged (a re-arm) it closes straight away.
+ */
+uint8_t PrechargeFit(uint8_t charging) {
+    int32_t d1, d2;
+    uint16_t dv;
+    uint32_t final;
 
+    if (chargeWindows < 3 && HV > params.TestVoltage) return 1; // already charged
+    if (!charging) { // R55 only charges while the user holds power on
+        chargeWindows = 0;
+        chargeSum = 0;
+        chargeTicks = 0;
+        return 0;
+    };
+    if (chargeWindows == 3) { // would the inrush be in the rating now?
+        dv = HV < chargeFinal ? chargeFinal - HV : 0;
+        if (dv <= PRECHARGE_DV_MAX && 
+            (uint32_t)dv * dv * chargeTau <= PRECHARGE_I2T_K) return 1;
     };
     
-    // and we are done....shut everything down and power cycle to reset
-    CCP1CONbits.DC1B = 0; // set the RPM to 0
-    CCPR1L = 0;
-    TotemControl_output = LOW;
-    PowerPermissive_output = LOW;
-    LED1 = HIGH;
+    chargeSum += HV;
+    if (++chargeTicks < (1 << PRECHARGE_WINDOW_SHIFT)) return 0;
+    chargeMean[0] = chargeMean[1];
+    chargeMean[1] = chargeMean[2];
+    chargeMean[2] = chargeSum >> (PRECHARGE_WINDOW_SHIFT - 8);
+    chargeSum = 0;
+    chargeTicks = 0;
+    if (chargeWindows < 3) ++chargeWindows;
+    if (chargeWindows < 2) return 0;
+    
+    d2 = (int32_t)chargeMean[2] - (int32_t)chargeMean[1];
+    if (d2 < PRECHARGE_MIN_RISE) { // not charging
+        faultCode = FAULT_CHARGE;
+        return 0;
+    };
+    if (chargeWindows < 3) return 0;
+    d1 = (int32_t)chargeMean[1] - (int32_t)chargeMean[0];
+    if (d2 >= d1) { // not slowing down like an RC does
+        faultCode = FAULT_CHARGE;
+        return 0;
+    };
+    chargeRatio = (uint16_t)(((uint32_t)d2 << 12) / d1);
+    final = chargeMean[2] + (uint32_t)d2 * d2 / (d1 - d2);
+    chargeFinal = (uint16_t)((final + 128) >> 8);
+    final = ((uint32_t)(4096 + chargeRatio) << PRECHARGE_WINDOW_SHIFT) / 
+            (2000UL * (4096 - chargeRatio));
+    chargeTau = final > 255 ? 255 : (uint8_t)final;
+    if (chargeRatio < PRECHARGE_RATIO_MIN || chargeRatio > PRECHARGE_RATIO_MAX || 
+        chargeFinal < PRECHARGE_MIN_FINAL) faultCode = FAULT_CHARGE;
+    return 0;
+};
+#endif
 
-    /*
-     * When "main(){};" ends, the compiler adds code to soft reset the code, 
-     * so to stop the device it must stay in this loop.  Microchip recommends 
-     * to never let the device exit the main loop
-    */
-     while (1){
-         FlashLED1(1,4);
-     };    
-    };    
+void StopTach(void) {
+    T1CONbits.TMR1ON = LOW;
+    CM1CON0bits.C1ON = LOW;
+    measuredSpeed = 0;
+    speedSeqSeen = speedSeq; // the window it stopped in is not a reading
+    SetTachOut(0);
+};
 
+/*
+ * The step the tick adds to tachPhase for this speed (see TACH_OUT in 
+ * PF906header.h).  The ISR reads it as 2 bytes, so the tick is held off 
+ * while it changes - a few cycles late at most.  Stopped, FR6 goes back to 
+ * off.
+ */
+void SetTachOut(uint16_t speed) {
+#if TACH_OUT
+    uint16_t step;
+    
+    step = speed < TACH_OUT_SPEED_MAX ? MULC(speed, TACH_OUT_PPR) : TACH_OUT_HALF - 1;
+    if (step == tachStep) return;
+    INTCONbits.T0IE = LOW;
+    tachStep = step;
+    if (!step) {
+        tachPhase = 0;
+        FR6out = HIGH;
+    };
+    INTCONbits.T0IE = HIGH;
+#endif
+};
 
+/*
+ * Telemetry - every TELEMETRY_TICKS pack a snapshot into txFrame (format 
+ * in PF906header.h), then each tick the ISR has finished the last byte 
+ * hand it the next one.  The ISR sends the stop bit of a byte on the tick 
+ * this runs, so the next start bit follows on the tick after with no gap.
+ */
+void TaskTelemetry(void) {
+#if TELEMETRY
+    uint8_t i, sum;
+    uint16_t w;
+    uint32_t adc;
+    
+    if (--txWait == 0) {
+        txWait = TELEMETRY_TICKS;
+        w = dutyApplied | (uint16_t)faultCode << 10 | (uint16_t)powerState << 13;
+        adc = CheckHV() | (uint32_t)CheckIV() << 10 | (uint32_t)CheckMV() << 20;
+#if POWER_LIMIT
+        if (dutyCycle > powerDuty) adc |= (uint32_t)1 << 30;
+#endif
+        txFrame[0] = TELEMETRY_SYNC;
+        txFrame[1] = txSeq++;
+        txFrame[2] = (uint8_t)measuredSpeed;
+        txFrame[3] = (uint8_t)(measuredSpeed >> 8);
+        txFrame[4] = (uint8_t)w;
+        txFrame[5] = (uint8_t)(w >> 8);
+        txFrame[6] = (uint8_t)adc;
+        txFrame[7] = (uint8_t)(adc >> 8);
+        txFrame[8] = (uint8_t)(adc >> 16);
+        txFrame[9] = (uint8_t)(adc >> 24);
+        txFrame[10] = (uint8_t)motorPower;
+        txFrame[11] = (uint8_t)(motorPower >> 8);
+        sum = 0;
+        for (i = 0; i < TELEMETRY_BYTES - 1; i++) sum += txFrame[i];
+        txFrame[TELEMETRY_BYTES - 1] = -sum;
+        txIndex = 0;
+    };
+    if (txBits || txIndex == TELEMETRY_BYTES) return;
+    // stop bit (1) at bit 9, the byte, start bit (0) at bit 0
+    txShift = 0x200 | (uint16_t)txFrame[txIndex++] << 1;
+    txBits = 10;
+#endif
+};
 
-/*** end of main code *****************************/
+/*
+ * CRC-8, polynomial x^8 + x^2 + x + 1 from 0.  Run over a block and its 
+ * CRC it comes out 0, so a block is checked in the same pass that reads it
+ */
+uint8_t Crc8(uint8_t crc, uint8_t data) {
+    uint8_t i;
+    
+    crc ^= data;
+    for (i = 0; i < 8; i++) {
+        if (crc & 0x80) crc = (uint8_t)(crc << 1) ^ 0x07;
+        else crc <<= 1;
+    };
+    return crc;
+};
 
+uint8_t EERead(uint8_t addr) {
+    EEADR = addr;
+    EECON1bits.EEPGD = LOW; // data EEPROM - it is unknown at power on
+    EECON1bits.RD = HIGH;
+    return EEDAT;
+};
 
-void FlashLED1 (uint8_t times, uint8_t period) {  
-    //period in multiples of 50ms    
-    uint8_t p = period;
-    if (times > 5) {times = 5;} // limit to 5 flashes
-    if (period > 10) {period = 10;} // limit the delay length to 1s
-    do {
-        LED1 = HIGH;    // Turn LED off as its already on
-        do {__delay_ms(50); 
-           } while (--p);
-        p = period;
-        LED1 = LOW;     // Turn LED on
-        do {__delay_ms(50); 
-           } while (--p);
-        p = period;
-        } while (--times);    
-       LED1 = HIGH;  //always finish with the LED OFF
-    // LED1 = LOW;  //always finish with the LED solid on 
+/*
+ * Start the ISR writing n bytes from src - setting EEIF gets it to do the 
+ * first.  src must stay as it is till eeLeft is back to 0.
+ */
+uint8_t EEWrite(uint8_t addr, uint8_t *src, uint8_t n) {
+    if (eeLeft || EECON1bits.WR) return 0;
+    eeAddr = addr;
+    eeSrc = src;
+    eeLeft = n;
+    PIR2bits.EEIF = HIGH;
+    return 1;
+};
+
+/*
+ * What a block with a good CRC still has to pass.  FeedForward() divides 
+ * by the step between neighbouring presets, so the table has to go up 
+ * step by step, and SpeedPID() shifts a 16 bit error by each gain plus 4.
+ */
+uint8_t ParamsUsable(uint8_t pr2) {
+    uint8_t i;
+    
+    if (pr2 < PWM_PR2_MIN || params.pidKp > PID_SHIFT_MAX || 
+        params.pidKi > PID_SHIFT_MAX || params.pidKd > PID_SHIFT_MAX || 
+        params.desiredPulses[0] < 0 || 
+        params.desiredPulses[PRESET_STEPS - 1] > PRESET_PULSES_MAX) return 0;
+    for (i = 1; i < PRESET_STEPS; i++) {
+        if (params.desiredPulses[i] <= params.desiredPulses[i - 1] || 
+            params.desiredSpeed[i] <= params.desiredSpeed[i - 1]) return 0;
+    };
+    return 1;
+};
+
+/*
+ * Check the parameter block in one pass and read its tuning part into 
+ * params on the way - the rest is only wanted here.  Anything wrong, or 
+ * values the code cannot run with (ParamsUsable()), and it is the 
+ * defaults, written back so the block is there to change next time.  
+ * Runs before the interrupts are on, so it writes them itself, straight 
+ * from program memory with the CRC worked out on the way rather than from 
+ * a copy in RAM - ~5ms a byte, the once.
+ */
+void LoadParams(void) {
+    uint8_t *p = (uint8_t *)&params;
+    const uint8_t *d = (const uint8_t *)&paramDefaults;
+    uint8_t i, b, crc = 0;
+    
+    for (i = 0; i < sizeof(params_t); i++) {
+        b = EERead(EE_PARAMS + i);
+        crc = Crc8(crc, b);
+        if (i >= offsetof(params_t, tuning) && 
+            i < offsetof(params_t, tuning) + sizeof(tuning_t)) 
+            p[i - offsetof(params_t, tuning)] = b;
+    };
+    b = EERead(EE_PARAMS + offsetof(params_t, pwmPr2));
+    if (crc == 0 && EERead(EE_PARAMS + offsetof(params_t, version)) == PARAM_VERSION && 
+        EERead(EE_PARAMS + offsetof(params_t, size)) == sizeof(params_t) && 
+        ParamsUsable(b)) {
+#if PWM_PR2_EE
+        pwmPr2 = b;
+#endif
+        return;
+    };
+    params = paramDefaults.tuning;
+    crc = 0;
+    for (i = 0; i < sizeof(params_t); i++) {
+        b = i < sizeof(params_t) - 1 ? d[i] : crc; // the CRC goes last
+        crc = Crc8(crc, b);
+        if (EERead(EE_PARAMS + i) == b) continue; // and leaves EEADR there
+        EEDAT = b;
+        EECON1bits.WREN = HIGH;
+        EECON2 = 0x55; // the unlock sequence, as in the ISR
+        EECON2 = 0xAA;
+        EECON1bits.WR = HIGH;
+        EECON1bits.WREN = LOW;
+        while (EECON1bits.WR) {};
+    };
+    PIR2bits.EEIF = LOW;
+};
+
+/*
+ * One pass round the ring - the newest good record is the one whose seq 
+ * is furthest on, counting round the wrap (there are far fewer records 
+ * than seq numbers).  With none the first record goes in the first slot.
+ */
+void LoadLog(void) {
+    uint8_t *p = (uint8_t *)&runLog;
+    uint8_t addr, i, crc, seq, newest = 0, found = 0;
+    
+    logAddr = EE_LOG + (LOG_RECORDS - 1) * sizeof(log_t);
+    for (addr = EE_LOG; addr < EE_LOG + LOG_RECORDS * sizeof(log_t); 
+         addr += sizeof(log_t)) {
+        crc = 0;
+        for (i = 0; i < sizeof(log_t); i++) crc = Crc8(crc, EERead(addr + i));
+        if (crc != 0) continue;
+        seq = EERead(addr + offsetof(log_t, seq));
+        if (found && (int8_t)(seq - newest) <= 0) continue;
+        newest = seq;
+        logAddr = addr;
+        found = 1;
+    };
+    // then read that one again, into runLog
+    if (found) for (i = 0; i < sizeof(log_t); i++) p[i] = EERead(logAddr + i);
+    logNext = runLog.setpoint;
+};
+
+/*
+ * Run log - count the run time, and log a new setpoint once it has held 
+ * for LOG_SETTLE_TICKS with the power request on and the motor armed.  
+ * The ISR writes the record straight from runLog, so runLog only changes 
+ * once it has all of it (eeLeft 0) - till then the run time builds up in 
+ * logSeconds, a setpoint stays in logNext and a fault in logWanted.  Any 
+ * change then waits in runLog till the ISR is free to write it.
+ */
+void RunLog(void) {
+    if (powerState == POWER_RUN && ++logTicks >= 1000) {
+        logTicks = 0;
+        ++logSeconds;
+    };
+    if (setpoint != logNext) {
+        logNext = setpoint;
+        logHeld = 0;
+    } else if (logNext != runLog.setpoint && (buttonState & BTN_POWER) && 
+               powerState >= POWER_ARMED && powerState <= POWER_STOPPING && 
+               ++logHeld >= LOG_SETTLE_TICKS && !eeLeft) {
+        runLog.setpoint = logNext;
+        logWanted |= LOG_WRITE;
+    };
+    if (eeLeft) return; // the ISR is still reading runLog
+    if (logWanted & LOG_FAULT) {
+        if (runLog.faults[faultCode - 1] != 255) ++runLog.faults[faultCode - 1];
+        runLog.setpoint = 0;
+        logWanted = LOG_WRITE;
+    };
+    if (logSeconds >= LOG_RUN_SECONDS) {
+        logSeconds -= LOG_RUN_SECONDS;
+        ++runLog.runTenths;
+        logWanted |= LOG_WRITE;
+    };
+    if (logWanted && LogWrite()) logWanted = 0;
+};
+
+uint8_t LogWrite(void) {
+    uint8_t *p = (uint8_t *)&runLog;
+    uint8_t i, crc = 0;
+    
+    // the last byte of the one before may still be being written
+    if (eeLeft || EECON1bits.WR) return 0;
+    logAddr += sizeof(log_t);
+    if (logAddr >= EE_LOG + LOG_RECORDS * sizeof(log_t)) logAddr = EE_LOG;
+    ++runLog.seq;
+    for (i = 0; i < sizeof(log_t) - 1; i++) crc = Crc8(crc, p[i]);
+    runLog.crc = crc;
+    return EEWrite(logAddr, p, sizeof(log_t));
+};
+
+/*
+ * A logged setpoint that is one of the steps comes back in preset mode so 
+ * the buttons step from it, anything else in fine mode
+ */
+void ResumeSpeed(uint16_t speed) {
+    uint8_t i;
+    
+    for (i = 1; i < PRESET_STEPS; i++) {
+        if ((uint16_t)params.desiredPulses[i] << 4 == speed) {
+            speedMode = SPEED_MODE_PRESET;
+            desiredSpeedCtr = i;
+            StepPreset(0, 0);
+            return;
+        };
+    };
+    speedMode = SPEED_MODE_FINE;
+    NewSetpoint(speed, FeedForward(speed));
+};
+
+/*
+ * Safe shutdown - PWM straight to 0, not down the ramp, the gate drive 
+ * off and RLA2 open.  The drop back to PRECHARGE uses it as well, and can 
+ * go on to run again - it is only a fault that latches the motor off, 
+ * until a power cycle.
+ */
+void Shutdown(void) {
+    CCP1CONbits.DC1B = 0; // set the RPM to 0
+    CCPR1L = 0;
+    dutyCycle = 0;
+    dutyRamp = 0;
+    dutyApplied = 0;
+    TotemControl_output = LOW;
+    PowerPermissive_output = LOW;
 };
 
 //void FlashLED5 (uint8_t times, uint8_t period) {  // also flashes opto FR6
@@ -524,7 +1543,7 @@ void doSetup(){
      * S        
      * 
      * 1  0 RA0 = ICSP data
-     * 0  1 RA1 = ICSP clock and FR6 output active low
+     * 0  1 RA1 = ICSP clock and FR6 output active low (telemetry or tach)
      * 1  0 RA2 = MV analog input
      * 1  0 RA3 = VPP/MCLR input
      * 0  0 RA4 = lift motor raise/lower relay coil active high
@@ -571,12 +1590,22 @@ void doSetup(){
     ANSELbits.ANS4 = 0x01;  // IV 
     ANSELbits.ANS5 = 0x01;  // HV
     
+    //parameters and the run log from the data EEPROM - EEIF paces the 
+    //writes, which start once the interrupts are on.  The PWM frequency is 
+    //one of the parameters
+    PIE2bits.EEIE = HIGH;
+    LoadParams();
+    LoadLog();
+#if PWM_PR2_EE
+    SetupDuty();
+#endif
     
     //set up and start PWM on RC5
     startPWM(); // always starts at 0rpm by default
 
     // Timer 2 is used in PWM, Timer 1 is 0.1s cycle timer
-    // and Timer 0 available
+    // and Timer 0 is the 1ms scheduler tick
+    setupScheduler();
     
     // setup Timer 1 IE for RPM counter read
     /* Instruction cycle is 1/4 of 8MHz and an interrupt every 0.1s means we 
@@ -595,9 +1624,17 @@ void doSetup(){
      * TMR1H = 0x3C
      * 
     */ 
+#if SPEED_MEASURE_MT
+    // for M/T the timer free runs at 1:1 as the slot timestamp clock and 
+    // its 32.8ms overflow paces the PID instead
+    T1CON = 0b00000000; //timer is off
+    TMR1L = 0x00;
+    TMR1H = 0x00;
+#else
     T1CON = 0b00100000; //timer is off
-    TMR1L = 0xAF;
-    TMR1H = 0x3C;
+    TMR1L = (uint8_t)SPEED_WINDOW_RELOAD;
+    TMR1H = (uint8_t)(SPEED_WINDOW_RELOAD >> 8);
+#endif
     PIE1bits.CCP1IE = 0x00; // disable capture and compare 1
     PIE1bits.TMR1IE = 0x01; // enable interrupt from Timer 1 
     
@@ -606,7 +1643,169 @@ void doSetup(){
     
     //set up the RPM counter actualSpeedPulses
     setupactualSpeedPulses();  
+#if OC_TRIP
+    //and comparator 2 for the overcurrent trip - after comparator 1 as they 
+    //share VRCON
+    setupOvercurrent();
+#endif
+    
+    //start sampling MV, IV and HV in the background
+    setupADC();
+    
+    // interrupts on - global, peripheral and Timer 0.  Timer 1 and 
+    // comparator 1 are enabled but stay quiet till the motor is started
+    INTCON = 0b11100000; 
+};
+
+/*
+ * ADC sequencer - converts MV, IV and HV in turn without the main code 
+ * ever waiting.  Following the steps in sect 9.2.6 page 109:
+ * 
+ * step 1 - port pins set to analog in doSetup
+ * step 2 - ADC clock set in doSetup (Fosc/32 = 4us TAD), channel selected 
+ *          here and again each time a result comes in
+ * step 3 - the ADC interrupt is used
+ * step 4 - acquisition: the next Timer 2 interrupt is ~300us away, far 
+ *          more than the 5us needed (page 250)
+ * step 5 - the Timer 2 interrupt sets GO
+ * step 6 - the ADC interrupt fires when the conversion is done, ~44us
+ * step 7 - the ISR stores the result in adcSample[], adds it to the 
+ *          channel's oversampling sum and selects the next channel
+ * 
+ * With ADC_SYNC_PWM 0 the tick starts the conversions in step 5 instead.
+ */
+void setupADC(void) {
+    adcChannel = 0;
+    ADCON0 = adcChannelSel[0];
+    PIR1bits.ADIF = LOW;
+    PIE1bits.ADIE = HIGH;
+#if ADC_SYNC_PWM
+    PIE1bits.TMR2IE = HIGH; // Timer 2 is already running for the PWM
+#endif
+};
+
+uint16_t ReadADC(uint8_t channel) {
+    uint16_t sample;
+    // the ISR writes the 2 bytes separately so keep it out while copying
+    PIE1bits.ADIE = LOW;
+    sample = adcSample[channel];
+    PIE1bits.ADIE = HIGH;
+    return sample;
+};
+
+uint16_t ReadDecimated(uint8_t channel) {
+    uint16_t value;
+    PIE1bits.ADIE = LOW;
+    value = adcDecimated[channel];
+    PIE1bits.ADIE = HIGH;
+    return value;
+};
+
+/*
+ * A new decimated value is in once adcCount has gone past another 
+ * ADC_OVERSAMPLE results.  Only the latest is filtered if TaskADC has 
+ * fallen behind - at 5ms against 14.7ms it does not.
+ */
+uint8_t FilterADC(uint8_t channel, uint16_t *filt) {
+    uint8_t n;
+    int x;
     
+    n = adcCount[channel] >> (2 * ADC_OVERSAMPLE_SHIFT);
+    if (n == adcDecimatedSeen[channel]) return 0;
+    adcDecimatedSeen[channel] = n;
+    x = (int)(ReadDecimated(channel) << ADC_IIR_FRAC);
+    *filt += (x - (int)*filt) >> ADC_IIR_SHIFT;
+    return 1;
+};
+
+/*
+ * Scheduler tick on Timer 0 - see PF906header.h
+ * 
+ * The OPTION_REG register sets the TMR0 clock and prescale... 
+ * 
+ *                 bit:  7  6  5  4  3  2  1  0
+ * OPTION_REG register   1  1  0  1  0  0  1  0 ... see page 80 
+ * 
+ * bit 7-6 port pull ups off and INT edge as at reset
+ * bit 5 T0CS = 0 the instruction clock (2MHz)
+ * bit 3 PSA = 0 the prescaler is for Timer 0
+ * bit 2-0 = 010 prescale 1:8 so 4us steps
+ */
+void setupScheduler(void) {
+    uint8_t i;
+    OPTION_REG = 0b11010010;
+    TMR0 = TICK_RELOAD;
+    tickCount = 0;
+    lastTick = 0;
+    for (i = 0; i < TASKS; i++) {
+        taskDue[i] = 1; // everything is due on the first tick
+    };
+    INTCONbits.T0IF = LOW; // T0IE is set with GIE at the end of doSetup
+};
+
+#if RUN_STATS
+/*
+ * Time since the start of tick 'from' in 4us Timer 0 steps.  The tick 
+ * starts with TMR0 at 256 - TICK_STEPS, and if TMR0 has rolled over but 
+ * the ISR has not counted it yet the uint8_t subtraction wraps to 
+ * TICK_STEPS and up, which is still right.
+ */
+uint16_t TickSteps(uint8_t from) {
+    uint8_t tick, step;
+    do {
+        tick = tickCount;
+        step = TMR0;
+    } while (tick != tickCount); // the tick changed while reading TMR0
+    step -= 256 - TICK_STEPS;
+    return MULC((uint16_t)(uint8_t)(tick - from), TICK_STEPS) + step;
+};
+#endif
+
+/*
+ * Wait for the next tick then run each task in the mask that is due, in 
+ * table order.  Tasks not in the mask follow the clock so they start on 
+ * time when they are wanted again.  A task more than a whole period late 
+ * drops the runs it missed rather than running them back to back, and 
+ * with RUN_STATS counts an overrun.
+ */
+void Schedule(uint8_t tasks) {
+    uint8_t i, now, late, bit;
+#if RUN_STATS
+    uint16_t start, run;
+#endif
+    
+    do {
+        now = tickCount;
+        SIM_CYCLES(4);
+    } while (now == lastTick); // idle till the next tick
+    lastTick = now;
+    SIM_MARK(SIM_MARK_TICK);
+    
+    bit = 0b00000001;
+    for (i = 0; i < TASKS; i++, bit <<= 1) {
+        if (!(tasks & bit)) {
+            taskDue[i] = now;
+            continue;
+        };
+        late = now - taskDue[i];
+        if (late & 0x80) continue; // not due yet
+        if (late >= taskPeriod[i]) {
+#if RUN_STATS
+            ++taskOverruns[i];
+#endif
+            taskDue[i] = now;
+        };
+#if RUN_STATS
+        start = TickSteps(taskDue[i]);
+        (*taskRun[i])();
+        run = TickSteps(taskDue[i]) - start;
+        if (start > taskJitter[i]) taskJitter[i] = start;
+        if (run > taskWcet[i]) taskWcet[i] = run;
+#else
+        (*taskRun[i])();
+#endif
+        taskDue[i] += taskPeriod[i];
+    };
 };
    
 /*
@@ -623,15 +1822,8 @@ void doSetup(){
  * 
  */
 int CheckMV (){
-    // turn off the ADC before making changes
-     ADCON0bits.ADON = 0x0;
-    //set up analog input on RA2 AN2 (MV) - range 0-3.6V = 0-200VDC
-    ADCON0 = 0b10000101; // right justified, VDD volt ref, channel AN2, 
-                         // not in progress, ADC on
-    __delay_ms(5);
-    ADCON0bits.GO_nDONE = HIGH; // start the ADC
-    while (ADCON0bits.GO_nDONE) {}; //wait for the conversion
-    return (ADRESL | (ADRESH<<8));
+    //analog input on RA2 AN2 (MV) - range 0-3.6V = 0-200VDC
+    return ReadADC(ADC_MV);
 };
 
 /*
@@ -645,15 +1837,8 @@ int CheckMV (){
  * 
  */
 int CheckIV (){
-    // turn off the ADC before making changes
-     ADCON0bits.ADON = 0x0;
-    //set up analog input on RC0 AN4 (IV) - range 0- 3.2V = 0 - 10.5A
-    ADCON0 = 0b10010001; // right justified, VDD volt ref, channel AN4, 
-                         // not in progress, ADC on
-    __delay_ms(5);
-    ADCON0bits.GO_nDONE = HIGH; // start the ADC
-    while (ADCON0bits.GO_nDONE) {}; //wait for the conversion
-    return (ADRESL | (ADRESH<<8));
+    //analog input on RC0 AN4 (IV) - range 0- 3.2V = 0 - 10.5A
+    return ReadADC(ADC_IV);
 };
 
 /*
@@ -663,44 +1848,395 @@ int CheckIV (){
  * 
  * It prevents all motor control till the voltage from the mains is available
  * 
+ * The reading comes from the ADC sequencer so this never waits.  Note the 
+ * data acquisition time is estimated at 4.4us per bit on page 114 - there 
+ * is an error on that page as it changes from us in the derivation to ms in 
+ * the final formula.  Looking at page 250 Tacq is 5us.
  * 
  */
 int CheckHV (){  
+    //analog input on RC1 AN5 (HV) 
     // 16 bits is plenty, 8 is too few as maxes out at 255
-    // steps as per sect 9.2.6 page 109
-    ADRESL = 0x00;
-    ADRESH = 0x00;
-    // turn off the ADC before making changes
-    ADCON0bits.ADON = 0x0;
-     
-    //step 1
-    //done in main program
+    return ReadADC(ADC_HV);
+};
+
+/*
+ * Motor power - MV x IV from the latest samples, the top 8 bits of each.  
+ * With POWER_LIMIT a tick over the power or current limit takes the duty 
+ * ceiling down from where the duty is now, 1 count plus 1 per 36W or 
+ * 0.26A over, and pulls the ramp down with it.  Otherwise the ceiling 
+ * creeps back up a count a tick.  See PF906header.h
+ */
+void CheckPower(void) {
+    uint16_t iv = ReadADC(ADC_IV);
+    uint16_t mv = ReadADC(ADC_MV);
+#if POWER_LIMIT
+    uint16_t down = 0;
+#endif
     
-    //step 2
-    //ADC clock set in main program
-    //set up analog input on RC1 AN5 (HV) 
-    ADCON0 = 0b10010101; // right justified, VDD volt ref, channel AN5, 
-                         // not in progress, ADC on
+    motorPower = Mul8((uint8_t)(mv >> 2), (uint8_t)(iv >> 2));
+#if POWER_LIMIT
+    if (motorPower > POWER_W_TO_UNITS(POWER_LIMIT_W))
+        down = ((motorPower - POWER_W_TO_UNITS(POWER_LIMIT_W)) >> POWER_GAIN_SHIFT) + 1;
+    if (iv > POWER_IV_MAX && ((iv - POWER_IV_MAX) >> 4) >= down)
+        down = ((iv - POWER_IV_MAX) >> 4) + 1;
+    if (down) {
+        if (powerDuty > dutyApplied) powerDuty = dutyApplied;
+        powerDuty = powerDuty > down ? powerDuty - down : 0;
+        if (dutyRamp > powerDuty << RAMP_FRAC) dutyRamp = powerDuty << RAMP_FRAC;
+    } else if (powerDuty < dutyMax) {
+        ++powerDuty;
+    };
+#endif
+};
+
+#if IR_COMP
+/*
+ * IR compensation - irComp is IV x IR_COMP_K / 256 duty counts at 19.6kHz, 
+ * scaled to the PWM frequency, from IV filtered over 2^IR_COMP_SHIFT 
+ * ticks.  Held from a setpoint change till the speed is within 
+ * 1/2^IR_COMP_ARRIVE_SHIFT of it, 0 with the duty.  See PF906header.h
+ */
+void IRComp(void) {
+    uint16_t comp;
+    
+    irIv += ((int)(ReadADC(ADC_IV) << 4) - (int)irIv) >> IR_COMP_SHIFT;
+    if (dutyCycle == 0) {
+        irComp = 0;
+        return;
+    };
+    if (irHold) {
+        if (measuredSpeed < setpoint - (setpoint >> IR_COMP_ARRIVE_SHIFT)) return;
+        irHold = 0;
+    };
+    // 2 fraction bits of IV, so 12 bits x IR_COMP_K fits 16
+    comp = MULC((uint16_t)(irIv >> 2), IR_COMP_K) >> 10;
+    if (comp > IR_COMP_MAX) comp = IR_COMP_MAX;
+    // comp is the multiplier as it is only 5 bits
+    irComp = (uint8_t)((Mul8(dutyScale, (uint8_t)comp) + 32) >> 6);
+};
+#endif
+
+void SetDuty(uint16_t duty) {
+    // Get the lowest 2 bits
+    CCP1CONbits.DC1B = (duty & 0x3); 
+    // Get the rest of the bits and set the register
+    CCPR1L = (uint8_t)(duty >> 2);
+};
+
+uint16_t ClampDuty(int duty) {
+    if (duty < 0) return 0;
+    if (duty > (int)dutyMax) return dutyMax;
+    return (uint16_t)duty;
+};
+
+#if PWM_PR2_EE
+/*
+ * The duty constants are counts at 19.6kHz, 408 full scale.  At PR2 the 
+ * full scale is 4*(PR2+1), so each is worked out again here once the 
+ * parameters are loaded - the divides only run the once.  dutyMax is done 
+ * exactly so the ceiling stays at 56%, and the ramp rates at least 1 so a 
+ * ramp still gets there.  At 19.6kHz they all come out as they are.  
+ * Without PWM_PR2_EE the compiler does the same with DUTY_SCALE and on.
+ */
+void SetupDuty(void) {
+    uint16_t periods = pwmPr2 + 1;
     
+    dutyScale = (uint8_t)((periods * 64 + (PWM_REF_PR2 + 1) / 2) / (PWM_REF_PR2 + 1));
+    dutyMax = (periods * DUTY_MAX + (PWM_REF_PR2 + 1) / 2) / (PWM_REF_PR2 + 1);
+    dutyStall = ScaleDuty(FAULT_STALL_DUTY);
+    rampAccel = ScaleDuty(RAMP_ACCEL);
+    if (RAMP_ACCEL && !rampAccel) rampAccel = 1;
+    rampDecel = ScaleDuty(RAMP_DECEL);
+    if (RAMP_DECEL && !rampDecel) rampDecel = 1;
+#if POWER_LIMIT
+    powerDuty = dutyMax;
+#endif
+};
+#endif
+
+/*
+ * Counts at 19.6kHz to counts at this PWM frequency, either sign - 16x8 
+ * by dutyScale and round, or shifts and adds by the constant DUTY_SCALE 
+ * (none at all at 19.6kHz).  For the PID and a setpoint change, not every 
+ * tick.
+ */
+int ScaleDuty(int duty) {
+#if PWM_PR2_EE
+    if (duty < 0) return -(int)((Mul16x8((uint16_t)-duty, dutyScale) + 32) >> 6);
+    return (int)((Mul16x8((uint16_t)duty, dutyScale) + 32) >> 6);
+#elif DUTY_SCALE == 64
+    return duty;
+#else
+    if (duty < 0) return -(int)((MULC((uint24_t)(uint16_t)-duty, DUTY_SCALE) + 32) >> 6);
+    return (int)((MULC((uint24_t)(uint16_t)duty, DUTY_SCALE) + 32) >> 6);
+#endif
+};
 
-    // step 3 not used
+/*
+ * Duty ramp - called every TaskPWM tick with the wanted duty and returns 
+ * the duty to send, which moves at most rampAccel or rampDecel (x64) per 
+ * tick.  So a press from 0 to step 11, or the PID jumping, never puts a 
+ * step on the IGBTs, caps and belt.  See PF906header.h
+ * 
+ * With RAMP_S_CURVE the slope itself starts at 1 and grows by 1 every 
+ * 2^RAMP_JERK_SHIFT ticks up to the limit.  It starts easing off again 
+ * once the distance left is no more than it takes to bring the slope back 
+ * down to 1:
+ * 
+ *   (rate + (rate-1) + ... + 1) x 2^RAMP_JERK_SHIFT = rate(rate+1)/2 << shift
+ * 
+ * rate is at most 8 bits so that is an 8x8 multiply.
+ */
+uint16_t RampDuty(uint16_t target) {
+    uint16_t want = target << RAMP_FRAC;
+    uint16_t dist, step;
+#if RAMP_S_CURVE
+    int8_t dir;
+    uint8_t limit;
+    
+    if (want > dutyRamp) {
+        dir = 1;
+        dist = want - dutyRamp;
+        limit = rampAccel;
+    } else {
+        dir = -1;
+        dist = dutyRamp - want;
+        limit = rampDecel;
+    };
+    if (dist == 0) {
+        rampDir = 0;
+        rampBusy = 0;
+        return target;
+    };
+    if (dir != rampDir) { // new ramp, or turned round - start gently
+        rampDir = dir;
+        rampRate = 1;
+        rampJerk = 0;
+    };
+    if (++rampJerk >= (1 << RAMP_JERK_SHIFT)) {
+        rampJerk = 0;
+        if (dist <= (Mul8((uint8_t)rampRate, (uint8_t)(rampRate + 1)) >> 1) 
+                    << RAMP_JERK_SHIFT) {
+            if (rampRate > 1) --rampRate;
+        } else if (rampRate < limit) {
+            ++rampRate;
+        };
+        if (rampRate > limit) rampRate = limit; // the limit just dropped
+    };
+    step = rampRate;
+#else
+    if (want > dutyRamp) {
+        dist = want - dutyRamp;
+        step = rampAccel;
+    } else {
+        dist = dutyRamp - want;
+        step = rampDecel;
+    };
+    if (step == 0) step = dist; // no limit
+#endif
+    if (dist <= step) {
+        dutyRamp = want; // there
+        rampBusy = 0;
+    } else {
+        if (want > dutyRamp) dutyRamp += step;
+        else dutyRamp -= step;
+        rampBusy = 1;
+    };
+    // round to the nearest duty count
+    return (dutyRamp + (1 << (RAMP_FRAC - 1))) >> RAMP_FRAC;
+};
 
-    // step 4
-    __delay_ms(5); // data acquisition time is estimated at 4.4us per bit
-    // there is a error on this page (114) as it changes from us in the 
-    // derivation to ms in the final formula.  Looking at page 250 Tacq is 
-    // 5us 
+/*
+ * Closed loop speed control - called once per Timer 1 window with the 
+ * measured speed in pulses per 0.1s x16.
+ * 
+ * The output is the open loop duty for the setpoint (feed forward) plus 
+ * the PID correction, so the PID only has to make up for the load.  
+ * Everything is integer and the gains are shifts - see PF906header.h.  
+ * The gains were set at 19.6kHz, so the correction and the integral are 
+ * duty counts at that frequency and the correction is scaled to the one in 
+ * use, which keeps the loop gain the same.
+ * 
+ * Anti-windup: the integral stops growing while the output (with any IR 
+ * compensation on top) is pinned at 0 or dutyMax in the direction of the 
+ * error, or the duty ramp has not yet caught up with it, and is clamped to 
+ * the duty range so it can never hold more correction than could be 
+ * applied.
+ */
+uint16_t SpeedPID(uint16_t speed) {
+    int error, p, d, out;
     
-    //step 5 - start the ADC
-    ADCON0bits.GO_nDONE = HIGH;
+    if (setpoint == 0) { // motor off - nothing to regulate
+        speedIntegral = 0;
+        lastSpeed = speed;
+        return 0;
+    };
     
-    //step 6 - wait for the conversion
-    while (ADCON0bits.GO_nDONE) {};  
+    // error x16, so the fraction from the M/T method is not lost
+    error = (int)setpoint - (int)speed;
+    p = error >> (params.pidKp + 4);
+    d = ((int)speed - (int)lastSpeed) >> (params.pidKd + 4);
+    lastSpeed = speed;
     
-    //step 7    
-    return (ADRESL | (ADRESH<<8));  
+    out = setpointDuty + ScaleDuty(p - d + (speedIntegral >> PID_I_FRAC));
+    // and while the ramp is still catching up with the last output or the 
+    // current has been limited
+    if (!rampBusy && !ocTripSeen && !powerLimited && 
+        !((out + irComp >= (int)dutyMax && error > 0) || (out <= 0 && error < 0))) {
+        speedIntegral = AddSatS16(speedIntegral, error >> (params.pidKi + 4 - PID_I_FRAC));
+        if (speedIntegral > (DUTY_MAX << PID_I_FRAC)) 
+            speedIntegral = DUTY_MAX << PID_I_FRAC;
+        if (speedIntegral < -(DUTY_MAX << PID_I_FRAC)) 
+            speedIntegral = -(DUTY_MAX << PID_I_FRAC);
+    };
+    out = setpointDuty + ScaleDuty(p - d + (speedIntegral >> PID_I_FRAC));
+    ocTripSeen = 0;
+    powerLimited = 0;
+    
+    return ClampDuty(out);
+};
+
+#if SPEED_MEASURE_MT
+/*
+ * M/T speed measurement - the ISR records how many slots have gone past 
+ * and the 24 bit Timer 1 time of the most recent one.  Once MT_SLOTS more 
+ * slots and at least MT_MIN_TICKS have passed since the start of the 
+ * estimate, the speed is the slot count over the time between the first 
+ * and last slot, so there is no +-1 count error like a gated count has:
+ * 
+ *   pulses per 0.1s x16 = slots * 16 * 200000 / ticks
+ * 
+ * The last slot of one estimate is the first of the next so no time is 
+ * lost between them.  No slot for MT_STALE Timer 1 overflows means the 
+ * motor has stopped (below ~25RPM).
+ */
+void MeasureSpeedMT(void) {
+    uint16_t count, slots;
+    uint32_t t, ticks;
+    uint8_t ext;
+
+    // take a consistent copy of what the ISR has recorded
+    PIE2bits.C1IE = LOW;
+    count = mtEdgeCount;
+    t = mtEdgeTicks;
+    ext = mtEdgeExt;
+    PIE2bits.C1IE = HIGH;
+    t |= (uint32_t)ext << 16;
+
+    if ((int8_t)(tmr1Overflows - ext) >= MT_STALE) {
+        measuredSpeed = 0;
+        mtRestart = 1;
+        mtStartCount = count;
+        return;
+    };
+    slots = count - mtStartCount;
+    if (slots == 0) return;
+    if (mtRestart) { // first slot after a stop starts the estimate
+        mtRestart = 0;
+        mtStartCount = count;
+        mtStartTime = t;
+        return;
+    };
+    ticks = (t - mtStartTime) & 0xFFFFFF;
+    if (slots < MT_SLOTS || ticks < MT_MIN_TICKS) return;
 
+    // slots x 3200000 / ticks, rounded - MT_SLOTS to a few more at 4ms 
+    // is nowhere near 8 bits of slots
+    measuredSpeed = TachSpeed((uint8_t)slots, ticks);
+    mtStartCount = count;
+    mtStartTime = t;
+    SIM_MARK(SIM_MARK_SPEED);
 };
+#endif
+
+#if OC_TRIP
+/*
+ * Overcurrent trip - comparator 2 watches the motor current and the ECCP 
+ * auto-shutdown turns the MOSFETs off in hardware the moment it goes over, 
+ * with no code in the path.  See OC_TRIP in PF906header.h.
+ * 
+ * HARDWARE MOD: IV is on RC0 which is C2IN+, and the C2 reference CVREF 
+ * can only go to the + input, so IV has to be on a C12INx- pin.  Jumper 
+ * IV over to RC2 (C12IN2-) and lift FR4 off it.
+ * 
+ * C2:  + = C2VREF = CVREF (VRCON C2VREN, VR<3:0> = OC_VR high range)
+ *      - = C12IN2- = IV on RC2
+ *      inverted so C2OUT is high when IV > CVREF
+ * 
+ *  refer register 8.2 page 97
+ *              bits   7  6  5  4  3  2  1  0
+ *  CM2CON0          = 1  0  0  1  0  1  1  0 - on, inverted, pin off, 
+ *                                               C2VREF, C12IN2-
+ *  refer register 8.5 page 104
+ *  VRCON            = 0  1  0  1  (OC_VR) - C2VREN, high range, 0.6V ref 
+ *                                            still on for comparator 1
+ *  refer register 11.3 page 140
+ *  ECCPAS           = 0  0  1  0  0  1  0  0 - shut down on C2 high, 
+ *                                               P1A driven high (MOSFETs off)
+ *  refer register 11.2 page 141
+ *  PWM1CON          = PRSEN (bit 7) set for OC_CYCLE_LIMIT
+ * 
+ * With OC_CYCLE_LIMIT the ECCP restarts itself at the next PWM period once 
+ * the current is back under, so it limits the current pulse by pulse.  
+ * Otherwise it stays off and CheckOvercurrent restarts it.
+ * 
+ * C2IF is polled each tick to count trips rather than interrupting, as in 
+ * current limit it would fire every PWM period.
+ */
+void setupOvercurrent(void) {
+    ANSELbits.ANS6 = 0x01; // IV on RC2 is now analog
+    VRCON = 0b01010000 | OC_VR;
+    CM2CON0 = 0b10010110;
+    __delay_us(10); // comparator and CVREF settling, page 247
+    PIR2bits.C2IF = LOW;
+    PIE2bits.C2IE = LOW;
+#if OC_CYCLE_LIMIT
+    PWM1CON = 0b10000000;
+#else
+    PWM1CON = 0b00000000;
+#endif
+    ECCPAS = 0b00100100;
+};
+
+/*
+ * Called every tick.  Counts ticks in which C2 changed (it went over, or 
+ * came back under after going over).  In latch mode, a shut down ECCP is 
+ * restarted after OC_RETRY_TICKS from 0 duty, up the ramp, as long as the 
+ * current has dropped.  More than OC_RETRY_MAX restarts without 
+ * OC_CLEAN_TICKS of clean running in between sets ocLatched, which stops 
+ * the motor for good.
+ */
+void CheckOvercurrent(void) {
+    if (PIR2bits.C2IF) {
+        PIR2bits.C2IF = LOW;
+        if (ocTrips != 0xFFFF) ++ocTrips;
+        ocTripSeen = 1;
+#if !OC_CYCLE_LIMIT
+        ocClean = 0;
+    } else if (ocClean < OC_CLEAN_TICKS) {
+        ++ocClean;
+    } else {
+        ocRetries = 0; // ran clean long enough, forget the old trips
+#endif
+    };
+#if !OC_CYCLE_LIMIT
+    if (ocLatched || !ECCPASbits.ECCPASE) return;
+    dutyRamp = 0; // the restart comes up the ramp
+    if (ocWait == 0) { // just tripped
+        if (++ocRetries > OC_RETRY_MAX) {
+            ocLatched = 1;
+            return;
+        };
+        ocWait = OC_RETRY_TICKS;
+    };
+    if (--ocWait == 0) {
+        if (CM2CON1bits.MC2OUT) ocWait = 1; // still over, wait on
+        else ECCPASbits.ECCPASE = LOW; // restart
+    };
+#endif
+};
+#endif
 
 void setupactualSpeedPulses() {  
 /* 
@@ -721,8 +2257,8 @@ void setupactualSpeedPulses() {
  * 
  * The comparator output is triggered when the RPM signal exceeds 0.6V
  * and the interrupt is triggered by the change of the comparator output, 
- * making it edge triggered.  Due to the 2 state changes per light pulse
- * the counter may count double what we want (TBC)
+ * making it edge triggered.  There are 2 state changes per light pulse so 
+ * the ISR only counts the change to a high output, ie 1 count per slot
  * 
  * Side note, the motor is rated at 4700rpm, so limiting the max controlled 
  * speed to 4500rpm for a little margin and a convenient multiple of 350
@@ -785,9 +2321,10 @@ void startPWM(){
      * thus PR2 = 2000000/19000 - 1 = (rounded) 103 = 67h, say 65h
      * OR PR2 = 2000000/31000 - 1 = 63 = 3Fh for 31kHz
      * 
-     * Also refer spreadsheet extract above
+     * Also refer spreadsheet extract above.  It is PWM_PR2, or with 
+     * PWM_PR2_EE pwmPr2 if the data EEPROM says otherwise
      */
-    PR2 = 0x65;     // set the PWM period (ie frequency) ~19kHz
+    PR2 = PWM_PR2_USED;  // set the PWM period (ie frequency) ~19kHz
     
     //step 3
     /*
@@ -828,6 +2365,10 @@ void startPWM(){
      * 
      */
     T2CONbits.T2CKPS = 0x00; // timer 2 prescale set to 1x
+    // and the postscaler paces the ADC sequencer, it does not affect the PWM - 
+    // the nearest to ADC_PERIOD_CYCLES, 12 at the most over PWM_PR2_MIN
+    T2CONbits.TOUTPS = (uint8_t)((ADC_PERIOD_CYCLES + (PWM_PR2_USED + 1) / 2) / 
+                                 (PWM_PR2_USED + 1)) - 1;
     
     //turn TMR2 on
     T2CONbits.TMR2ON = 0x01; 
@@ -843,26 +2384,180 @@ void startPWM(){
     };
 
     
+#if ISR_PROFILE
+// a path starts and ends - Timer 2 counts cycles from 0 to PR2
+#define ISR_PATH_START() (isrStart = TMR2)
+#define ISR_PATH_END(path) {                                           \
+        isrTime = TMR2 - isrStart;                                     \
+        if (isrTime > PWM_PR2_USED) isrTime += PWM_PR2_USED + 1;       \
+        ++isrCount[path];                                              \
+        isrCycles[path] += isrTime;                                    \
+        if (isrTime > isrMax[path]) isrMax[path] = isrTime;            \
+    }
+#else
+#define ISR_PATH_START()
+#define ISR_PATH_END(path)
+#endif
+
+/*
+ * The ISR takes every source that is pending in one pass, most frequent 
+ * first.  The tach edge leads because there are 5400 a second at 4500RPM 
+ * and the M/T timestamp is only as steady as the time it takes to get to 
+ * it.  Each test is on the flag first, which is clear nearly every time, so 
+ * the enable bit is only looked at when there is something to do.  GIE is 
+ * left alone - the PIC clears it on the way in and RETFIE sets it again.
+ */
 void __interrupt() Isr(void) {
-    // On PIC devices all the interrupts get handled by this ISR
-    // common code to all interrupts
+#if SPEED_MEASURE_MT
+    uint8_t hi;
+#else
+    uint8_t i;
+    uint16_t reload;
+#endif
+    uint16_t result;
+#if ISR_PROFILE
+    uint8_t isrStart, isrTime;
+#endif
     
-    INTCONbits.GIE = LOW; // disable all interrupts in this routine as we are 
-                           // already responding to an interrupt
-        
     // this is the ISR for the RPM counter on Comparator 1 Interrupt flag
-    if (PIE2bits.C1IE && PIR2bits.C1IF) { 
-        ++actualSpeedPulses;
+    if (PIR2bits.C1IF && PIE2bits.C1IE) { 
+        ISR_PATH_START();
+        // the flag sets on both edges - count only the rising one
+        if (CM2CON1bits.MC1OUT) {
+#if SPEED_MEASURE_MT
+            // timestamp the slot - reread if TMR1L carried into TMR1H
+            do {
+                hi = TMR1H;
+                mtEdgeTicks = TMR1L;
+            } while (hi != TMR1H);
+            mtEdgeTicks |= (uint16_t)hi << 8;
+            mtEdgeExt = tmr1Overflows;
+            // an overflow that is pending but not yet counted below
+            if (PIR1bits.TMR1IF && !(hi & 0x80)) ++mtEdgeExt;
+            ++mtEdgeCount;
+#else
+            ++actualSpeedPulses; // XC8 makes this incf, btfsc, incf
+#endif
+        };
         PIR2bits.C1IF = LOW; // reset the counter interrupt flag
+        ISR_PATH_END(ISR_PATH_TACH);
+    };
+    
+    // ADC sequencer - Timer 2 says it's time to convert the channel that 
+    // has been acquiring since the last result
+    if (PIR1bits.TMR2IF && PIE1bits.TMR2IE) {
+        ISR_PATH_START();
+#if ISR_PROFILE
+        // Timer 2 restarted from 0 as it set the flag
+        if (isrStart > isrLatencyMax) isrLatencyMax = isrStart;
+#endif
+        ADCON0bits.GO_nDONE = HIGH;
+        PIR1bits.TMR2IF = LOW;
+        ISR_PATH_END(ISR_PATH_ADC_GO);
+    };
+    
+    // ADC conversion done - store it, add it to the oversampling and move 
+    // on to the next channel
+    if (PIR1bits.ADIF && PIE1bits.ADIE) {
+        ISR_PATH_START();
+        result = ADRESL | (ADRESH<<8);
+        adcSample[adcChannel] = result;
+        adcSum[adcChannel] += result;
+        if (!(++adcCount[adcChannel] & (ADC_OVERSAMPLE - 1))) {
+            adcDecimated[adcChannel] = adcSum[adcChannel] >> ADC_OVERSAMPLE_SHIFT;
+            adcSum[adcChannel] = 0;
+        };
+        if (++adcChannel == ADC_CHANNELS) adcChannel = 0;
+        ADCON0 = adcChannelSel[adcChannel];
+        PIR1bits.ADIF = LOW;
+        ISR_PATH_END(ISR_PATH_ADC);
+    };
+    
+    // scheduler tick - TMR0 has counted on from 0 since it rolled over, so 
+    // add the reload to keep the ticks from drifting
+    if (INTCONbits.T0IF && INTCONbits.T0IE) {
+        ISR_PATH_START();
+        TMR0 += TICK_RELOAD;
+        ++tickCount;
+#if !ADC_SYNC_PWM
+        // a conversion every tick, at a different point of the PWM period 
+        // each time - the channel has had the whole tick to acquire
+        ADCON0bits.GO_nDONE = HIGH;
+#endif
+#if TELEMETRY
+        // the next telemetry bit to FR6, here so that the bit times do not 
+        // move about with the tasks
+        if (txBits) {
+            FR6out = txShift & 1;
+            txShift >>= 1;
+            --txBits;
+        };
+#endif
+#if TACH_OUT
+        // the tach output, steady with the tick and nothing on the tach edge
+        tachPhase += tachStep;
+        if (tachPhase >= TACH_OUT_HALF) {
+            tachPhase -= TACH_OUT_HALF;
+            FR6out = !FR6out;
+        };
+#endif
+        INTCONbits.T0IF = LOW;
+        ISR_PATH_END(ISR_PATH_TICK);
     };
     
     // this is the ISR for Timer1 - the RPM cycle timer
-    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF) { 
-        //turn off comparator 1
-        CM1CON0bits.C1ON = LOW; //actualSpeedPulses is now a valid count
-        T1CONbits.TMR1ON = LOW; //turn the timer off again
-        // note reset the timer 1 interrupt in the main loop to allow the 
-        //read of the data and other calcs to get RPM
+    if (PIR1bits.TMR1IF && PIE1bits.TMR1IE) { 
+        ISR_PATH_START();
+#if SPEED_MEASURE_MT
+        ++tmr1Overflows;
+        ++speedSeq;
+        PIR1bits.TMR1IF = LOW;
+#else
+        // 0.1s is up - add the reload to the ticks counted since the 
+        // overflow so the windows do not drift (see SPEED_WINDOW_RELOAD)
+        T1CONbits.TMR1ON = LOW;
+        reload = TMR1L + (uint8_t)(SPEED_WINDOW_RELOAD + SPEED_WINDOW_STOP);
+        TMR1L = (uint8_t)reload;
+        TMR1H += (uint8_t)((SPEED_WINDOW_RELOAD + SPEED_WINDOW_STOP) >> 8) + 
+                 (uint8_t)(reload >> 8);
+        T1CONbits.TMR1ON = HIGH;
+        // latch the count into the buffer the main loop is not reading, 
+        // then publish it
+        i = (speedSeq + 1) & 1;
+        speedSnapL[i] = (uint8_t)actualSpeedPulses;
+        speedSnapH[i] = (uint8_t)(actualSpeedPulses >> 8);
+        actualSpeedPulses = 0;
+        ++speedSeq;
+        PIR1bits.TMR1IF = LOW;
+#endif
+        ISR_PATH_END(ISR_PATH_WINDOW);
+    };
+    
+    // data EEPROM - the last byte is written (or the main code is starting 
+    // a block), so start the next.  A byte that is already right is skipped 
+    // by setting EEIF again, so the ISR only ever looks at one at a time
+    if (PIR2bits.EEIF && PIE2bits.EEIE) {
+        ISR_PATH_START();
+        PIR2bits.EEIF = LOW;
+        if (eeLeft) {
+            --eeLeft;
+            EEADR = eeAddr++;
+            // data EEPROM, not program memory, for the read and the write
+            EECON1bits.EEPGD = LOW;
+            EECON1bits.RD = HIGH;
+            if (EEDAT == *eeSrc) {
+                PIR2bits.EEIF = HIGH;
+            } else {
+                EEDAT = *eeSrc;
+                EECON1bits.WREN = HIGH;
+                EECON2 = 0x55; // the unlock sequence, page 121
+                EECON2 = 0xAA;
+                EECON1bits.WR = HIGH;
+                EECON1bits.WREN = LOW;
+            };
+            ++eeSrc;
+        };
+        ISR_PATH_END(ISR_PATH_EEPROM);
     };
     
     
@@ -882,10 +2577,6 @@ void __interrupt() Isr(void) {
 //        };
 //        INTCONbits.RABIF = 0x00; // reset the interrupt
 //    };
-   
-    // this is the ISR for the Timer 0 overflow IF
-    
-//    INTCONbits.GIE = 0x01; //enable all interrupts again
 };
 
 
@@ -56,7 +56,665 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>  // allows uint_8t style
+#include <stddef.h>  // offsetof
 // #include <stdbool.h>
 #include <pic16f690.h>
 
-#define _XTAL_FREQ 8000000  // not that this is the clock speed but the instruction cycle is 1/4 of this page 239 note 1
\ No newline at end of file
+#define _XTAL_FREQ 8000000  // not that this is the clock speed but the instruction cycle is 1/4 of this page 239 note 1
+
+/*
+ * ADC sequencer - Timer 2 (the PWM time base) sets TMR2IF every few PWM 
+ * periods and each one starts a conversion.  startPWM() sets the 
+ * postscaler to the nearest to ADC_PERIOD_CYCLES whatever the PWM 
+ * frequency, 1:6 at 19.6kHz.  The channels MV, IV, HV are converted in 
+ * turn, so each channel is sampled every 3 x 306us = 918us, ~1.09kHz.  The 
+ * next channel is selected as soon as a result is in, so it gets ~300us to 
+ * acquire against the 5us Tacq on page 250.
+ */
+#define ADC_PERIOD_CYCLES 612 // Tcy between conversions
+
+/*
+ * ADC filtering - the ISR adds up 4^ADC_OVERSAMPLE_SHIFT results of each 
+ * channel and shifts the sum down ADC_OVERSAMPLE_SHIFT bits, which gives 
+ * 10 + ADC_OVERSAMPLE_SHIFT bits as long as there is about 1 count of 
+ * noise or ripple to spread the results.  16 results (12 bits) take 14.7ms 
+ * per channel at 1:6.  TaskADC then runs each new IV and MV value through 
+ * a first order IIR, y += (x - y) / 2^ADC_IIR_SHIFT, which takes 
+ * 2^ADC_IIR_SHIFT values to get 63% of the way to a step.  The filter is 
+ * kept with ADC_IIR_FRAC fraction bits so it still fits in 15 bits.  All 
+ * of it is adds and shifts.
+ * 
+ * ADC_SYNC_PWM 1 starts every conversion on TMR2IF, the start of a PWM 
+ * period, so each result sees the same point of the chopped waveform - 
+ * steady, but the motor current is at the bottom of its ripple then.  
+ * ADC_SYNC_PWM 0 starts them from the 1ms tick instead, which is not a 
+ * whole number of PWM periods so the results land all over the period and 
+ * the oversampling averages the ripple out.  That is a third of the 
+ * samples (333Hz per channel) but saves the Timer 2 interrupts.
+ */
+#ifndef ADC_OVERSAMPLE_SHIFT
+#define ADC_OVERSAMPLE_SHIFT 2  // 0..3
+#endif
+#ifndef ADC_IIR_SHIFT
+#define ADC_IIR_SHIFT   2
+#endif
+#ifndef ADC_SYNC_PWM
+#define ADC_SYNC_PWM    1
+#endif
+#define ADC_OVERSAMPLE  (1 << (2 * ADC_OVERSAMPLE_SHIFT))
+#define ADC_BITS        (10 + ADC_OVERSAMPLE_SHIFT)
+#define ADC_IIR_FRAC    (15 - ADC_BITS)
+#if ADC_OVERSAMPLE_SHIFT > 3
+#error ADC_OVERSAMPLE_SHIFT over 3 overflows the 16 bit sums
+#endif
+
+/*
+ * Scheduler - Timer 0 with a 1:8 prescaler counts 4us steps and is reloaded 
+ * in the ISR to overflow every 250 steps, a 1ms tick.  Writing TMR0 clears 
+ * the prescaler and stops the count for 2 cycles, losing ~5 cycles on 
+ * average, so the reload is one step short to make up for it.
+ * 
+ * The tasks run from the main code at fixed multiples of the tick.  With 
+ * RUN_STATS each keeps its worst case run time and how late it started 
+ * after its tick (jitter), both in 4us Timer 0 steps, and its overruns, 
+ * and TaskPower times its states.  That is for the host simulation's 
+ * reports - the RAM is wanted on the PIC, so it is off in the real build.
+ */
+#ifndef RUN_STATS
+#define RUN_STATS       0
+#endif
+#define TICK_STEPS      250   // Timer 0 steps per tick
+#define TICK_RELOAD     (256 - TICK_STEPS + 1)
+
+/*
+ * Interrupt profile - with ISR_PROFILE 1 the ISR times each of its paths 
+ * with Timer 2, which counts Tcy from 0 to PR2 for the PWM, and keeps 
+ * how often each ran, its worst case and its total cycles (isrCount, 
+ * isrMax, isrCycles).  A path is well under a PWM period so Timer 2 wraps 
+ * at most once.  isrLatencyMax is the most cycles from Timer 2 setting 
+ * TMR2IF to the ADC start path running, the worst an interrupt waits for 
+ * the ones ahead of it.  The timing costs ~10 cycles a path, so it is off 
+ * in the real build.
+ */
+#ifndef ISR_PROFILE
+#define ISR_PROFILE     0
+#endif
+#define ISR_PATH_TACH   0     // comparator 1 - a tach edge
+#define ISR_PATH_ADC_GO 1     // Timer 2 - start a conversion
+#define ISR_PATH_ADC    2     // conversion done
+#define ISR_PATH_TICK   3     // Timer 0 - scheduler tick
+#define ISR_PATH_WINDOW 4     // Timer 1 - speed window or M/T overflow
+#define ISR_PATH_EEPROM 5     // EEIF - the next data EEPROM byte
+#define ISR_PATHS       6
+
+#define TASKS               8
+#define TASK_BUTTONS_TICKS  2    // button sampling, 4 samples debounce = 8ms
+#define TASK_SPEED_TICKS    1    // speed measurement and PID
+#define TASK_PWM_TICKS      1    // duty cycle to CCPR1L:DC1B
+#define TASK_ADC_TICKS      5    // HV, IV, MV from the ADC sequencer
+#define TASK_LED_TICKS      50   // LED1 flash pattern, FlashLED1 units
+#define TASK_FAULT_TICKS    1    // fault supervisor
+#define TASK_POWER_TICKS    1    // power sequence state machine
+#define TASK_TELEMETRY_TICKS 1   // next telemetry byte to the ISR
+
+/*
+ * Power sequence states, stepped by TaskPower - see there for what each 
+ * one waits for.  A clean stop goes back to ARMED, or with power let go 
+ * to PRECHARGE ready to re-arm.  Only FAULT needs a power cycle.
+ */
+#define POWER_PRECHARGE     0
+#define POWER_RELAY_SETTLE  1
+#define POWER_ARMED         2
+#define POWER_RUN           3
+#define POWER_STOPPING      4
+#define POWER_FAULT         5
+#define POWER_STATES        6
+#define RELAY_SETTLE_TICKS  100   // RLA2 bounce and the caps topping up
+
+/*
+ * Tach output on FR6 (RA1, the feedback opto) - TACH_OUT 1 puts a square 
+ * wave of TACH_OUT_PPR cycles a revolution on FR6 for a counter or DRO, 
+ * in place of the telemetry.  It is not the tach edges passed on, which 
+ * would put more in the comparator ISR 5400 times a second at 4500RPM, 
+ * but made from measuredSpeed by the 1ms tick: each tick the ISR adds 
+ * measuredSpeed x TACH_OUT_PPR to a phase and FR6 changes each time that 
+ * passes TACH_OUT_HALF.  measuredSpeed is slots per 0.1s x16, so with 36 
+ * slots a revolution a millisecond at speed s is s / 57600 of one - 
+ * exact with no divide.  An edge can be up to a tick late, but a count 
+ * over any gate is right to a pulse, as good as the speed measurement, 
+ * and it follows each new reading.  At most one change a tick is 500Hz, 
+ * the overspeed trip at 6 cycles a revolution.
+ */
+#ifndef TACH_OUT
+#define TACH_OUT        0
+#endif
+#ifndef TACH_OUT_PPR
+#define TACH_OUT_PPR    1     // cycles per revolution
+#endif
+#define TACH_OUT_HALF   28800 // half a cycle, 57600 a revolution / 2
+#define TACH_OUT_SPEED_MAX (TACH_OUT_HALF / TACH_OUT_PPR) // FR6 changes every tick
+#if TACH_OUT_PPR < 1 || TACH_OUT_PPR > 6
+#error TACH_OUT_PPR must be 1..6 (over 6 is past 500Hz below the overspeed trip)
+#endif
+
+/*
+ * Telemetry on FR6 (RA1, the feedback opto) - the Timer 0 ISR shifts out 
+ * one bit per tick, so it is 1000 baud async serial, 8 data bits LSB 
+ * first, 1 start (opto on) and 1 stop bit (opto off, the idle level).  
+ * Every TELEMETRY_TICKS TaskTelemetry takes a snapshot and sends this 
+ * 13 byte frame, little endian:
+ * 
+ *   0     0xA5 sync
+ *   1     sequence number, +1 each frame
+ *   2-3   measuredSpeed, pulses per 0.1s x16
+ *   4-5   bits 0-9 duty sent to CCPR1L:DC1B, 10-12 faultCode, 
+ *         13-15 powerState
+ *   6-9   bits 0-9 HV, 10-19 IV, 20-29 MV (ADC counts), bit 30 the 
+ *         POWER_LIMIT ceiling is holding the duty down
+ *   10-11 motorPower, 0.0697W units
+ *   12    checksum, all 13 bytes add up to 0
+ * 
+ * That is 130ms of the 200ms between frames.  host/fr6decode turns a 
+ * capture of the FR6 opto into CSV.  TELEMETRY 0 leaves FR6 idle.  It is 
+ * off by default with TACH_OUT.
+ */
+#ifndef TELEMETRY
+#define TELEMETRY       (!TACH_OUT)
+#endif
+#if TELEMETRY && TACH_OUT
+#error FR6 carries the telemetry or the tach output, not both
+#endif
+#define TELEMETRY_TICKS 200   // 5 frames a second
+#define TELEMETRY_SYNC  0xA5
+#define TELEMETRY_BYTES 13
+
+/*
+ * Predictive precharge - rather than waiting for HV to pass the fixed 
+ * TestVoltage, PrechargeFit() averages HV over windows of 
+ * 2^PRECHARGE_WINDOW_SHIFT ticks and fits the R55/cap RC curve to the last 
+ * 3 averages.  That predicts the voltage the caps are heading for (the 
+ * rectified mains), so the relay closes as soon as the step from the bus 
+ * to the mains would give an inrush inside the RLA2 rating:
+ * 
+ *   peak  = dV / RELAY_PATH                   <= RELAY_PEAK_A
+ *   I^2t  = C dV^2 / (2 RELAY_PATH),  C = tau / R55  <= RELAY_I2T
+ * 
+ * The first fit is ready after 3 windows (~12s).  A curve that does not 
+ * rise (R55 open, a shorted cap, no mains), a time constant out of range 
+ * (caps lost or the wrong resistor) or too low a final voltage (low mains, 
+ * leaky caps) is the charge fault, FAULT_CHARGE.
+ * 
+ * PRECHARGE_FIT 0 goes back to the fixed TestVoltage.
+ */
+#ifndef PRECHARGE_FIT
+#define PRECHARGE_FIT   1
+#endif
+#define PRECHARGE_WINDOW_SHIFT 12    // 4096 ticks, 4.1s per HV average
+#define RELAY_PEAK_A        270
+#define RELAY_I2T           3969UL   // A^2s, see TaskPower
+#define RELAY_PATH_MOHM     500      // mains, bridge and wiring to the caps
+#define R55_KOHM            47
+#define HV_COUNTS(v)        ((v) * 2685L / 1000)  // 4.2V at 320V
+// 5% under the peak rating for the error in the fit
+#define PRECHARGE_DV_MAX    HV_COUNTS(RELAY_PEAK_A * 95L * RELAY_PATH_MOHM / 100000)
+// 2 x RELAY_PATH x R55 x RELAY_I2T in HV counts^2 s, (2.685 counts/V)^2 
+#define PRECHARGE_I2T_K     (2UL * RELAY_PATH_MOHM * R55_KOHM * RELAY_I2T / 1000 * 7209)
+#define PRECHARGE_MIN_RISE  256      // counts x256 a window, less is not charging
+#define PRECHARGE_RATIO_MIN 3337     // e^-(window/tau) x4096, tau 20s
+#define PRECHARGE_RATIO_MAX 3986     // tau 150s
+#define PRECHARGE_MIN_FINAL HV_COUNTS(240)
+
+/*
+ * Buttons - all 5 inputs are debounced together in TaskButtons.  A change 
+ * is accepted after 4 steady samples, so the debounce time is set by 
+ * TASK_BUTTONS_TICKS.  A button held with nothing else changing for 
+ * BUTTON_HOLD_SAMPLES gives a held event (max 254).
+ */
+#define BUTTON_HOLD_SAMPLES 250   // 0.5s at 2ms
+
+/*
+ * Speed measurement - pick one
+ * 
+ * SPEED_MEASURE_MT 0 : count the tach pulses in a 0.1s Timer 1 window, the 
+ *                      original method.  60 counts at 1000RPM so 1 count is 
+ *                      1.7%, and a new reading only every 100ms
+ * SPEED_MEASURE_MT 1 : M/T method.  Timer 1 free runs at 2MHz and the 
+ *                      comparator ISR timestamps each slot.  The main loop 
+ *                      divides the slots seen by the time between the first 
+ *                      and last of them, so a new reading comes every 
+ *                      MT_SLOTS slots (but not sooner than MT_MIN_TICKS) 
+ *                      with 0.5us timing resolution
+ * 
+ * CCP1 would be the natural capture input but it is busy making the PWM, 
+ * so the timestamp is taken in software in the comparator interrupt.  An 
+ * edge that comes while the ISR is busy with something else waits up to 
+ * ~35us (see "make isr" in the host build), so the estimate spans at least 
+ * MT_MIN_TICKS to keep that jitter to ~0.35% at any speed.  The PID only 
+ * takes a reading every 32.8ms so the longer span costs it nothing.
+ */
+#ifndef SPEED_MEASURE_MT
+#define SPEED_MEASURE_MT 0
+#endif
+#define MT_SLOTS        4     // slots per estimate at least
+#define MT_MIN_TICKS    8000  // 4ms of Timer 1
+#define MT_STALE        2     // Timer 1 overflows (65ms) without a slot = stopped
+
+/*
+ * Gated count window - Timer 1 at 1:4 counts 50000 x 2us = 0.1s from the 
+ * reload to the overflow.  The ISR adds the reload to what Timer 1 has 
+ * counted since it overflowed rather than overwriting it, so the interrupt 
+ * latency does not stretch the window.  Timer 1 is stopped for the add and 
+ * writing it clears the prescaler, so SPEED_WINDOW_STOP puts back 
+ * the ticks that loses.
+ * 
+ * Each count is latched into one of 2 buffers with a sequence number, the 
+ * main loop reads the other one and checks the number has not moved 
+ * while it did (see ReadSpeedSnap()), so it never needs to mask the 
+ * interrupt and never sees half of one count and half of the next.
+ */
+#define SPEED_WINDOW_RELOAD (65536UL - 50000)
+#define SPEED_WINDOW_STOP   2     // Timer 1 ticks lost per reload
+
+/*
+ * Speed control tuning - closed loop PID on the measured speed
+ * 
+ * The PID runs once per 0.1s window, or once per 32.8ms Timer 1 overflow 
+ * with SPEED_MEASURE_MT, using the latest estimate.
+ * 
+ * The 16F690 has no hardware multiplier so the gains are powers of 2 and 
+ * are applied as shifts.  The error is in pulses per 0.1s window and the 
+ * output is in 10 bit duty cycle counts (CCPR1L:DC1B), so a gain of 1/2 
+ * means half a duty count per pulse of error.  Plant gain is roughly 1.2 
+ * pulses per duty count (270 pulses at 0xDC).
+ * 
+ * These are the defaults for params, the data EEPROM can change them.
+ * 
+ * The integral is kept x16 (4 fractional bits) so small errors still 
+ * accumulate.  The derivative acts on the measurement, not the error, so a 
+ * button press does not kick the output.
+ */
+#if SPEED_MEASURE_MT
+#ifndef PID_KP_SHIFT
+#define PID_KP_SHIFT    1   // Kp = 1/2 
+#endif
+#ifndef PID_KI_SHIFT
+#define PID_KI_SHIFT    3   // Ki = 1/8 per 32.8ms
+#endif
+#ifndef PID_KD_SHIFT
+#define PID_KD_SHIFT    3   // Kd = 1/8 
+#endif
+#else
+#ifndef PID_KP_SHIFT
+#define PID_KP_SHIFT    1   // Kp = 1/2 
+#endif
+#ifndef PID_KI_SHIFT
+#define PID_KI_SHIFT    2   // Ki = 1/4 per 0.1s window
+#endif
+#ifndef PID_KD_SHIFT
+#define PID_KD_SHIFT    2   // Kd = 1/4 
+#endif
+#endif
+#define PID_I_FRAC      4   // fractional bits in the integral
+#define PID_SHIFT_MAX   7   // SpeedPID() shifts a 16 bit error by 4 more
+#if PID_KP_SHIFT > PID_SHIFT_MAX || PID_KI_SHIFT > PID_SHIFT_MAX || PID_KD_SHIFT > PID_SHIFT_MAX
+#error PID_KP_SHIFT, PID_KI_SHIFT and PID_KD_SHIFT must be 0..PID_SHIFT_MAX
+#endif
+
+/*
+ * Speed setpoint - kept in the same units as measuredSpeed, pulses per 0.1s 
+ * x16, so 1 count is 1.04RPM (36 slots).  The duty cycle control is finer 
+ * than that needs - 1 duty count is ~20RPM and the PID trims in between.
+ * 
+ * SPEED_MODE_PRESET : the 11 steps in desiredSpeed[], 1000 to 4500rpm
+ * SPEED_MODE_FINE   : a press moves SPEED_FINE_RPM between SPEED_MIN_RPM 
+ *                     and SPEED_MAX_RPM.  Holding repeats every 
+ *                     SPEED_REPEAT_TICKS and the step doubles every 
+ *                     SPEED_REPEAT_DOUBLE repeats up to SPEED_FINE_MAX_RPM
+ * Holding both speed buttons for BUTTON_HOLD_SAMPLES swaps modes.
+ */
+#define RPM_TO_SPEED(rpm) ((uint16_t)(((rpm) * 24UL + 12) / 25)) // x 36 x 16 / 600
+#define SPEED_MODE_PRESET 0
+#define SPEED_MODE_FINE   1
+#ifndef SPEED_MODE_DEFAULT
+#define SPEED_MODE_DEFAULT SPEED_MODE_PRESET
+#endif
+#define SPEED_MIN_RPM       300
+#define SPEED_MAX_RPM       4500  // the motor is rated 4700
+#define SPEED_FINE_RPM      10    // per press
+#define SPEED_FINE_MAX_RPM  320   // biggest auto repeat step
+#define SPEED_REPEAT_TICKS  50    // 20 repeats a second
+#define SPEED_REPEAT_DOUBLE 10
+#define SPEED_REPEAT_PRESET_TICKS 300
+
+/* 
+ * PWM frequency - Timer 2 counts Tcy from 0 to PR2, so the period is 
+ * (PR2+1) x 0.5us and the duty has 4*(PR2+1) counts:
+ * 
+ *   0xC7 10kHz   0x7C 16kHz   0x65 19.6kHz   0x4F 25kHz   0x3F 31.25kHz
+ * 
+ * Lower switches the IGBTs less often, so there is less switching loss, 
+ * but the current ripple grows with the period and under ~18kHz the motor 
+ * can be heard.  With PWM_PR2_EE, PWM_PR2 is only the default for the 
+ * pwmPr2 parameter, so it can be changed in the data EEPROM too.  Over 40kHz 
+ * (PWM_PR2_MIN) the ISR paths are no longer well inside a period.
+ * 
+ * Duty ceiling - the motor is rated 180V and the bus is 320V so never go 
+ * above 56% on time.  At 19.6kHz full scale is 408 counts, 56% is 228.
+ * 
+ * DUTY_MAX, the preset table, the ramp rates, FAULT_STALL_DUTY, the IR 
+ * compensation and the PID gains are all in duty counts at 19.6kHz 
+ * (PWM_REF_PR2), where they were set.  At PWM_PR2 the compiler works out 
+ * what they are (DUTY_SCALE and on), and with PWM_PR2_EE SetupDuty() does 
+ * once the parameters are loaded and keeps them in RAM.
+ */
+#ifndef PWM_PR2
+#define PWM_PR2         0x65
+#endif
+#ifndef PWM_PR2_EE
+#define PWM_PR2_EE      0     // 1 - PR2 from the data EEPROM parameters
+#endif
+#define PWM_PR2_MIN     0x31
+#define PWM_REF_PR2     0x65
+#define DUTY_MAX        228
+#if PWM_PR2 < PWM_PR2_MIN || PWM_PR2 > 0xFF
+#error PWM_PR2 must be PWM_PR2_MIN..0xFF
+#endif
+// the duty constants at PWM_PR2, as SetupDuty() works them out
+#define DUTY_SCALE      (((PWM_PR2 + 1) * 64 + (PWM_REF_PR2 + 1) / 2) / (PWM_REF_PR2 + 1))
+#define DUTY_CEILING    (((PWM_PR2 + 1) * DUTY_MAX + (PWM_REF_PR2 + 1) / 2) / (PWM_REF_PR2 + 1))
+#define DUTY_AT(d)      (((d) * DUTY_SCALE + 32) >> 6)
+#define RAMP_AT(r)      ((r) && !DUTY_AT(r) ? 1 : DUTY_AT(r))
+
+/*
+ * Overcurrent trip - comparator 2 compares the motor current with CVREF 
+ * and the ECCP auto-shutdown turns the MOSFETs off within microseconds.  
+ * NEEDS THE HARDWARE MOD in setupOvercurrent() (IV jumpered to RC2), so it 
+ * is off by default.
+ * 
+ * OC_VR - CVREF high range: VDD/4 + OC_VR/32 x VDD, IV is 0.305V/A
+ *   15 -> 3.59V = 11.8A (the most CVREF can do)   13 -> 3.28V = 10.8A
+ * OC_CYCLE_LIMIT 1 : the PWM restarts each period once the current is 
+ *                    back under - a pulse by pulse current limit
+ * OC_CYCLE_LIMIT 0 : the PWM stays off, the firmware restarts it after 
+ *                    OC_RETRY_TICKS up to OC_RETRY_MAX times, then the 
+ *                    motor is shut down.  OC_CLEAN_TICKS without a trip 
+ *                    resets the retry count.
+ *                    The default RAMP_ACCEL draws ~14A starting, so slow 
+ *                    it to 8 or less or the starts will trip.
+ */
+#ifndef OC_TRIP
+#define OC_TRIP         0
+#endif
+#ifndef OC_CYCLE_LIMIT
+#define OC_CYCLE_LIMIT  1
+#endif
+#define OC_VR           15
+#define OC_RETRY_TICKS  200
+#define OC_RETRY_MAX    3
+#define OC_CLEAN_TICKS  2000
+
+/*
+ * Motor power - TaskPWM multiplies the latest MV and IV samples every tick,
+ * top 8 bits of each so it is an 8x8 shift and add multiply (the 16F690 
+ * has no multiplier).  One unit of motorPower is 1.086V x 0.0642A = 
+ * 0.0697W, so 16 bits covers 4.5kW.
+ * 
+ * POWER_LIMIT 1 keeps a duty ceiling under the PID and the ramp: each tick 
+ * over POWER_LIMIT_W, or over the rated POWER_RATED_A, takes it down 
+ * (further the more it is over) and each tick under lets it back up a 
+ * count.  The speed droops instead of the motor overheating and the PID 
+ * does not wind up meanwhile.  Near full speed it is power that limits, 
+ * lower down the rated current - a torque limit.
+ * 
+ * POWER_CONSTANT 1 lifts the current limit to POWER_PEAK_A so that power 
+ * is the limit down to 1900W / 14A = 136V on the motor, about 3500rpm, 
+ * for heavy cuts at low speed.  That is over the continuous rating, so 
+ * keep the cuts short.
+ */
+#ifndef POWER_LIMIT
+#define POWER_LIMIT     0
+#endif
+#ifndef POWER_CONSTANT
+#define POWER_CONSTANT  0
+#endif
+#define POWER_LIMIT_W   1900  // 2.5HP
+#define POWER_RATED_A   107   // 10.7A, in 0.1A
+#define POWER_PEAK_A    140   // POWER_CONSTANT, under FAULT_OC_IV
+#define POWER_GAIN_SHIFT 9    // an extra duty count down per 36W over
+// W to motorPower units: 1023^2 x 3.6 x 3.2 / (5^2 x 200 x 10.5 x 16) = 14.352
+#define POWER_W_TO_UNITS(w) ((uint16_t)((w) * 14352UL / 1000))
+// 0.1A to IV counts: 1023 x 3.2 / (5 x 10.5) = 62.36 per A
+#define POWER_A_TO_IV(a10)  ((uint16_t)((a10) * 6236UL / 1000))
+#if POWER_CONSTANT
+#define POWER_IV_MAX    POWER_A_TO_IV(POWER_PEAK_A)
+#else
+#define POWER_IV_MAX    POWER_A_TO_IV(POWER_RATED_A)
+#endif
+
+/*
+ * IR compensation - under load the current through Ra and R8/R8A takes 
+ * I x Ra off the armature voltage, so the speed sags until the PID sees it 
+ * at the end of a window.  IR_COMP 1 adds duty in proportion to the motor 
+ * current every tick instead, after the ramp, so it does not wait for the 
+ * tach and it works on the open loop duty whether the PID is trimming it 
+ * or not.  IV is put through its own first order filter of 
+ * 2^IR_COMP_SHIFT ticks from the latest conversion - ivFilt is too slow.
+ * 
+ * IR_COMP_K is duty counts x256 per IV count.  The whole 1.5 ohm at 320V 
+ * is 7.85 (0.024V per IV count, 0.78V per duty count); making up all of it 
+ * is positive feedback that only the resistance holds back, and it makes 
+ * each PID step draw that much more current - past ~65% the speed hunts 
+ * under load.  The extra duty is no more than IR_COMP_MAX and the total 
+ * no more than DUTY_MAX.
+ * 
+ * Speeding up takes current too, and adding duty for that would only 
+ * speed up faster and take more.  So from a setpoint change irComp is held 
+ * where it was until the speed is within 1/2^IR_COMP_ARRIVE_SHIFT of the 
+ * setpoint, and it goes to 0 with the duty.
+ */
+#ifndef IR_COMP
+#define IR_COMP         0
+#endif
+#ifndef IR_COMP_K
+#define IR_COMP_K       5     // 64%
+#endif
+#define IR_COMP_SHIFT   4     // IV filter, 16 ticks
+#define IR_COMP_MAX     24    // ~19V
+#define IR_COMP_ARRIVE_SHIFT 5  // 3%
+#if IR_COMP_K > 15
+#error IR_COMP_K over 15 overflows the 16 bit product
+#endif
+
+/*
+ * Fault supervisor - TaskFault checks every tick while the motor is 
+ * running.  A condition that holds for its FAULT_xx_TICKS in a row shuts 
+ * the motor down (PWM to 0, TotemControl and PowerPermissive low) and 
+ * LED1 then flashes the fault code until the power is cycled.
+ * 
+ *   1 undervoltage  HV below minimumVoltage (~100V on the bus)
+ *   2 overcurrent   IV over FAULT_OC_IV, or the OC_TRIP latch gave up
+ *   3 overspeed     tach over FAULT_OVERSPEED_RPM
+ *   4 stall         duty over FAULT_STALL_DUTY (or held down by the 
+ *                   POWER_LIMIT) but the tach says stopped and there is 
+ *                   no back emf either
+ *   5 tach loss     the tach says stopped but the back emf says turning
+ *   6 charge        the caps did not charge as they should - found by 
+ *                   PrechargeFit() before the relay closes, not TaskFault
+ * 
+ * The back emf is MV less the IR drop: MV - IV x FAULT_IR_K / 256, in MV 
+ * counts (3.68 per volt).  Without the OC_TRIP current limit a stalled 
+ * motor draws far more than FAULT_OC_IV, so a stall shows as overcurrent.
+ */
+#define FAULT_NONE          0
+#define FAULT_UNDERVOLTAGE  1
+#define FAULT_OVERCURRENT   2
+#define FAULT_OVERSPEED     3
+#define FAULT_STALL         4
+#define FAULT_TACH          5
+#define FAULTS              5
+#define FAULT_CHARGE        6
+
+#define FAULT_UV_TICKS        3
+#define FAULT_OC_IV           980   // ~16A, the IV reading tops out at 16.8A
+#define FAULT_OC_TICKS        20
+#define FAULT_OVERSPEED_RPM   5000  // the motor is rated 4700
+#define FAULT_OVERSPEED_TICKS 2
+#define FAULT_STALL_RPM       100   // under this the tach says stopped
+#define FAULT_STALL_DUTY      40    // ~10%, 32V on the armature
+#define FAULT_STALL_TICKS     250
+#define FAULT_TACH_EMF        74    // ~20V of back emf, ~500RPM
+#define FAULT_TACH_TICKS      250
+#define FAULT_IR_K            23    // Ra x 256 in MV counts per IV count, 1.5 ohm
+
+/*
+ * Worst case detection latency of each fault in ms, from the condition 
+ * starting to the motor being shut down - the host faults scenarios check 
+ * these.  The speed faults wait for the speed reading to catch up: up to 
+ * 2 windows, or with SPEED_MEASURE_MT the MT_STALE overflows it takes to 
+ * call the motor stopped.  HV and IV samples are at most ~1ms old.
+ */
+#if SPEED_MEASURE_MT
+#define FAULT_SPEED_AGE_MS  66
+#else
+#define FAULT_SPEED_AGE_MS  200
+#endif
+#define FAULT_UV_MS         (FAULT_UV_TICKS + 2)
+#define FAULT_OC_MS         (FAULT_OC_TICKS + 2)
+#define FAULT_OVERSPEED_MS  (FAULT_SPEED_AGE_MS + FAULT_OVERSPEED_TICKS + 1)
+#define FAULT_STALL_MS      (FAULT_SPEED_AGE_MS + FAULT_STALL_TICKS + 1)
+#define FAULT_TACH_MS       (FAULT_SPEED_AGE_MS + FAULT_TACH_TICKS + 1)
+#define LED_CODE_PERIOD     4     // fault code flashes, 200ms on and off
+#define LED_CODE_GAP        6     // and 1.4s off between repeats
+
+/*
+ * Duty ramp - TaskPWM moves the duty sent to CCPR1L:DC1B towards the 
+ * wanted duty by at most RAMP_ACCEL (speeding up) or RAMP_DECEL (slowing 
+ * down) per tick, in 1/64ths of a duty count.  0 = no limit.
+ *   15 -> 0 to DUTY_MAX in ~1s   29 -> ~0.5s   57 -> ~0.25s
+ * The motor only coasts down (the chopper cannot brake) so RAMP_DECEL 
+ * mostly stops the duty dropping away from under the PID.
+ * 
+ * RAMP_S_CURVE 1 eases in and out of each ramp: the slope changes by 1/64 
+ * every 2^RAMP_JERK_SHIFT ticks, so with 15 and 4 it takes 240ms to reach 
+ * full slope.  Needs non zero rates.
+ */
+#ifndef RAMP_ACCEL
+#define RAMP_ACCEL      15
+#endif
+#ifndef RAMP_DECEL
+#define RAMP_DECEL      29
+#endif
+#ifndef RAMP_S_CURVE
+#define RAMP_S_CURVE    0
+#endif
+#define RAMP_JERK_SHIFT 4
+#define RAMP_FRAC       6     // fraction bits in the ramped duty
+#if RAMP_S_CURVE && (RAMP_ACCEL == 0 || RAMP_DECEL == 0)
+#error RAMP_S_CURVE needs RAMP_ACCEL and RAMP_DECEL
+#endif
+#if RAMP_ACCEL > 100 || RAMP_DECEL > 100
+#error RAMP_ACCEL and RAMP_DECEL over 100 do not fit a byte at the lowest PWM frequency
+#endif
+
+/*
+ * Data EEPROM - the 256 bytes hold the parameters and a run log.
+ * 
+ * 0x00-0x33  params_t: the preset speed table, the relay and undervoltage 
+ *            levels, the overcurrent limit, the PID gains and the PWM 
+ *            frequency, with a version, its size and a CRC-8.  
+ *            LoadParams() checks it in one pass at power up and keeps only 
+ *            the tuning_t part, which the tasks read, in RAM (params).  A 
+ *            blank chip, a different layout or a bad CRC gets the defaults 
+ *            compiled in and writes them back, so once it has run the block 
+ *            can be changed (see host/eeimage) and programmed into the data 
+ *            EEPROM on its own without reflashing the code.
+ * 0x34-0xF3  the run log, LOG_RECORDS log_t records written in turn round 
+ *            a ring so each byte only takes 1/16 of the writes.  The newest 
+ *            is the good record with the highest seq, so a write cut short 
+ *            by the power going only loses the record it was writing.  It 
+ *            is written straight from runLog, which holds still till the 
+ *            ISR has it all.
+ * 
+ * A record is written once a new setpoint has held for LOG_SETTLE_TICKS 
+ * with the power request on (letting go of power stops the motor but is 
+ * not logged as a stop), every LOG_RUN_SECONDS of running for the run 
+ * time, and on a fault with the setpoint logged as 0.  EE_RESUME 1 goes 
+ * straight to the logged setpoint as soon as the motor is armed, so it 
+ * picks up where it was when the power went - a stop on the speed buttons 
+ * logs 0 and it stays stopped.
+ * 
+ * A byte takes ~5ms to write, so the main code only hands the ISR the 
+ * bytes and it writes them one after another on EEIF.  Bytes that already 
+ * hold the value are not written again.
+ */
+#ifndef EE_RESUME
+#define EE_RESUME       1
+#endif
+#define PARAM_VERSION   2
+#define EE_PARAMS       0x00
+#define EE_LOG          0x34
+#define LOG_RECORDS     16
+#define LOG_SETTLE_TICKS 2000   // 2s
+#define LOG_RUN_SECONDS 360     // 0.1h
+#define PRESET_STEPS    12      // off and the 11 speed steps
+#define PRESET_PULSES_MAX 0x0FFF // x16 has to fit 16 bits
+
+// XC8 does not pad structs, so the host build must not either - gcc would 
+// round params_t up to an even size and put the CRC over the pad byte
+#ifdef PF906_HOST
+#define EE_PACKED __attribute__((packed))
+#else
+#define EE_PACKED
+#endif
+
+// the parameters the tasks read as they run, in RAM
+typedef struct EE_PACKED {
+    uint8_t desiredSpeed[PRESET_STEPS]; // open loop duty of each step
+    int16_t desiredPulses[PRESET_STEPS]; // and its tach pulses per 0.1s
+    int16_t TestVoltage;        // HV to close the relay, PRECHARGE_FIT 0
+    int16_t minimumVoltage;     // HV under which it is undervoltage
+    uint16_t faultOcIv;         // FAULT_OC_IV
+    uint8_t pidKp, pidKi, pidKd; // PID_KP_SHIFT, PID_KI_SHIFT, PID_KD_SHIFT
+} tuning_t;
+
+// and the block in the data EEPROM
+typedef struct EE_PACKED {
+    uint8_t version;            // PARAM_VERSION
+    uint8_t size;               // sizeof(params_t)
+    tuning_t tuning;
+    uint8_t pwmPr2;             // PWM_PR2, used with PWM_PR2_EE
+    uint8_t crc;                // CRC-8 (x^8 + x^2 + x + 1) of the rest
+} params_t;
+
+typedef struct {
+    uint16_t setpoint;          // pulses per 0.1s x16, 0 stopped
+    uint16_t runTenths;         // motor run time, 0.1h
+    uint8_t faults[FAULT_CHARGE]; // shutdowns for each fault code, stops at 255
+    uint8_t seq;                // +1 each record, wraps
+    uint8_t crc;
+} log_t;
+
+/*
+ * Host build (see ../host) - gcc compiles this code against a simulated 
+ * PIC16F690 that supplies its own xc.h and pic16f690.h and defines 
+ * PF906_HOST.  SIM_MARK() lets the simulator time points in the code, eg the 
+ * main loop period.  Only register accesses take simulated time, so 
+ * SIM_CYCLES() charges the cycles of a loop that polls a variable set in 
+ * the ISR.  SIM_PREEMPT() marks a point between 2 instructions where the 
+ * simulator may run the ISR, so code that shares data with the ISR can be 
+ * tested against an interrupt at each of its points.  On the PIC they all 
+ * compile to nothing.
+ */
+#ifdef PF906_HOST
+#define SIM_MARK(id) sim_mark(id)
+#define SIM_CYCLES(n) sim_delay(n)
+#define SIM_PREEMPT(id) sim_preempt(id)
+#else
+#define SIM_MARK(id)
+#define SIM_CYCLES(n)
+#define SIM_PREEMPT(id)
+#endif
+
+#define SIM_MARK_LOOP  0  // top of the operating loop
+#define SIM_MARK_SPEED 1  // a new speed measurement is available
+#define SIM_MARK_TICK  2  // the scheduler has started a tick
@@ -0,0 +1,185 @@
+/*
+ * File:   PF906math.h
+ * Comments: multiply and divide kernels for the control code
+ *
+ * The 16F690 has no multiplier or divider, so every * and / in the C turns
+ * into a call to one of XC8's library routines.  Those take whatever types
+ * the C promotes to: a uint8_t x uint8_t goes through the 16x16 __wmul,
+ * anything with a long through the 32 bit __lmul and __lldiv, and every 
+ * pass round their loops shifts, adds and tests all the bytes of the 
+ * widest type.  What is here is cut down to the sizes actually needed:
+ *
+ *   Mul8       8x8 -> 16 shift and add, one pass per bit of b that is left
+ *   Mul16x8    16x8 -> 24, the same
+ *   MULC       x times a constant - the compiler keeps a shift and an add
+ *              for each 1 bit of the constant and throws the rest away
+ *   TachSpeed  the M/T speed, slots x 3200000 / ticks, from a table of
+ *              reciprocals instead of a 32 bit divide
+ *   SatU16, AddSatS16   results that clamp instead of wrapping
+ *
+ * uint24_t is XC8's 3 byte __uint24, which is what the 24 bit values cost
+ * on the PIC.
+ *
+ * MATH_CYCLES() charges the instruction cycles of each step of the PIC16
+ * code in host/mathbench, which compares them with XC8's routines.  The
+ * counts come from the instructions XC8 gives for each step - 1 cycle each,
+ * 2 for a goto, call, return or a skip taken.  Everywhere else it is
+ * nothing.
+ */
+
+#ifndef PF906MATH_H
+#define PF906MATH_H
+
+#include <stdint.h>
+
+#ifdef PF906_HOST
+typedef uint32_t uint24_t;  // XC8's stdint.h has it as __uint24
+#endif
+
+#ifdef MATH_BENCH
+extern uint32_t mathCycles;
+#define MATH_CYCLES(n) (mathCycles += (n))
+#else
+#define MATH_CYCLES(n)
+#endif
+
+/*
+ * x times the constant k (up to 16 bits), in the type of x - widen x first
+ * if the product needs it.  Horner's rule from the top bit of k down:
+ * shift the total left 1 and add x if the bit is 1.  The bit tests are 
+ * constants the compiler folds away, so what is left is one shift per bit 
+ * below the top 1 of k and one add per 1 bit
+ */
+#define MULC_STEP(acc, x, k, n) (((acc) << 1) + (((k) >> (n) & 1) ? (x) : 0))
+#define MULC(x, k) \
+    MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP( \
+    MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP(MULC_STEP( \
+    MULC_STEP(((k) >> 15 & 1) ? (x) : 0, x, k, 14), x, k, 13), x, k, 12), \
+    x, k, 11), x, k, 10), x, k, 9), x, k, 8), x, k, 7), x, k, 6), x, k, 5), \
+    x, k, 4), x, k, 3), x, k, 2), x, k, 1), x, k, 0)
+
+/*
+ * Shift and add - one add per 1 bit of b and it stops at the top 1 bit,
+ * so small b are quick.  In C a uint8_t x uint8_t is int x int, __wmul, 
+ * which does the same but shifts and tests 2 bytes of b where 1 will do 
+ * and passes 4 bytes of arguments.
+ */
+static inline uint16_t Mul8(uint8_t a, uint8_t b) {
+    uint16_t product = 0;
+    uint16_t addend = a;
+
+    MATH_CYCLES(8);                        // clear product, a to addend
+    while (b) {
+        MATH_CYCLES(3);                    // b == 0?
+        if (b & 1) {
+            product += addend;
+            MATH_CYCLES(6);                // 2 byte add with carry
+        };
+        addend <<= 1;
+        b >>= 1;
+        MATH_CYCLES(2 + 3 + 2 + 2);        // bit test, 2 byte shift, shift, loop
+    };
+    MATH_CYCLES(3 + 2);                    // b == 0, return
+    return product;
+};
+
+static inline uint24_t Mul16x8(uint16_t a, uint8_t b) {
+    uint24_t product = 0;
+    uint24_t addend = a;
+
+    MATH_CYCLES(11);
+    while (b) {
+        MATH_CYCLES(3);
+        if (b & 1) {
+            product += addend;
+            MATH_CYCLES(9);                // 3 byte add with carries
+        };
+        addend <<= 1;
+        b >>= 1;
+        MATH_CYCLES(2 + 4 + 2 + 2);
+    };
+    MATH_CYCLES(3 + 2);
+    return product;
+};
+
+/*
+ * 16 bits of a 24 bit result, 0xFFFF if it is more
+ */
+static inline uint16_t SatU16(uint24_t x) {
+    MATH_CYCLES(6);
+    return x > 0xFFFF ? 0xFFFF : (uint16_t)x;
+};
+
+/*
+ * a + b clamped to -32768..32767.  Only 2 numbers of the same sign can
+ * overflow, and then the sign of the sum comes out wrong
+ */
+static inline int16_t AddSatS16(int16_t a, int16_t b) {
+    int16_t sum = (int16_t)(uint16_t)((uint16_t)a + (uint16_t)b);
+
+    MATH_CYCLES(12);
+    if ((a ^ b) >= 0 && (sum ^ a) < 0) sum = a < 0 ? -32767 - 1 : 32767;
+    return sum;
+};
+
+/*
+ * Reciprocal table for the M/T speed - 1638400000 / x at 33 points from
+ * x = 32768 to 65536, 1024 apart.  1638400000 is 3200000 x 512, so that
+ * with ticks = x x 2^e
+ *
+ *   slots x 3200000 / ticks = slots x table(x) >> (9 + e)
+ *
+ * Between points it is a straight line, which bows above 1/x, and TachSpeed
+ * drops the low 2 bits of x, which reads high too.  So each entry is set
+ * down by 2/3 of the bow either side of it and 0.004% for the bits, which
+ * centres the error - it is within 0.02% of 1/x and averages nothing.
+ */
+static const uint16_t tachRecip[33] = {
+    49990, 48475, 47050, 45706, 44437, 43236, 42099, 41019, 39994, 39019,
+    38090, 37204, 36359, 35551, 34778, 34039, 33330, 32649, 31997, 31369,
+    30766, 30186, 29627, 29088, 28569, 28068, 27584, 27116, 26664, 26227,
+    25804, 25395, 24998
+};
+
+/*
+ * Pulses per 0.1s x16 from slots in ticks of Timer 1 (0.5us) - what
+ * slots x 3200000UL / ticks gives without the 32 bit multiply and divide.
+ * ticks is shifted into 32768..65535 (it is 8000 or more in the M/T code),
+ * the top 5 bits below the leading 1 pick the table entry and the next 8
+ * place it between that entry and the next.  Under 128 ticks there is 
+ * nothing to shift and it saturates.
+ */
+static inline uint16_t TachSpeed(uint8_t slots, uint24_t ticks) {
+    uint8_t shift = 9, i, f;
+    uint16_t x, r;
+    uint24_t speed;
+
+    MATH_CYCLES(6);
+    if (ticks < 128) return 0xFFFF;
+    while (ticks > 0xFFFF) {
+        ticks >>= 1;
+        ++shift;
+        MATH_CYCLES(12);                   // top byte test, 3 byte shift, count
+    };
+    x = (uint16_t)ticks;
+    MATH_CYCLES(4);
+    while (!(x & 0x8000)) {
+        x <<= 1;
+        --shift;
+        MATH_CYCLES(8);                    // bit test, 2 byte shift, count
+    };
+    i = (uint8_t)(x >> 10) & 31;           // the high byte shifted twice
+    f = (uint8_t)(x >> 2);
+    r = tachRecip[i];
+    MATH_CYCLES(10 + 2 * 14);              // i and f, 2 table reads of 2 bytes
+    r -= (uint16_t)(Mul16x8(r - tachRecip[i + 1], f) >> 8);
+    MATH_CYCLES(4 + 8);                    // call, subtract the high 2 bytes
+    speed = Mul16x8(r, slots);
+    MATH_CYCLES(4);
+    // round to the nearest
+    speed = (speed + ((uint24_t)1 << (shift - 1))) >> shift;
+    MATH_CYCLES(12 + 6 * shift);           // the rounding bit, shift loop
+    return SatU16(speed);
+};
+
+#endif // PF906MATH_H
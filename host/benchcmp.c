@@ -0,0 +1,216 @@
+/*
+ * File:   benchcmp.c  (host tool)
+ *
+ * Compares the results of the pf906sim bench-* scenarios with the baseline
+ * checked in as bench-baseline.json, or writes the baseline from them.
+ *
+ * usage: benchcmp baseline.json result.json ...
+ *        benchcmp -w baseline.json result.json ...
+ *
+ * Each file is what "pf906sim bench-x file" writes,
+ *
+ *   {"bench-x": {"metric": {"value": v, "unit": "u", "tol": t}, ...}, ...}
+ *
+ * and the baseline is them all in one.  Every metric is lower is better,
+ * and one is a regression when it is more than tol (a fraction) over the
+ * baseline - tol is the baseline's, so it is changed there.  A metric the
+ * baseline has for a scenario that was run but that is not in the results
+ * is a failure too, and a new one is listed to go into the baseline.  The
+ * exit status is 1 on any of those.
+ *
+ * -w writes the results as the new baseline, with the tolerances they came
+ * with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define MAX_METRICS 200
+
+typedef struct {
+    char scenario[32], name[32], unit[12];
+    double value, tol;
+    int seen;
+} metric_t;
+
+typedef struct {
+    metric_t m[MAX_METRICS];
+    int n;
+} set_t;
+
+static set_t base, result;
+
+/*
+ * Just enough JSON for the files above: objects, strings without escapes
+ * and numbers, three deep
+ */
+static const char *src, *file;
+static int line;
+
+static void skip(void) {
+    while (isspace((unsigned char)*src)) if (*src++ == '\n') ++line;
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "%s:%d: %s\n", file, line, what);
+    return -1;
+}
+
+static int string(char *out, int size) {
+    int n = 0;
+    skip();
+    if (*src++ != '"') return fail("want a string");
+    while (*src && *src != '"' && *src != '\\') {
+        if (n < size - 1) out[n++] = *src;
+        ++src;
+    }
+    out[n] = 0;
+    if (*src++ != '"') return fail("string not ended, or escaped");
+    return 0;
+}
+
+static int expect(char c) {
+    char what[] = "want 'x'";
+    skip();
+    if (*src == c) { ++src; return 0; }
+    what[6] = c;
+    return fail(what);
+}
+
+static metric_t *find(set_t *s, const char *scenario, const char *name) {
+    for (int i = 0; i < s->n; i++)
+        if (!strcmp(s->m[i].scenario, scenario) && !strcmp(s->m[i].name, name)) return &s->m[i];
+    return NULL;
+}
+
+// {"value": v, "unit": "u", "tol": t}
+static int metric(metric_t *m) {
+    char key[16];
+    if (expect('{')) return -1;
+    skip();
+    if (*src == '}') return ++src, 0;
+    do {
+        if (string(key, sizeof key) || expect(':')) return -1;
+        skip();
+        if (!strcmp(key, "unit")) {
+            if (string(m->unit, sizeof m->unit)) return -1;
+            continue;
+        }
+        char *end;
+        double v = strtod(src, &end);
+        if (end == src) return fail("want a number");
+        src = end;
+        if (!strcmp(key, "value")) m->value = v, m->seen |= 1;
+        else if (!strcmp(key, "tol")) m->tol = v, m->seen |= 2;
+    } while (skip(), *src == ',' && ++src);
+    if (m->seen != 3) return fail("want a value and a tol");
+    return expect('}');
+}
+
+static int load(set_t *s, const char *name) {
+    FILE *f = fopen(name, "r");
+    static char text[65536];
+    if (!f) { perror(name); return -1; }
+    size_t n = fread(text, 1, sizeof text - 1, f);
+    fclose(f);
+    text[n] = 0;
+    src = text;
+    file = name;
+    line = 1;
+
+    char scenario[32];
+    if (expect('{')) return -1;
+    skip();
+    if (*src == '}') return 0;
+    do {
+        if (string(scenario, sizeof scenario) || expect(':') || expect('{')) return -1;
+        skip();
+        if (*src == '}') { ++src; continue; }
+        do {
+            metric_t m = {{0}};
+            strcpy(m.scenario, scenario);
+            if (string(m.name, sizeof m.name) || expect(':') || metric(&m)) return -1;
+            m.seen = 0;
+            metric_t *old = find(s, scenario, m.name);
+            if (!old) {
+                if (s->n == MAX_METRICS) return fail("too many metrics");
+                old = &s->m[s->n++];
+            }
+            *old = m;
+        } while (skip(), *src == ',' && ++src);
+        if (expect('}')) return -1;
+    } while (skip(), *src == ',' && ++src);
+    return expect('}');
+}
+
+static int writeBaseline(const char *name) {
+    FILE *f = fopen(name, "w");
+    if (!f) { perror(name); return -1; }
+    fprintf(f, "{");
+    for (int i = 0; i < result.n; i++) {
+        metric_t *m = &result.m[i];
+        int first = !i || strcmp(m->scenario, result.m[i - 1].scenario);
+        if (first) fprintf(f, "%s\n  \"%s\": {", i ? "\n  }," : "", m->scenario);
+        fprintf(f, "%s\n    \"%s\": {\"value\": %.6g, \"unit\": \"%s\", \"tol\": %g}",
+                first ? "" : ",", m->name, m->value, m->unit, m->tol);
+    }
+    fprintf(f, "%s\n}\n", result.n ? "\n  }" : "");
+    return fclose(f);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: benchcmp [-w] baseline.json result.json ...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int opt, writeBase = 0;
+    while ((opt = getopt(argc, argv, "w")) != -1) {
+        if (opt == 'w') writeBase = 1;
+        else usage();
+    }
+    if (argc - optind < 2) usage();
+    const char *baseFile = argv[optind++];
+    for (int i = optind; i < argc; i++)
+        if (load(&result, argv[i])) return 2;
+    if (writeBase) return writeBaseline(baseFile) ? 2 : 0;
+    if (load(&base, baseFile)) return 2;
+
+    int bad = 0;
+    printf("%-16s %-24s %12s %12s %8s\n", "scenario", "metric", "baseline", "now", "change");
+    for (int i = 0; i < result.n; i++) {
+        metric_t *r = &result.m[i], *b = find(&base, r->scenario, r->name);
+        if (!b) {
+            printf("%-16s %-24s %12s %12.4g %8s  new, not in the baseline\n", r->scenario,
+                   r->name, "-", r->value, "");
+            bad = 1;
+            continue;
+        }
+        b->seen = 1;
+        const char *flag = "";
+        if (r->value > b->value * (1 + b->tol) && r->value > b->value) flag = "  WORSE", bad = 1;
+        else if (r->value < b->value * (1 - b->tol) && r->value < b->value) flag = "  better";
+        if (b->value != 0)
+            printf("%-16s %-24s %12.4g %12.4g %+7.1f%%%s\n", r->scenario, r->name, b->value,
+                   r->value, 100 * (r->value - b->value) / b->value, flag);
+        else
+            printf("%-16s %-24s %12.4g %12.4g %8s%s\n", r->scenario, r->name, b->value,
+                   r->value, "", flag);
+    }
+    // only the scenarios that were run
+    for (int i = 0; i < base.n; i++) {
+        metric_t *b = &base.m[i];
+        int ran = 0;
+        for (int j = 0; j < result.n && !ran; j++) ran = !strcmp(result.m[j].scenario, b->scenario);
+        if (ran && !b->seen) {
+            printf("%-16s %-24s %12.4g %12s %8s  MISSING\n", b->scenario, b->name, b->value,
+                   "-", "");
+            bad = 1;
+        }
+    }
+    printf("%s\n", bad ? "regressions - see above" : "no regressions");
+    return bad;
+}
@@ -0,0 +1,208 @@
+/*
+ * File:   eeimage.c  (host tool)
+ *
+ * Shows and changes the parameter block in an image of the PIC's 256 byte
+ * data EEPROM (see "Data EEPROM" in PF906header.h), as saved by "pf906sim
+ * -e" or read back from the chip by the programmer.
+ *
+ * usage: eeimage [-x params.hex] image [name=value ...]
+ *
+ * With no changes it prints the parameters and the run log.  Each
+ * name=value sets a parameter - the names are the params_t fields, with
+ * speed1..speed12 and pulses1..pulses12 for the preset table - then the
+ * CRC is worked out again and the image written back.  The values are in
+ * the firmware's own units, the same as the defaults in
+ * PF906_base_code_v4b.c, and it will not write what the firmware would
+ * not use - the preset table has to go up step by step and the gains be
+ * 0..PID_SHIFT_MAX.  -x writes the parameter block on its own as Intel HEX
+ * at the PIC16 data EEPROM address, for the programmer, so the run log on
+ * the chip is left as it is.
+ *
+ * The block has to be there already - run the firmware once on a blank
+ * image to write the defaults.  The exit status is 1 if it is not good.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "PF906header.h"
+
+#define EE_SIZE 256
+#define HEX_EEPROM 0x4200  // the data EEPROM in a PIC16 HEX file, 2 bytes a byte
+
+static uint8_t ee[EE_SIZE];
+static params_t params;
+static tuning_t *const tune = &params.tuning;
+
+static const char *faultName[FAULT_CHARGE] = {
+    "undervoltage", "overcurrent", "overspeed", "stall", "tach loss", "charge"
+};
+
+static uint8_t crc8(const uint8_t *p, int n) {
+    uint8_t crc = 0;
+    while (n--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static int good(void) {
+    return params.version == PARAM_VERSION && params.size == sizeof params &&
+           !crc8((const uint8_t *)&params, sizeof params);
+}
+
+// what LoadParams() also wants, or it goes back to the defaults
+static int usable(void) {
+    for (int i = 1; i < PRESET_STEPS; i++)
+        if (tune->desiredPulses[i] <= tune->desiredPulses[i - 1] ||
+            tune->desiredSpeed[i] <= tune->desiredSpeed[i - 1]) return 0;
+    return 1;
+}
+
+static double rpm(unsigned speed) {
+    return speed * 600.0 / 36 / 16;
+}
+
+static void show(void) {
+    printf("parameters  version %u, %u bytes, CRC %s\n", params.version, params.size,
+           crc8((const uint8_t *)&params, sizeof params) ? "bad" : "good");
+    printf("step  speed  pulses\n");
+    for (int i = 0; i < PRESET_STEPS; i++)
+        printf("%4d  %5u  %6d\n", i + 1, tune->desiredSpeed[i], tune->desiredPulses[i]);
+    printf("TestVoltage %d  minimumVoltage %d  faultOcIv %u\n", tune->TestVoltage,
+           tune->minimumVoltage, tune->faultOcIv);
+    printf("pidKp %u  pidKi %u  pidKd %u\n", tune->pidKp, tune->pidKi, tune->pidKd);
+    printf("pwmPr2 0x%02X  %.1f kHz\n", params.pwmPr2, 2000.0 / (params.pwmPr2 + 1));
+
+    log_t newest;
+    int slot = -1, records = 0;
+    for (int i = 0; i < LOG_RECORDS; i++) {
+        const uint8_t *p = ee + EE_LOG + i * sizeof(log_t);
+        log_t r;
+        memcpy(&r, p, sizeof r);
+        if (crc8(p, sizeof r)) continue;
+        ++records;
+        if (slot >= 0 && (int8_t)(r.seq - newest.seq) <= 0) continue;
+        newest = r;
+        slot = i;
+    }
+    printf("run log     %d good records of %d\n", records, LOG_RECORDS);
+    if (slot < 0) return;
+    printf("newest      slot %d seq %u  setpoint %.0f rpm  run %.1f h\n", slot, newest.seq,
+           rpm(newest.setpoint), newest.runTenths / 10.0);
+    for (int i = 0; i < FAULT_CHARGE; i++)
+        if (newest.faults[i]) printf("            %u %s\n", newest.faults[i], faultName[i]);
+}
+
+// name=value, 0 if it is good
+static int set(const char *arg) {
+    char name[20];
+    long value;
+    int n, step;
+    if (sscanf(arg, "%19[^=]=%li%n", name, &value, &n) != 2 || arg[n]) return -1;
+    if (sscanf(name, "speed%d", &step) == 1 && step >= 1 && step <= PRESET_STEPS &&
+        value >= 0 && value <= 255)
+        tune->desiredSpeed[step - 1] = value;
+    else if (sscanf(name, "pulses%d", &step) == 1 && step >= 1 && step <= PRESET_STEPS &&
+             value >= 0 && value <= PRESET_PULSES_MAX)
+        tune->desiredPulses[step - 1] = value;
+    else if (!strcmp(name, "TestVoltage") && value >= 0 && value <= 1023)
+        tune->TestVoltage = value;
+    else if (!strcmp(name, "minimumVoltage") && value >= 0 && value <= 1023)
+        tune->minimumVoltage = value;
+    else if (!strcmp(name, "faultOcIv") && value >= 0 && value <= 1023)
+        tune->faultOcIv = value;
+    // the PID gains are shifts, 4 more than these, of a 16 bit error
+    else if (!strcmp(name, "pidKp") && value >= 0 && value <= PID_SHIFT_MAX)
+        tune->pidKp = value;
+    else if (!strcmp(name, "pidKi") && value >= 0 && value <= PID_SHIFT_MAX)
+        tune->pidKi = value;
+    else if (!strcmp(name, "pidKd") && value >= 0 && value <= PID_SHIFT_MAX)
+        tune->pidKd = value;
+    else if (!strcmp(name, "pwmPr2") && value >= PWM_PR2_MIN && value <= 0xFF)
+        params.pwmPr2 = value;
+    else
+        return -1;
+    return 0;
+}
+
+static void hexLine(FILE *f, unsigned addr, unsigned type, const uint8_t *data, unsigned n) {
+    unsigned sum = n + (addr >> 8) + (addr & 0xFF) + type;
+    fprintf(f, ":%02X%04X%02X", n, addr, type);
+    for (unsigned i = 0; i < n; i++) {
+        fprintf(f, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(f, "%02X\n", -sum & 0xFF);
+}
+
+// each EEPROM byte is the low byte of a 14 bit word in the HEX file
+static int writeHex(const char *name) {
+    FILE *f = fopen(name, "w");
+    if (!f) { perror(name); return -1; }
+    const uint8_t *p = ee + EE_PARAMS;
+    for (unsigned i = 0; i < sizeof params; i += 8) {
+        uint8_t words[16] = {0};
+        unsigned n = sizeof params - i < 8 ? sizeof params - i : 8;
+        for (unsigned j = 0; j < n; j++) words[2 * j] = p[i + j];
+        hexLine(f, HEX_EEPROM + 2 * (EE_PARAMS + i), 0, words, 2 * n);
+    }
+    hexLine(f, 0, 1, NULL, 0);
+    return fclose(f);
+}
+
+int main(int argc, char **argv) {
+    const char *hexFile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "x:")) != -1) {
+        if (opt == 'x') hexFile = optarg;
+        else {
+            fprintf(stderr, "usage: eeimage [-x params.hex] image [name=value ...]\n");
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: eeimage [-x params.hex] image [name=value ...]\n");
+        return 2;
+    }
+    const char *image = argv[optind++];
+    FILE *f = fopen(image, "rb");
+    if (!f) { perror(image); return 2; }
+    if (fread(ee, 1, EE_SIZE, f) != EE_SIZE) {
+        fprintf(stderr, "%s: want %d bytes\n", image, EE_SIZE);
+        return 2;
+    }
+    fclose(f);
+    memcpy(&params, ee + EE_PARAMS, sizeof params);
+    if (!good()) {
+        show();
+        fprintf(stderr, "%s: no good parameter block - run the firmware on it first\n", image);
+        return 1;
+    }
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++)
+            if (set(argv[i])) {
+                fprintf(stderr, "eeimage: %s: not a parameter or out of range\n", argv[i]);
+                return 2;
+            }
+        if (!usable()) {
+            fprintf(stderr, "eeimage: the preset speeds and pulses have to go up step by step\n");
+            return 2;
+        }
+        params.crc = 0;
+        params.crc = crc8((const uint8_t *)&params, sizeof params - 1);
+        memcpy(ee + EE_PARAMS, &params, sizeof params);
+        f = fopen(image, "wb");
+        if (!f || fwrite(ee, 1, EE_SIZE, f) != EE_SIZE || fclose(f)) {
+            perror(image);
+            return 2;
+        }
+    }
+    show();
+    if (hexFile && writeHex(hexFile)) return 2;
+    return 0;
+}
@@ -0,0 +1,9 @@
+/*
+ * File:   firmware.c  (host build)
+ *
+ * The firmware as it is, then firmware.h so gcc checks the harness's
+ * declarations of its globals against the definitions.
+ */
+
+#include "PF906_base_code_v4b.c"
+#include "firmware.h"
@@ -0,0 +1,68 @@
+/*
+ * File:   firmware.h  (host build)
+ *
+ * The firmware's globals the harness reads, for pf906sim.c.  The firmware
+ * is built through firmware.c, which includes this after the firmware
+ * itself, so gcc checks every one here against its definition - a type
+ * that has drifted is a build error rather than a wrong reading.
+ *
+ * PF906header.h comes first, for the types and the build options.
+ */
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include <stdint.h>
+
+// the firmware, renamed by the Makefile so it does not clash with ours
+void pf906_main(void);
+void Isr(void);
+extern uint16_t measuredSpeed;
+extern volatile uint8_t speedSeq;
+extern uint8_t speedSeqSeen;
+#if !SPEED_MEASURE_MT
+extern volatile uint16_t actualSpeedPulses;
+extern volatile uint8_t speedSnapL[2], speedSnapH[2];
+extern uint16_t speedSnap;
+#endif
+extern volatile uint16_t adcSample[3];  // MV, IV, HV
+extern volatile uint8_t adcCount[3];
+extern volatile uint16_t adcDecimated[3];
+extern uint8_t adcDecimatedSeen[3];
+extern uint16_t ivFilt, mvFilt;
+extern uint16_t motorPower;
+extern uint8_t desiredSpeedCtr;
+extern uint16_t setpoint;
+extern uint8_t speedMode;
+extern uint16_t ocTrips;
+extern uint8_t ocLatched;
+extern uint8_t faultCode;
+extern uint8_t powerState;
+extern uint16_t stateTime, stateLast[POWER_STATES];
+extern uint8_t stateEntries[POWER_STATES];
+extern tuning_t params;
+extern log_t runLog;
+#if PWM_PR2_EE
+extern uint8_t pwmPr2;
+extern uint16_t dutyMax;
+extern uint8_t dutyScale;
+#endif
+#if TELEMETRY
+extern uint8_t txSeq;
+#endif
+#if PRECHARGE_FIT
+extern uint16_t chargeFinal, chargeRatio;
+extern uint8_t chargeTau;
+#endif
+#if ISR_PROFILE
+extern uint16_t isrCount[ISR_PATHS];
+extern uint8_t isrMax[ISR_PATHS], isrLatencyMax;
+extern uint32_t isrCycles[ISR_PATHS];
+#endif
+extern const uint8_t taskPeriod[TASKS];
+#if RUN_STATS
+extern uint16_t taskWcet[TASKS], taskJitter[TASKS];
+extern uint8_t taskOverruns[TASKS];
+#endif
+
+#endif // FIRMWARE_H
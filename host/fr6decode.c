@@ -0,0 +1,137 @@
+/*
+ * File:   fr6decode.c  (host tool)
+ *
+ * Decodes a capture of the FR6 telemetry stream (see TELEMETRY in
+ * PF906header.h) into CSV, one line per good frame.
+ *
+ * usage: fr6decode [-r rate] [-b baud] [-p pr2] [-i] [capture]
+ *
+ * The capture is the FR6 level sampled at a fixed rate, one '0' or '1'
+ * per sample (anything else is skipped), as written by "pf906sim
+ * telemetry" or exported from a logic analyser.  1 is RA1 high, the idle
+ * level - use -i for a capture taken on the far side of the opto, which
+ * inverts it.  Reads stdin without a file.  -r is the sample rate in Hz
+ * (default 10000) and -b the bit rate (default 1000).  The duty is in 
+ * counts of the PWM, so -p gives the PR2 it ran at for the duty % if it 
+ * was not PWM_PR2.
+ *
+ * Bad frames are counted on stderr and make the exit status 1.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "PF906header.h"
+
+#define MAX_SAMPLES_PER_BIT 1000
+
+static const char *stateName[POWER_STATES] = {
+    "precharge", "relay", "armed", "run", "stopping", "fault"
+};
+static const char *faultName[8] = {
+    "none", "undervoltage", "overcurrent", "overspeed", "stall", "tach loss",
+    "charge", "?"
+};
+
+static unsigned frames, badBytes, badSums;
+static uint8_t buf[TELEMETRY_BYTES];
+static unsigned have;
+static double frameT;
+static unsigned dutyFull = 4 * (PWM_PR2 + 1);
+
+static void frame(void) {
+    unsigned speed = buf[2] | buf[3] << 8;
+    unsigned w = buf[4] | buf[5] << 8;
+    unsigned long adc = buf[6] | buf[7] << 8 | (unsigned long)buf[8] << 16 |
+                        (unsigned long)buf[9] << 24;
+    unsigned duty = w & 0x3FF, fault = (w >> 10) & 7, state = w >> 13;
+    unsigned hv = adc & 0x3FF, iv = (adc >> 10) & 0x3FF, mv = (adc >> 20) & 0x3FF;
+    unsigned limited = (adc >> 30) & 1, power = buf[10] | buf[11] << 8;
+    double v = 5.0 / 1023;  // ADC counts to volts at the pin
+
+    printf("%.3f,%u,%.0f,%u,%u,%.1f,%s,%s,%.1f,%.2f,%.1f,%.0f,%u\n", frameT, buf[1],
+           speed * 600.0 / 36 / 16, speed, duty, 100.0 * duty / dutyFull,
+           state < POWER_STATES ? stateName[state] : "?", faultName[fault],
+           hv * v * 320 / 4.2, iv * v * 10.5 / 3.2, mv * v * 200 / 3.6,
+           power * 1000.0 / 14352, limited);
+    ++frames;
+}
+
+// a byte off the line - line the frames up on the sync byte and checksum
+static void byte(uint8_t b, double t) {
+    if (have == 0) {
+        if (b != TELEMETRY_SYNC) { ++badBytes; return; }
+        frameT = t;
+    }
+    buf[have++] = b;
+    if (have < TELEMETRY_BYTES) return;
+    uint8_t sum = 0;
+    for (unsigned i = 0; i < TELEMETRY_BYTES; i++) sum += buf[i];
+    if (sum == 0) {
+        frame();
+        have = 0;
+        return;
+    }
+    // not a frame - start again from the next sync byte in it
+    ++badSums;
+    unsigned i = 1;
+    while (i < TELEMETRY_BYTES && buf[i] != TELEMETRY_SYNC) i++;
+    have = TELEMETRY_BYTES - i;
+    memmove(buf, buf + i, have);
+}
+
+int main(int argc, char **argv) {
+    double rate = 10000, baud = 1000;
+    int invert = 0, opt;
+    while ((opt = getopt(argc, argv, "r:b:p:i")) != -1) {
+        if (opt == 'r') rate = atof(optarg);
+        else if (opt == 'b') baud = atof(optarg);
+        else if (opt == 'p') dutyFull = 4 * (strtoul(optarg, NULL, 0) + 1);
+        else if (opt == 'i') invert = 1;
+        else {
+            fprintf(stderr, "usage: fr6decode [-r rate] [-b baud] [-p pr2] [-i] [capture]\n");
+            return 2;
+        }
+    }
+    FILE *in = stdin;
+    if (optind < argc && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 2;
+    }
+    double spb = rate / baud;  // samples per bit
+    if (spb < 3 || spb > MAX_SAMPLES_PER_BIT) {
+        fprintf(stderr, "fr6decode: need 3 to %d samples per bit\n", MAX_SAMPLES_PER_BIT);
+        return 2;
+    }
+
+    printf("t_s,seq,rpm,speed_x16,duty,duty_pct,state,fault,hv_v,iv_a,mv_v,power_w,"
+           "power_limited\n");
+    // UART receive: a falling edge from idle starts a byte, then each bit
+    // is read in the middle of its time
+    unsigned long n = 0, start = 0;
+    int c, last = 1, busy = 0;
+    unsigned shift = 0, bit = 0;
+    while ((c = fgetc(in)) != EOF) {
+        if (c != '0' && c != '1') continue;
+        int level = (c == '1') ^ invert;
+        if (!busy) {
+            if (last && !level) { busy = 1; start = n; bit = 0; shift = 0; }
+        } else if (n == start + (unsigned long)((bit + 0.5) * spb)) {
+            if (bit == 0 && level) busy = 0;  // glitch, not a start bit
+            else if (bit >= 1 && bit <= 8) shift |= (unsigned)level << (bit - 1);
+            else if (bit == 9) {
+                if (level) byte((uint8_t)shift, start / rate);
+                else ++badBytes;  // framing error
+                busy = 0;
+            }
+            ++bit;
+        }
+        last = level;
+        ++n;
+    }
+    fprintf(stderr, "fr6decode: %u frames, %u bad checksums, %u stray bytes\n",
+            frames, badSums, badBytes);
+    return frames == 0 || badSums || badBytes;
+}
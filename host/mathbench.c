@@ -0,0 +1,224 @@
+/*
+ * File:   mathbench.c  (host tool)
+ *
+ * Instruction cycles of the PF906math.h kernels against the C they
+ * replace, which XC8 turns into calls to its library multiply and divide.
+ * Those routines are copied here from the XC8 library sources as C, with
+ * the same MATH_CYCLES() counting as the kernels: the cycles of the PIC16
+ * instructions XC8 gives for each step, 1 per instruction and 2 for a
+ * goto, call, return or a skip taken.  So the figures are a model, but
+ * the same model both sides.
+ *
+ * usage: mathbench
+ *
+ * Each kernel is run over the inputs the firmware gives it and checked
+ * against the exact result - the exit status is 1 if any is out by more
+ * than it should be.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#define MATH_BENCH
+#include "PF906header.h"  // FAULT_IR_K, TICK_STEPS, MT_MIN_TICKS
+#include "PF906math.h"
+
+uint32_t mathCycles;
+
+// XC8's 16x16 multiply, multiplier is the first operand
+static uint16_t xc8_wmul(uint16_t multiplier, uint16_t multiplicand) {
+    uint16_t product = 0;
+    MATH_CYCLES(2 + 8 + 4);                    // call, 4 argument bytes, clear
+    do {
+        if (multiplier & 1) {
+            product += multiplicand;
+            MATH_CYCLES(6);
+        }
+        multiplicand <<= 1;
+        multiplier >>= 1;
+        MATH_CYCLES(3 + 3 + 3 + 5);            // bit test, 2 shifts, 2 byte test
+    } while (multiplier != 0);
+    MATH_CYCLES(2 + 4);                        // return, the result
+    return product;
+}
+
+// XC8's 32x32 multiply
+static uint32_t xc8_lmul(uint32_t multiplier, uint32_t multiplicand) {
+    uint32_t product = 0;
+    MATH_CYCLES(2 + 16 + 8);
+    do {
+        if (multiplier & 1) {
+            product += multiplicand;
+            MATH_CYCLES(12);
+        }
+        multiplicand <<= 1;
+        multiplier >>= 1;
+        MATH_CYCLES(3 + 5 + 5 + 7);
+    } while (multiplier != 0);
+    MATH_CYCLES(2 + 8);
+    return product;
+}
+
+// XC8's 32/32 divide
+static uint32_t xc8_lldiv(uint32_t divisor, uint32_t dividend) {
+    uint32_t quotient = 0;
+    uint8_t counter;
+    MATH_CYCLES(2 + 16 + 8 + 5);
+    if (divisor != 0) {
+        counter = 1;
+        while ((divisor & 0x80000000UL) == 0) {
+            divisor <<= 1;
+            counter++;
+            MATH_CYCLES(3 + 5 + 1 + 2);
+        }
+        do {
+            quotient <<= 1;
+            MATH_CYCLES(5 + 13);               // shift, 4 byte compare
+            if (divisor <= dividend) {
+                dividend -= divisor;
+                quotient |= 1;
+                MATH_CYCLES(12 + 1);
+            }
+            divisor >>= 1;
+            MATH_CYCLES(5 + 3);
+        } while (--counter != 0);
+    }
+    MATH_CYCLES(2 + 8);
+    return quotient;
+}
+
+typedef struct {
+    const char *name;
+    uint64_t naive, kernel, calls;
+    uint32_t naiveMax, kernelMax;
+    double err;        // worst error, as below
+    const char *unit;
+    double limit;
+} bench_t;
+
+static bench_t benches[] = {
+    {"Mul8 MV x IV", .unit = "counts", .limit = 0},
+    {"Mul8 ramp rate", .unit = "counts", .limit = 0},
+    {"MULC iv x 23", .unit = "counts", .limit = 0},
+    {"MULC tick x 250", .unit = "counts", .limit = 0},
+    {"Mul16x8", .unit = "counts", .limit = 0},
+    {"TachSpeed", .unit = "%", .limit = 0.05},
+    {"AddSatS16", .unit = "counts", .limit = 0},
+};
+
+static void charge(bench_t *b, uint32_t naive, uint32_t kernel, double err) {
+    b->naive += naive;
+    b->kernel += kernel;
+    if (naive > b->naiveMax) b->naiveMax = naive;
+    if (kernel > b->kernelMax) b->kernelMax = kernel;
+    if (err > b->err) b->err = err;
+    ++b->calls;
+}
+
+#define TIME(cycles, expr) (mathCycles = 0, (expr), (cycles) = mathCycles)
+
+/*
+ * MULC is folded by the compiler so it has no MATH_CYCLES of its own - it
+ * is a 2 byte shift (3 cycles) per bit below the top 1 of k and a 2 byte
+ * add (6) per 1 bit after the first, which is a move (4)
+ */
+static uint32_t mulcCycles(uint16_t k) {
+    uint32_t cycles = 4;
+    for (int n = 14; n >= 0; n--) {
+        if (k >> (n + 1) == 0) continue;
+        cycles += 3;
+        if (k >> n & 1) cycles += 6;
+    }
+    return cycles;
+}
+
+int main(void) {
+    uint32_t n, c;
+    bench_t *b;
+
+    // CheckPower - the top 8 bits of MV and IV
+    b = &benches[0];
+    for (unsigned mv = 0; mv < 256; mv++)
+        for (unsigned iv = 0; iv < 256; iv++) {
+            uint16_t naive, kernel;
+            TIME(n, naive = xc8_wmul(mv, iv));
+            TIME(c, kernel = Mul8(mv, iv));
+            charge(b, n, c, abs((int)naive - (int)kernel));
+        }
+    // RampDuty - rate x (rate + 1), rate 1..RAMP_ACCEL
+    b = &benches[1];
+    for (unsigned rate = 1; rate <= 64; rate++) {
+        uint16_t naive, kernel;
+        TIME(n, naive = xc8_wmul(rate, rate + 1));
+        TIME(c, kernel = Mul8(rate, rate + 1));
+        charge(b, n, c, abs((int)naive - (int)kernel));
+    }
+    // TaskFault - the IR drop, iv is 10 bits
+    b = &benches[2];
+    for (unsigned iv = 0; iv < 1024; iv++) {
+        uint16_t naive, kernel = MULC((uint16_t)iv, FAULT_IR_K);
+        TIME(n, naive = xc8_wmul(iv, FAULT_IR_K));
+        charge(b, n, mulcCycles(FAULT_IR_K), abs((int)naive - (int)kernel));
+    }
+    // TickSteps - whole ticks since the start
+    b = &benches[3];
+    for (unsigned ticks = 0; ticks < 256; ticks++) {
+        uint16_t naive, kernel = MULC((uint16_t)ticks, TICK_STEPS);
+        TIME(n, naive = xc8_wmul(ticks, TICK_STEPS));
+        charge(b, n, mulcCycles(TICK_STEPS), abs((int)naive - (int)kernel));
+    }
+    // 16x8 against the 32 bit multiply it would be done with
+    b = &benches[4];
+    for (unsigned a = 0; a < 65536; a += 251)
+        for (unsigned m = 0; m < 256; m++) {
+            uint32_t naive, kernel;
+            TIME(n, naive = xc8_lmul(m, a));
+            TIME(c, kernel = Mul16x8(a, m));
+            charge(b, n, c, labs((long)naive - (long)kernel));
+        }
+    // the M/T speed, from 4 slots at the slowest to about 12 at 4ms
+    b = &benches[5];
+    for (unsigned slots = MT_SLOTS; slots <= 16; slots++)
+        for (uint32_t ticks = MT_MIN_TICKS; ticks < 0x40000; ticks += 97) {
+            uint32_t naive;
+            uint16_t kernel;
+            double exact = slots * 3200000.0 / ticks;
+            if (exact > 0xFFFF) continue;
+            mathCycles = 0;
+            naive = xc8_lldiv(ticks, xc8_lmul(slots, 3200000UL) + (ticks >> 1));
+            n = mathCycles;
+            TIME(c, kernel = TachSpeed(slots, ticks));
+            // out by more than the rounding, as a % of the speed
+            double err = fabs(kernel - exact) - 0.5;
+            charge(b, n, c, err > 0 ? 100.0 * err / exact : 0);
+            if ((double)naive != floor(exact + 0.5) && fabs(naive - exact) > 0.5) {
+                fprintf(stderr, "mathbench: __lldiv %u / %u wrong\n", slots, ticks);
+                return 1;
+            }
+        }
+    // the PID integral - against adding in 32 bits and clamping
+    b = &benches[6];
+    for (int x = -32768; x < 32768; x += 61)
+        for (int y = -32768; y < 32768; y += 4099) {
+            long sum = (long)x + y;
+            int16_t kernel;
+            if (sum > 32767) sum = 32767;
+            if (sum < -32768) sum = -32768;
+            TIME(c, kernel = AddSatS16(x, y));
+            // 2 sign extends, a 4 byte add and 2 4 byte compares
+            charge(b, 6 + 12 + 2 * 14, c, labs(sum - kernel));
+        }
+
+    printf("kernel              calls   naive avg/max   kernel avg/max  speedup  worst error\n");
+    int bad = 0;
+    for (unsigned i = 0; i < sizeof benches / sizeof benches[0]; i++) {
+        b = &benches[i];
+        printf("%-16s %8llu  %6.1f %6u  %7.1f %6u  %6.2fx  %.3f %s\n", b->name,
+               (unsigned long long)b->calls, (double)b->naive / b->calls, b->naiveMax,
+               (double)b->kernel / b->calls, b->kernelMax, (double)b->naive / b->kernel,
+               b->err, b->unit);
+        if (b->err > b->limit) bad = 1;
+    }
+    return bad;
+}
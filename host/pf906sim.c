@@ -0,0 +1,1616 @@
+/*
+ * File:   pf906sim.c  (host build)
+ *
+ * Runs the unmodified PF906 firmware on the virtual PIC against the plant
+ * model and reports timing figures.
+ *
+ * usage: pf906sim [-l profile] [-s series.csv] [-e eeprom.bin] [-r trace]
+ *                 [scenario] [file]
+ *        pf906sim [-r trace] replay trace [expected]
+ *        pf906sim list
+ *
+ * scenario defaults to "startup".  file is where scenarios that write
+ * something put it, "telemetry" writes the FR6 capture for fr6decode.
+ * -l puts a load torque profile on the spindle (see plant.h), -s writes
+ * a time series of the run every 1ms as CSV.  -e keeps the data EEPROM in
+ * a file, loaded before the run (blank if there is no file) and saved
+ * after it, so the next run is the next power up.  -r records the pins, 
+ * comparators, ADC results and outputs as a trace (see trace.h), and the 
+ * replay scenario feeds one back to the firmware in place of the plant and
+ * compares the outputs with the trace's own, or with an expected trace.
+ *
+ * pf906sim_mt is the same with the M/T speed measurement (SPEED_MEASURE_MT)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include "sim.h"
+#include "plant.h"
+#include "trace.h"
+#include "PF906header.h"  // build options and SIM_MARK ids
+#include "firmware.h"      // the firmware's globals we read
+#if !RUN_STATS
+#error the harness reports the run statistics - build the firmware with RUN_STATS=1
+#endif
+
+#define ADC_IV 1  // adcSample[] index
+#if ISR_PROFILE
+static const char *isrPathName[ISR_PATHS] = {"tach", "adc go", "adc done", "tick", "window", "eeprom"};
+#endif
+static const char *taskName[TASKS] = {
+    "buttons", "speed", "pwm", "adc", "led", "fault", "power", "telemetry"
+};
+static const char *stateName[POWER_STATES] = {
+    "precharge", "relay", "armed", "run", "stopping", "fault"
+};
+static const char *faultName[FAULT_CHARGE + 1] = {
+    "none", "undervoltage", "overcurrent", "overspeed", "stall", "tach loss", "charge"
+};
+
+typedef struct {
+    const char *name;
+    const char *help;
+    double seconds;
+    void (*init)(void);   // optional, sets up the plant before the run
+    void (*tick)(void);   // runs every plant step to script the operator
+    int (*report)(void);  // prints results, returns the exit status
+} scenario_t;
+
+static const scenario_t *scenario;
+static const char *outFile, *expectFile;
+static FILE *series;
+static int seriesDiv;
+
+static double us(double cycles) {
+    return cycles * 1e6 / SIM_TCY_HZ;
+}
+
+// hold *button for 'on' seconds, n times, 'period' apart, starting at t0
+static void pressEvery(int *button, double t0, int n, double on, double period) {
+    double dt = plant.t - t0;
+    *button = dt >= 0 && dt < n * period && dt - (int)(dt / period) * period < on;
+}
+
+// hold *button for 100ms, n times, 300ms apart, starting at t0
+static void press(int *button, double t0, int n) {
+    pressEvery(button, t0, n, 0.1, 0.3);
+}
+
+static void printTiming(void) {
+    sim_mark_t *loop = &sim.mark[0];
+    printf("virtual time        %.3f s\n", sim_time());
+    if (plant.relayTime >= 0)
+        printf("relay closed at     %.3f s\n", plant.relayTime);
+    else
+        printf("relay closed at     never\n");
+    if (loop->count > 1)
+        printf("main loop period    min %.1f  avg %.1f  max %.1f us  (%llu passes)\n",
+               us(loop->min), us(loop->sum) / (loop->count - 1), us(loop->max),
+               (unsigned long long)loop->count);
+    sim_mark_t *tick = &sim.mark[SIM_MARK_TICK];
+    if (tick->count > 1)
+        printf("scheduler tick      min %.1f  avg %.1f  max %.1f us  (%llu ticks)\n",
+               us(tick->min), us(tick->sum) / (tick->count - 1), us(tick->max),
+               (unsigned long long)tick->count);
+    printf("interrupts          %llu", (unsigned long long)sim.isr_count);
+    if (sim.isr_count)
+        printf("  avg %.1f  max %llu cycles  (%.2f%% cpu)",
+               (double)sim.isr_cycles / sim.isr_count, (unsigned long long)sim.isr_max,
+               100.0 * sim.isr_cycles / sim.cycle);
+    printf("\n");
+    printf("adc conversions     %llu  (%llu under-acquired)\n",
+           (unsigned long long)sim.adc_conversions, (unsigned long long)sim.adc_short_acq);
+    printf("pwm duty            %u/%u  (%.1f%%)\n", sim.pwm_duty,
+           4 * (sim.reg[0x092] + 1), 100.0 * sim_pwm_on());
+    printf("motor               %.0f rpm  %.2f A  bus %.0f V\n",
+           plant_rpm(), plant.current, plant.vbus);
+}
+
+// worst case run time and start jitter of each scheduler task
+static void printTasks(void) {
+    printf("task     period ms  wcet us  jitter us  overruns\n");
+    for (unsigned i = 0; i < TASKS; i++)
+        printf("%-8s %9u  %7u  %9u  %8u\n", taskName[i], taskPeriod[i],
+               4 * taskWcet[i], 4 * taskJitter[i], taskOverruns[i]);
+}
+
+// power sequence - times each state was entered and how long it lasted
+static void printStates(void) {
+    printf("state      entries  last ms\n");
+    for (unsigned i = 0; i < POWER_STATES; i++) {
+        printf("%-10s %7u  ", stateName[i], stateEntries[i]);
+        if (i == powerState) printf("%7u (now)\n", stateTime);
+        else if (stateEntries[i]) printf("%7u\n", stateLast[i]);
+        else printf("%7s\n", "-");
+    }
+}
+
+/*
+ * startup - power request held from 0.5s, precharge, then five presses of
+ * speed up once the relay is in and a 5s run
+ */
+static void startupTick(void) {
+    plant.userPower = plant.t >= 0.5;
+    if (plant.relayTime >= 0) press(&plant.speedUp, plant.relayTime + 0.5, 5);
+}
+
+static int startupReport(void) {
+    printTiming();
+    printTasks();
+    printStates();
+    return plant.relayTime < 0;
+}
+
+/*
+ * load - caps already charged, run at step 8 (3450rpm, 207 pulses) and put
+ * a 2Nm cut on the spindle from 6s to 10s.  Shows the droop and how well 
+ * the speed control pulls it back
+ */
+static double loadBefore, loadMin, loadSum, loadEnd;
+static long loadN;
+
+static void warmCaps(void) {
+    plant.vbus = plant.vmains;
+}
+
+static void loadTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    plant.loadTorque = plant.t >= 6.0 && plant.t < 10.0 ? 2.0 : 0.0;
+    if (plant.t < 6.0) { loadBefore = plant_rpm(); loadMin = 1e9; }
+    else if (plant.t < 10.0) {
+        if (plant_rpm() < loadMin) loadMin = plant_rpm();
+        if (plant.t >= 9.0) { loadSum += plant_rpm(); ++loadN; }
+    }
+    loadEnd = plant_rpm();
+}
+
+static int loadReport(void) {
+    printTiming();
+    printf("no load             %.0f rpm\n", loadBefore);
+    printf("2Nm cut             min %.0f rpm, %.0f rpm after 3s (%.1f%% droop)\n",
+           loadMin, loadSum / loadN, 100.0 * (1.0 - loadSum / loadN / loadBefore));
+    printf("after the cut       %.0f rpm\n", loadEnd);
+    return 0;
+}
+
+/*
+ * speedmeas - spin the shaft at fixed speeds (deliberately not whole 
+ * pulses per 0.1s) and compare the firmware's measuredSpeed with the true 
+ * pulse rate.  Run it on pf906sim and pf906sim_mt to compare the gated 
+ * count with the M/T method
+ */
+static const double measRpm[] = {510, 1015, 1730, 2420, 3465, 4490};
+#define MEAS_STEPS (sizeof measRpm / sizeof measRpm[0])
+#define MEAS_HOLD 1.5   // seconds at each speed, the first 0.5s is ignored
+static struct {
+    uint64_t n, lastMark;
+    double sumErr, maxErr, sumSq;
+    double firstT, lastT;
+} meas[MEAS_STEPS];
+
+static void measTick(void) {
+    unsigned i = (unsigned)(plant.t / MEAS_HOLD);
+    plant.userPower = 1;
+    if (i >= MEAS_STEPS) return;
+    plant.forceRpm = measRpm[i];
+    uint64_t marks = sim.mark[SIM_MARK_SPEED].count;
+    if (marks == meas[i].lastMark) return;
+    meas[i].lastMark = marks;
+    if (plant.t - i * MEAS_HOLD < 0.5) return;
+    double truth = measRpm[i] * 36 / 600.0;  // pulses per 0.1s
+    double err = 100.0 * (measuredSpeed / 16.0 - truth) / truth;
+    if (meas[i].n == 0) meas[i].firstT = plant.t;
+    meas[i].lastT = plant.t;
+    ++meas[i].n;
+    meas[i].sumErr += err;
+    meas[i].sumSq += err * err;
+    if (fabs(err) > meas[i].maxErr) meas[i].maxErr = fabs(err);
+}
+
+static int measReport(void) {
+    printf("   rpm  readings  interval ms  mean err %%  rms err %%  max err %%\n");
+    for (unsigned i = 0; i < MEAS_STEPS; i++) {
+        double n = meas[i].n;
+        printf("%6.0f  %8.0f  %11.2f  %10.3f  %9.3f  %9.3f\n", measRpm[i], n,
+               n > 1 ? 1e3 * (meas[i].lastT - meas[i].firstT) / (n - 1) : 0.0,
+               n ? meas[i].sumErr / n : 0.0, n ? sqrt(meas[i].sumSq / n) : 0.0,
+               meas[i].maxErr);
+    }
+    printf("interrupts          %llu  (%.2f%% cpu)\n", (unsigned long long)sim.isr_count,
+           100.0 * sim.isr_cycles / sim.cycle);
+    return 0;
+}
+
+/*
+ * adc - run at step 5 for 3s and check the background ADC sequencer: how 
+ * often each channel is converted, whether any conversion started before 
+ * the channel had acquired, and that the latest samples match the plant
+ */
+static void adcTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 5);
+}
+
+static int adcReport(void) {
+    static const struct { const char *name; int an; } ch[] = {
+        {"MV", 2}, {"IV", 4}, {"HV", 5},
+    };
+    int bad = 0;
+    printTiming();
+    printf("chan  an  samples/s  latest  expected\n");
+    for (unsigned i = 0; i < 3; i++) {
+        int expect = (int)(sim.an[ch[i].an] / sim.vdd * 1023.0 + 0.5);
+        printf("%-4s  %2d  %9.0f  %6u  %8d\n", ch[i].name, ch[i].an,
+               sim.adc_chan_conversions[ch[i].an] / sim_time(), adcSample[i], expect);
+        // the motor side moves with the PWM ripple, allow a few counts
+        if (abs((int)adcSample[i] - expect) > 8) bad = 1;
+        if (sim.adc_chan_conversions[ch[i].an] / sim_time() < 500) bad = 1;
+    }
+    return bad || sim.adc_short_acq != 0;
+}
+
+/*
+ * buttons - 5ms of contact bounce on every press and release.  6 presses of
+ * speed up then 2 of speed down must give exactly step 4, and shows how 
+ * long after the contact first closes the press takes effect
+ */
+static struct {
+    int lastUp, lastDown, waiting;
+    uint8_t lastCtr;
+    double pressT, minLat, maxLat, sumLat;
+    int steps;
+} btn = {.minLat = 1e9};
+
+static void buttonsInit(void) {
+    warmCaps();
+    plant.bounce = 0.005;
+}
+
+static void buttonsTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 6);
+    press(&plant.speedDown, 3.0, 2);
+    if ((plant.speedUp && !btn.lastUp) || (plant.speedDown && !btn.lastDown)) {
+        btn.pressT = plant.t;
+        btn.waiting = 1;
+    }
+    btn.lastUp = plant.speedUp;
+    btn.lastDown = plant.speedDown;
+    if (desiredSpeedCtr != btn.lastCtr) {
+        btn.lastCtr = desiredSpeedCtr;
+        ++btn.steps;
+        if (btn.waiting) {
+            double lat = plant.t - btn.pressT;
+            btn.waiting = 0;
+            if (lat < btn.minLat) btn.minLat = lat;
+            if (lat > btn.maxLat) btn.maxLat = lat;
+            btn.sumLat += lat;
+        }
+    }
+}
+
+static int buttonsReport(void) {
+    printTiming();
+    printTasks();
+    printf("presses             8 with 5ms bounce, %d registered, speed step %u (want 4)\n",
+           btn.steps, desiredSpeedCtr);
+    if (btn.steps)
+        printf("press to setpoint   min %.2f  avg %.2f  max %.2f ms\n", 1e3 * btn.minLat,
+               1e3 * btn.sumLat / btn.steps, 1e3 * btn.maxLat);
+    return btn.steps != 8 || desiredSpeedCtr != 4;
+}
+
+/*
+ * ramp - 11 quick presses from standstill to step 11 (4500rpm).  Shows 
+ * what the duty ramp does to the peak motor current and how long it takes
+ * to get to speed.  make ramps runs it for each ramp setting.  Fails if
+ * it never gets to 98%, as the build without a ramp does when it trips
+ */
+static struct {
+    double peakI, t98, maxRpm;
+} ramp;
+
+static void rampTick(void) {
+    plant.userPower = 1;
+    pressEvery(&plant.speedUp, 0.5, 11, 0.025, 0.05);
+    if (plant.current > ramp.peakI) ramp.peakI = plant.current;
+    if (plant_rpm() > ramp.maxRpm) ramp.maxRpm = plant_rpm();
+    if (ramp.t98 == 0 && plant_rpm() >= 0.98 * 4500) ramp.t98 = plant.t - 0.5;
+}
+
+static int rampReport(void) {
+    printTiming();
+    printf("ramp                accel %d  decel %d  s-curve %d  (x1/64 duty per ms)\n",
+           RAMP_ACCEL, RAMP_DECEL, RAMP_S_CURVE);
+    printf("peak current        %.1f A\n", ramp.peakI);
+    if (ramp.t98 == 0) {
+        printf("0 to 98%% of 4500    never, %.0f rpm at most\n", ramp.maxRpm);
+    } else {
+        printf("0 to 98%% of 4500    %.3f s\n", ramp.t98);
+        printf("overshoot           %.0f rpm\n", ramp.maxRpm - 4500);
+    }
+    printf("fault               %s\n", faultName[faultCode]);
+    return ramp.t98 == 0;
+}
+
+/*
+ * fine - hold both speed buttons to get fine mode, one press up (to the 
+ * minimum speed), hold up for 2s to auto repeat, then 3 presses down.  The
+ * setpoint must end exactly 3 steps below where the hold left it and the 
+ * motor must settle on it
+ */
+static struct {
+    double afterHold, rpmSum;
+    long rpmN;
+} fine;
+
+static void fineTick(void) {
+    plant.userPower = 1;
+    plant.speedUp = (plant.t >= 0.5 && plant.t < 1.3) ||  // both for 0.8s
+                    (plant.t >= 2.0 && plant.t < 2.1) ||  // one press
+                    (plant.t >= 3.0 && plant.t < 5.0);    // hold 2s
+    press(&plant.speedDown, 5.5, 3);
+    if (plant.t >= 0.6 && plant.t < 1.3) plant.speedDown = 1;
+    if (plant.t >= 5.0 && plant.t < 5.5) fine.afterHold = setpoint;
+    if (plant.t >= 9.0) { fine.rpmSum += plant_rpm(); ++fine.rpmN; }
+}
+
+static int fineReport(void) {
+    double want = (fine.afterHold - 3 * RPM_TO_SPEED(SPEED_FINE_RPM)) * 600.0 / 36 / 16;
+    double got = setpoint * 600.0 / 36 / 16;
+    double rpm = fine.rpmSum / fine.rpmN;
+    printTiming();
+    printf("mode                %s\n", speedMode == SPEED_MODE_FINE ? "fine" : "preset");
+    printf("after the 2s hold   %.0f rpm\n", fine.afterHold * 600.0 / 36 / 16);
+    printf("setpoint            %.0f rpm (want %.0f)\n", got, want);
+    printf("motor over 9-10s    %.0f rpm (%.2f%% off)\n", rpm, 100.0 * (rpm - got) / got);
+    return speedMode != SPEED_MODE_FINE || got != want || fabs(rpm - got) > 0.01 * got;
+}
+
+/*
+ * overcurrent - run at step 8 then jam the spindle (a 40Nm load the motor 
+ * cannot turn) at 4s.  Needs an OC_TRIP build.  Reports how long after the 
+ * current crosses the trip level the PWM is shut down, how high the current
+ * got and what the trip policy did.  The crossing is put where it fell in 
+ * the plant step, between its current before and after, so the latency 
+ * is that part step, the comparator response and the shutdown delay (see 
+ * sim.c)
+ */
+static struct {
+    uint64_t tripCycle;
+    double crossCycle, lastI, tripAmps, peakI, offT;
+} oc;
+
+static void ocInit(void) {
+    warmCaps();
+    plant.ivOnRc2 = 1;
+    // CVREF high range with OC_VR, as set up by setupOvercurrent()
+    oc.tripAmps = (sim.vdd / 4 + sim.vdd * OC_VR / 32) / plant.ivScale;
+}
+
+static void ocTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    plant.loadTorque = plant.t >= 4.0 ? 40.0 : 0.0;
+    double lastI = oc.lastI;
+    oc.lastI = plant.current;
+    if (plant.t < 4.0) return;
+    if (plant.current > oc.peakI) oc.peakI = plant.current;
+    if (!oc.crossCycle && plant.current > oc.tripAmps)
+        oc.crossCycle = sim.cycle - SIM_PLANT_CYCLES * (lastI < oc.tripAmps ?
+            (plant.current - oc.tripAmps) / (plant.current - lastI) : 0.0);
+    if (oc.crossCycle && !oc.tripCycle && sim.shutdown_cycle >= oc.crossCycle)
+        oc.tripCycle = sim.shutdown_cycle;
+    if (!oc.offT && sim_output(SIM_PORTA, 5) == 0) oc.offT = plant.t;
+}
+
+static int ocReport(void) {
+    printTiming();
+    printf("policy              %s\n", OC_CYCLE_LIMIT ? "current limit" : "latch and retry");
+    printf("trip level          %.1f A\n", oc.tripAmps);
+    if (oc.tripCycle)
+        printf("trip latency        %.1f us from crossing to PWM off\n",
+               us(oc.tripCycle - oc.crossCycle));
+    else
+        printf("trip latency        never tripped\n");
+    printf("peak current        %.1f A after the jam\n", oc.peakI);
+    printf("trips               %u ticks, %s\n", ocTrips,
+           ocLatched ? "latched off" : "not latched");
+    if (oc.offT) printf("motor shut down     %.3f s after the jam\n", oc.offT - 4.0);
+    return !OC_TRIP || !oc.tripCycle || us(oc.tripCycle - oc.crossCycle) > 5.0 ||
+           (!OC_CYCLE_LIMIT && !ocLatched);
+}
+
+/*
+ * rearm - the power sequence through 2 clean stops.  Step 3, back down to
+ * 0 with power held (back to armed), step 2, then let go of power at 5s
+ * (relay opens, back to precharge) and ask for power again at 6s.  The 
+ * caps are still charged so it must re-arm and run step 2 again without a
+ * power cycle
+ */
+static double rearmRpm;
+
+static void rearmTick(void) {
+    plant.userPower = (plant.t >= 0.5 && plant.t < 5.0) || plant.t >= 6.0;
+    plant.speedUp = 0;
+    plant.speedDown = 0;
+    if (plant.t < 2.5) press(&plant.speedUp, 1.0, 3);
+    else if (plant.t < 3.5) press(&plant.speedDown, 2.5, 3);
+    else if (plant.t < 6.5) press(&plant.speedUp, 3.5, 2);
+    else press(&plant.speedUp, 6.5, 2);
+    if (plant.t >= 4.9 && plant.t < 5.0) rearmRpm = plant_rpm();
+}
+
+static int rearmReport(void) {
+    static const uint8_t want[POWER_STATES] = {2, 2, 3, 3, 2, 0};
+    int bad = powerState != POWER_RUN || plant_rpm() < 0.9 * rearmRpm;
+    printTiming();
+    printStates();
+    printf("before letting go   %.0f rpm\n", rearmRpm);
+    printf("after re-arming     %.0f rpm\n", plant_rpm());
+    for (unsigned i = 0; i < POWER_STATES; i++)
+        if (stateEntries[i] != want[i]) bad = 1;
+    return bad;
+}
+
+/*
+ * precharge - power held from 0.5s with the caps flat, the relay closes 
+ * and nothing else.  Reports when it closed and the inrush through RLA2, 
+ * against the RELAY_PEAK_A / RELAY_I2T rating.  precharge-lo and -hi are 
+ * the same on 90% and 110% mains.  make precharge runs all 3 with and 
+ * without PRECHARGE_FIT.
+ * 
+ * precharge-open (R55 open) and precharge-leaky (47k across the caps) must
+ * give the charge fault and never close the relay.
+ */
+static double chargeMains = 1.0;
+
+static void precharge(double mains) {
+    chargeMains = mains;
+    plant.vmains *= mains;
+}
+static void prechargeInit(void) { precharge(1.0); }
+static void prechargeLoInit(void) { precharge(0.9); }
+static void prechargeHiInit(void) { precharge(1.1); }
+static void prechargeOpenInit(void) { plant.rPrecharge = 1e12; }
+static void prechargeLeakyInit(void) { plant.rLeak = 47e3; }
+
+static void prechargeTick(void) {
+    plant.userPower = plant.t >= 0.5;
+}
+
+static int prechargeReport(void) {
+    double dv = plant.relayPeak * plant.rRelay;
+    int over = plant.relayPeak > RELAY_PEAK_A || plant.relayI2t > RELAY_I2T;
+    printTiming();
+#if PRECHARGE_FIT
+    double r = chargeRatio / 4096.0, window = (1 << PRECHARGE_WINDOW_SHIFT) / 1000.0;
+    if (chargeRatio)
+        printf("fit                 final %.0f V  tau %u s (%.1f s from r)\n",
+               chargeFinal * 320.0 / HV_COUNTS(320), chargeTau, -window / log(r));
+#endif
+    printf("fault               %s\n", faultName[faultCode]);
+    if (plant.relayTime < 0) return !PRECHARGE_FIT || faultCode != FAULT_CHARGE;
+    printf("%s  mains %3.0f%%  relay after %5.2f s  step %3.0f V  "
+           "peak %3.0f A  I2t %4.0f A2s%s\n", PRECHARGE_FIT ? "fit  " : "fixed",
+           100 * chargeMains, plant.relayTime - 0.5, dv, plant.relayPeak,
+           plant.relayI2t, over ? "  OVER RATING" : "");
+    return faultCode != FAULT_NONE || (PRECHARGE_FIT && over);
+}
+
+/*
+ * telemetry - run at step 8 with a 2Nm cut from 3s to 4s, and sample the 
+ * FR6 pin every 100us into the file (default fr6.txt) for fr6decode.  
+ * make telemetry decodes it into build/telemetry.csv
+ */
+static FILE *capture;
+static int captureDiv;
+
+static void telemetryInit(void) {
+    warmCaps();
+    if (!outFile) outFile = "fr6.txt";
+    if (!(capture = fopen(outFile, "w"))) perror(outFile);
+}
+
+static void telemetryTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    plant.loadTorque = plant.t >= 3.0 && plant.t < 4.0 ? 2.0 : 0.0;
+    if (capture && ++captureDiv == 100) {
+        captureDiv = 0;
+        fputc(sim_output(SIM_PORTA, 1) ? '1' : '0', capture);
+    }
+}
+
+static int telemetryReport(void) {
+    printTiming();
+    printTasks();
+    if (!capture) return 1;
+    fputc('\n', capture);
+    fclose(capture);
+#if TELEMETRY
+    printf("frames sent         %u, capture in %s\n", txSeq, outFile);
+#endif
+    return !TELEMETRY;
+}
+
+/*
+ * fault-xx - run at step 8 (3450rpm) then make something go wrong at 4s.  
+ * Checks that the supervisor picks the right fault and shuts the motor 
+ * down (TotemControl and PowerPermissive low) within that fault's 
+ * FAULT_xx_MS of the condition starting.
+ * 
+ *   fault-uv         mains drops to 60V
+ *   fault-jam        40Nm jam - overcurrent, or a stall with the OC_TRIP 
+ *                    current limit holding the current down (pf906sim_oc)
+ *   fault-overspeed  the spindle is driven to 5400rpm
+ *   fault-tach       the tach opto goes dark
+ */
+static struct {
+    int want;         // FAULT_xx expected
+    double limitMs;   // its FAULT_xx_MS
+    double startT;    // when the condition started
+    double offT;      // when the motor was shut down
+} flt;
+
+static void faultStart(int want, double limitMs) {
+    warmCaps();
+    plant.ivOnRc2 = OC_TRIP;
+    flt.want = want;
+    flt.limitMs = limitMs;
+}
+
+static void uvInit(void) { faultStart(FAULT_UNDERVOLTAGE, FAULT_UV_MS); }
+static void overspeedInit(void) { faultStart(FAULT_OVERSPEED, FAULT_OVERSPEED_MS); }
+static void tachInit(void) { faultStart(FAULT_TACH, FAULT_TACH_MS); }
+static void jamInit(void) {
+    if (OC_TRIP && OC_CYCLE_LIMIT) faultStart(FAULT_STALL, FAULT_STALL_MS);
+    else faultStart(FAULT_OVERCURRENT, FAULT_OC_MS);
+}
+
+static void faultTick(void) {
+    int started = 0;
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    if (plant.t >= 4.0) {
+        switch (flt.want) {
+        case FAULT_UNDERVOLTAGE:
+            plant.vmains = 60.0;
+            started = plant.vbus * plant.hvScale < params.minimumVoltage * sim.vdd / 1023;
+            break;
+        case FAULT_OVERCURRENT:
+            plant.loadTorque = 40.0;
+            started = plant.current * plant.ivScale > params.faultOcIv * sim.vdd / 1023;
+            break;
+        case FAULT_STALL:
+            plant.loadTorque = 40.0;
+            started = plant_rpm() < FAULT_STALL_RPM;
+            break;
+        case FAULT_OVERSPEED:
+            plant.forceRpm = 5400.0;
+            started = plant_rpm() > FAULT_OVERSPEED_RPM;
+            break;
+        case FAULT_TACH:
+            plant.tachLost = 1;
+            started = 1;
+            break;
+        }
+    }
+    if (started && !flt.startT) flt.startT = plant.t;
+    if (flt.startT && !flt.offT && sim_output(SIM_PORTA, 5) == 0 &&
+        sim_output(SIM_PORTB, 7) == 0)
+        flt.offT = plant.t;
+}
+
+static int faultReport(void) {
+    double ms = (flt.offT - flt.startT) * 1000.0;
+    printTiming();
+    printf("fault               %s (want %s)\n", faultName[faultCode], faultName[flt.want]);
+    if (flt.offT)
+        printf("detection latency   %.1f ms (limit %.0f ms)\n", ms, flt.limitMs);
+    else
+        printf("detection latency   never shut down\n");
+    return faultCode != flt.want || !flt.offT || ms > flt.limitMs;
+}
+
+/*
+ * cut - run at step 8 (3450rpm) under the load profile given with -l, 
+ * "step" without one.  Reports the droop, how long the speed takes to come
+ * back within 1% of where it was before the load after the lowest point,
+ * and when it last strayed outside that (the load coming off counts too)
+ * - run it with -s to see the whole recovery
+ */
+static struct {
+    double sum, before, min, minT, backT, outT;
+    long n;
+} cut;
+
+static void cutInit(void) {
+    warmCaps();
+    if (!plantProfile.n) plant_profile("step");
+}
+
+static void cutTick(void) {
+    double rpm = plant_rpm();
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    if (plantProfile.start < 0 || plant.t < plantProfile.start) {
+        // the speed to come back to is the mean over the 0.5s before the load
+        if (plant.t >= plantProfile.start - 0.5) {
+            cut.sum += rpm;
+            cut.before = cut.sum / ++cut.n;
+        }
+        cut.min = 1e9;
+        return;
+    }
+    if (rpm < cut.min) { cut.min = rpm; cut.minT = plant.t; }
+    if (fabs(rpm - cut.before) > 0.01 * cut.before) cut.outT = plant.t;
+    else if (cut.backT < cut.minT) cut.backT = plant.t;
+}
+
+static int cutReport(void) {
+    printTiming();
+    if (plantProfile.start < 0) {
+        printf("load                none\n");
+        return 0;
+    }
+    printf("before the load     %.0f rpm\n", cut.before);
+    printf("droop               min %.0f rpm (%.1f%%) at %.3f s, %.3f s into the load\n",
+           cut.min, 100.0 * (1.0 - cut.min / cut.before), cut.minT,
+           cut.minT - plantProfile.start);
+    if (cut.backT < cut.minT)
+        printf("recovery            not back within 1%% by the end\n");
+    else
+        printf("recovery            within 1%% at %.3f s, %.3f s after the low point\n",
+               cut.backT, cut.backT - cut.minT);
+    if (cut.outT < sim_time() - 0.01)
+        printf("settled             within 1%% from %.3f s on\n", cut.outT);
+    printf("fault               %s\n", faultName[faultCode]);
+    return 0;
+}
+
+/*
+ * snapshot - the gated count hand over from the ISR to the main loop.
+ * 
+ * Up to 2s the motor is spun at 3000rpm and the length of each window is 
+ * timed from one Timer 1 overflow to the next, which should be 0.1s to 
+ * the microsecond now the reload is added rather than written.
+ * 
+ * From 2s the shaft is stopped and at the SIM_PREEMPT() points inside 
+ * ReadSpeedSnap() the harness closes 1 or 2 windows itself, taking each 
+ * point and each number in turn, with counts of 255 and 256 so any mix of 
+ * the bytes of 2 of them is wrong in both.  Each copy the main loop ends 
+ * up with must be exactly the count latched for its sequence number.
+ */
+#define SNAP_INJECT_T 2.0
+#if !SPEED_MEASURE_MT
+static struct {
+    uint8_t lastSeq, seqAtStart;
+    uint16_t latched[256];  // what the ISR latched for each speedSeq
+    uint64_t lastWindow;
+    int overflow;
+    double windows, sum, min, max;
+    unsigned long passes, checked, injected[3][2], missedIrq, reread, wouldTear, torn;
+    unsigned pattern;
+    uint8_t lastChecked;
+} snap = {.min = 1e9};
+
+static void snapLatched(void) {
+    uint8_t i = speedSeq & 1;
+    snap.latched[speedSeq] = speedSnapL[i] | speedSnapH[i] << 8;
+    snap.lastSeq = speedSeq;
+}
+
+static void snapPreempt(int id) {
+    if (plant.t < SNAP_INJECT_T) return;
+    if (id == 1) {
+        // the copy from the last time round must be one the ISR latched
+        if (speedSeqSeen != snap.lastChecked) ++snap.checked;
+        snap.lastChecked = speedSeqSeen;
+        if (speedSnap != snap.latched[speedSeqSeen]) ++snap.torn;
+        snap.seqAtStart = speedSeq;
+        ++snap.passes;
+    }
+    // pass 0 of 7 is left alone, then 1 window at points 1, 2 and 3, then 2
+    int c = snap.passes % 7, n = c > 3 ? 2 : 1, point = c > 3 ? c - 3 : c;
+    if (c && id == point) {
+        for (int k = 0; k < n; k++) {
+            actualSpeedPulses = snap.pattern++ & 1 ? 0x0100 : 0x00FF;
+            sim.reg[0x00C] |= 0x01;  // TMR1IF
+            if (!sim_irq()) ++snap.missedIrq;
+            snapLatched();
+        }
+        ++snap.injected[point - 1][n - 1];
+    }
+    if (id == 3 && speedSeq != snap.seqAtStart) {
+        ++snap.reread;
+        // the buffer being read was written again between lo and hi
+        if ((uint8_t)(speedSeq - snap.seqAtStart) >= 2 && point == 2 && c) ++snap.wouldTear;
+    }
+}
+#endif
+
+static void snapInit(void) {
+    warmCaps();
+#if !SPEED_MEASURE_MT
+    sim.preempt = snapPreempt;
+#endif
+}
+
+static void snapTick(void) {
+    plant.userPower = 1;
+    plant.forceRpm = plant.t < SNAP_INJECT_T ? 3000 : 0;
+    if (plant.t >= SNAP_INJECT_T) plant.omega = 0;
+#if !SPEED_MEASURE_MT
+    int overflow = sim.reg[0x00C] & 0x01;  // TMR1IF
+    if (overflow && !snap.overflow && plant.t < SNAP_INJECT_T) {
+        if (snap.lastWindow) {
+            double ms = (sim.cycle - snap.lastWindow) * 1e3 / SIM_TCY_HZ;
+            snap.windows++;
+            snap.sum += ms;
+            if (ms < snap.min) snap.min = ms;
+            if (ms > snap.max) snap.max = ms;
+        }
+        snap.lastWindow = sim.cycle;
+    }
+    snap.overflow = overflow;
+    if (speedSeq != snap.lastSeq) snapLatched();
+#endif
+}
+
+static int snapReport(void) {
+#if SPEED_MEASURE_MT
+    printf("gated count only - build with SPEED_MEASURE_MT 0\n");
+    return 0;
+#else
+    double mean = snap.windows ? snap.sum / snap.windows : 0;
+    printf("windows             %.0f  mean %.4f  min %.4f  max %.4f ms\n",
+           snap.windows, mean, snap.min, snap.max);
+    printf("reader passes       %lu, %lu new windows checked\n", snap.passes, snap.checked);
+    for (int p = 0; p < 3; p++)
+        printf("injected at point %d %lu x 1 window, %lu x 2 windows\n", p + 1,
+               snap.injected[p][0], snap.injected[p][1]);
+    printf("re-reads            %lu  (%lu would have torn without)\n", snap.reread,
+           snap.wouldTear);
+    printf("torn reads          %lu\n", snap.torn);
+    return snap.torn || snap.missedIrq || !snap.wouldTear || fabs(mean - 100.0) > 0.002;
+#endif
+}
+
+/*
+ * isr - the shaft spun at 4500rpm with the motor armed, so the tach edges 
+ * come at their fastest alongside the ADC sequencer, the tick and the 
+ * telemetry.  Reports how long each edge waits for the ISR to clear C1IF 
+ * and, on the ISR_PROFILE builds (pf906sim_isrprof), what the firmware 
+ * measured for each path of the ISR with Timer 2
+ */
+static void isrTick(void) {
+    plant.userPower = 1;
+    plant.forceRpm = 4500;
+}
+
+static int isrReport(void) {
+    double secs = sim_time();
+    printTiming();
+    printf("tach edge to C1IF   avg %.1f  max %llu cycles over %llu edges (%.0f/s)\n",
+           sim.c1_serviced ? (double)sim.c1_latency_sum / sim.c1_serviced : 0.0,
+           (unsigned long long)sim.c1_latency_max, (unsigned long long)sim.c1_serviced,
+           sim.c1_serviced / secs);
+#if ISR_PROFILE
+    printf("path      count/s  avg cyc  max cyc   cpu %%\n");
+    for (int i = 0; i < ISR_PATHS; i++) {
+        // isrCount wraps at 65536 - the cycles total does not over 2s
+        double n = isrCount[i], avg = n ? isrCycles[i] / n : 0;
+        printf("%-9s %7.0f  %7.1f  %7u  %6.2f\n", isrPathName[i], n / secs, avg, isrMax[i],
+               100.0 * isrCycles[i] / sim.cycle);
+    }
+    printf("isr latency         max %u cycles from TMR2IF to its path\n", isrLatencyMax);
+    printf("tach cost           %.2f%% cpu in its path, %.2f%% with an entry and exit per edge\n",
+           100.0 * isrCycles[ISR_PATH_TACH] / sim.cycle,
+           100.0 * (isrCycles[ISR_PATH_TACH] + (double)isrCount[ISR_PATH_TACH] *
+                    (SIM_ISR_ENTRY_CYCLES + SIM_ISR_EXIT_CYCLES)) / sim.cycle);
+#endif
+    return 0;
+}
+
+/*
+ * adcfilter - 3450rpm under a steady 2Nm from 3s with the PWM ripple and 3mV
+ * of noise on the sense lines.  From 4s to 8s each new IV value at each 
+ * stage of the filtering - the raw sample, the oversampled ADC_BITS value
+ * and the IIR in TaskADC - is compared with the averaged motor current put 
+ * through the same stages, so what is left is the ripple, noise and 
+ * rounding that got through.  Its spread gives the effective bits against
+ * the 5V full scale
+ */
+typedef struct {
+    const char *name;
+    double sum, sq;
+    long n;
+} adcStage_t;
+
+static adcStage_t adcStage[3] = {{"raw"}, {"oversampled"}, {"iir"}};
+static struct {
+    uint8_t count, seen, pending;
+    double sum, decimated, iir;  // plant.current through the same stages
+} adcTruth;
+
+static void adcStageAdd(adcStage_t *st, double counts, double fullScale, double truth) {
+    double err = counts / fullScale * sim.vdd / plant.ivScale - truth;
+    if (plant.t < 4.0) return;
+    st->sum += err;
+    st->sq += err * err;
+    ++st->n;
+}
+
+static void adcFilterInit(void) {
+    warmCaps();
+    plant.ivRipple = 1;
+    plant.noise = 0.003;
+}
+
+static void adcFilterTick(void) {
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    plant.loadTorque = plant.t >= 3.0 ? 2.0 : 0.0;
+    if (adcCount[ADC_IV] != adcTruth.count) {
+        // TaskADC is done with the last new value by the next conversion
+        if (adcTruth.pending) {
+            adcTruth.pending = 0;
+            adcStageAdd(&adcStage[2], ivFilt, 1023 << (ADC_BITS - 10 + ADC_IIR_FRAC),
+                        adcTruth.iir);
+        }
+        adcTruth.count = adcCount[ADC_IV];
+        adcTruth.sum += plant.current;
+        adcStageAdd(&adcStage[0], adcSample[ADC_IV], 1023, plant.current);
+        if (!(adcTruth.count & (ADC_OVERSAMPLE - 1))) {
+            adcTruth.decimated = adcTruth.sum / ADC_OVERSAMPLE;
+            adcTruth.sum = 0;
+            adcStageAdd(&adcStage[1], adcDecimated[ADC_IV], 1023 << ADC_OVERSAMPLE_SHIFT,
+                        adcTruth.decimated);
+        }
+    }
+    if (adcDecimatedSeen[ADC_IV] != adcTruth.seen) {
+        adcTruth.seen = adcDecimatedSeen[ADC_IV];
+        adcTruth.iir += (adcTruth.decimated - adcTruth.iir) / (1 << ADC_IIR_SHIFT);
+        adcTruth.pending = 1;
+    }
+}
+
+static int adcFilterReport(void) {
+    double secs = sim_time() - 4.0, fullScale = sim.vdd / plant.ivScale;
+    printTiming();
+    printf("motor current %.2f A, ripple on IV, %.1f mV rms noise, ADC_SYNC_PWM %d\n",
+           plant.current, plant.noise * 1000, ADC_SYNC_PWM);
+    printf("IV stage     values/s  mean err A  rms err A  enob\n");
+    for (int i = 0; i < 3; i++) {
+        adcStage_t *st = &adcStage[i];
+        double mean = st->n ? st->sum / st->n : 0;
+        double sd = st->n ? sqrt(st->sq / st->n - mean * mean) : 0;
+        printf("%-12s %8.0f  %10.3f  %9.3f  %4.1f\n", st->name, st->n / secs, mean,
+               st->n ? sqrt(st->sq / st->n) : 0, sd > 0 ? log2(fullScale / (sd * sqrt(12))) : 0);
+    }
+    printTasks();
+#if ISR_PROFILE
+    printf("path      count/s  avg cyc  max cyc   cpu %%\n");
+    for (int i = 0; i < ISR_PATHS; i++) {
+        double n = isrCount[i], avg = n ? isrCycles[i] / n : 0;
+        printf("%-9s %7.0f  %7.1f  %7u  %6.2f\n", isrPathName[i], n / sim_time(), avg,
+               isrMax[i], 100.0 * isrCycles[i] / sim.cycle);
+    }
+#endif
+    return adcStage[2].n == 0;
+}
+
+/*
+ * power - a heavy cut coming on slowly: the load rises from 0 at 5s to 
+ * 4.5Nm at 8s at 4500rpm (power-low: at 2400rpm) and holds to 13s.  
+ * Reports the most electrical power and current the motor drew, averaged 
+ * over 10ms, the speed it held under the full load and how far the firmware's motorPower is 
+ * from the true power.  Without POWER_LIMIT (pf906sim) the motor takes 
+ * whatever the cut needs.  pf906sim_power holds the rated 10.7A, which is 
+ * 3.9Nm so the cut stalls it.  pf906sim_powerconst allows 14A, 5.1Nm, 
+ * and slows down to hold 1900W at 4500rpm
+ */
+static struct {
+    int presses;
+    double load, p, i, pMax, iMax, rpmMin, rpmEnd, estErr, estSum;
+    long n, estN;
+} pwr;
+
+static void powerStart(int presses, double load) {
+    warmCaps();
+    pwr.presses = presses;
+    pwr.load = load;
+    pwr.rpmMin = 1e9;
+}
+
+static void powerInit(void) { powerStart(11, 4.5); }
+static void powerLowInit(void) { powerStart(5, 4.5); }
+
+static void powerTick(void) {
+    double p = plant.vmotor * plant.current;
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, pwr.presses);
+    plant.loadTorque = plant.t < 5.0 ? 0 : plant.t < 8.0 ? pwr.load * (plant.t - 5.0) / 3.0 : 
+                       pwr.load;
+    if (plant.t < 5.0) return;
+    pwr.p += p;
+    pwr.i += plant.current;
+    if (++pwr.n == 10000) {
+        if (pwr.p / pwr.n > pwr.pMax) pwr.pMax = pwr.p / pwr.n;
+        if (pwr.i / pwr.n > pwr.iMax) pwr.iMax = pwr.i / pwr.n;
+        pwr.p = pwr.i = 0;
+        pwr.n = 0;
+    }
+    if (plant_rpm() < pwr.rpmMin) pwr.rpmMin = plant_rpm();
+    pwr.rpmEnd = plant_rpm();
+    if (p > 500 && ((long)(plant.t * 1e6) % 1000) == 0) {
+        // the firmware works from single samples - compare once a ms
+        double err = motorPower * 1000.0 / 14352 - p;
+        pwr.estSum += err;
+        pwr.estErr += err * err;
+        ++pwr.estN;
+    }
+}
+
+static int powerReport(void) {
+    printTiming();
+    printf("power limit         %s", POWER_LIMIT ? "" : "off\n");
+    if (POWER_LIMIT)
+        printf("%d W, %.1f A\n", POWER_LIMIT_W, (POWER_CONSTANT ? POWER_PEAK_A : POWER_RATED_A) / 10.0);
+    printf("load                0 to %.1f Nm from 5s to 8s\n", pwr.load);
+    printf("most power          %.0f W  (10ms mean)\n", pwr.pMax);
+    printf("most current        %.2f A\n", pwr.iMax);
+    printf("speed               lowest %.0f  at the end %.0f rpm\n", pwr.rpmMin, pwr.rpmEnd);
+    if (pwr.estN)
+        printf("motorPower error    mean %.0f  rms %.0f W over %ld ticks\n", pwr.estSum / pwr.estN,
+               sqrt(pwr.estErr / pwr.estN), pwr.estN);
+    printf("fault               %s\n", faultName[faultCode]);
+    if (!POWER_LIMIT) return 0;
+    return pwr.pMax > 1.05 * POWER_LIMIT_W ||
+           pwr.iMax > 1.05 * (POWER_CONSTANT ? POWER_PEAK_A : POWER_RATED_A) / 10.0;
+}
+
+/*
+ * pwm - what the PWM frequency costs and buys: 7 presses to 3100rpm, a 2Nm 
+ * cut from 4s to 8s, then 4 more presses to full speed under it.  Reports 
+ * the current ripple and the IGBT switching loss (see plant.c) under the 
+ * cut, how well the speed held and the most duty it took.  Build with 
+ * PWM_PR2, or with PWM_PR2_EE set pwmPr2 in the -e EEPROM, to change the
+ * frequency.  Fails 
+ * if the duty went over 56%, the speed was more than 1% out under the cut 
+ * or there was a fault.
+ */
+static struct {
+    double ripple, ripple2, j0, j1, rpmErr, rpmErrMax, dutyMost;
+    long n;
+} pwm;
+
+static void pwmTick(void) {
+    plant.userPower = 1;
+    if (plant.t < 8.0) press(&plant.speedUp, 0.5, 7);
+    else press(&plant.speedUp, 8.0, 4);
+    plant.loadTorque = plant.t >= 4.0 ? 2.0 : 0;
+    // the gate drive is off till the motor is started
+    if (sim_output(SIM_PORTA, 5) == 1 && sim_pwm_on() > pwm.dutyMost) pwm.dutyMost = sim_pwm_on();
+    if (plant.t < 5.0 || plant.t >= 8.0) return;
+    if (!pwm.n) pwm.j0 = plant.switchJ;
+    pwm.j1 = plant.switchJ;
+    double err = fabs(plant_rpm() - setpoint * 600.0 / 36 / 16);
+    pwm.rpmErr += err;
+    if (err > pwm.rpmErrMax) pwm.rpmErrMax = err;
+    pwm.ripple += plant.ripple;
+    pwm.ripple2 += plant.ripple * plant.ripple;
+    ++pwm.n;
+}
+
+static int pwmReport(void) {
+#if PWM_PR2_EE
+    unsigned pr2 = pwmPr2, ceiling = dutyMax, scale = dutyScale;
+#else
+    unsigned pr2 = PWM_PR2, ceiling = DUTY_CEILING, scale = DUTY_SCALE;
+#endif
+    double khz = SIM_TCY_HZ / 1000.0 / (pr2 + 1);
+    double sp = setpoint * 600.0 / 36 / 16;
+    printTiming();
+    printf("pwm frequency       %.2f kHz (PR2 0x%02X)%s\n", khz, pr2,
+           khz < 18 ? ", audible" : "");
+    printf("duty                %u counts, ceiling %u (%.1f%%), x%.3f on 19.6kHz\n",
+           4 * (pr2 + 1), ceiling, 100.0 * ceiling / (4 * (pr2 + 1)), scale / 64.0);
+    printf("under the cut       ripple %.2f A p-p, %.2f A rms  switching %.1f W\n",
+           pwm.ripple / pwm.n, sqrt(pwm.ripple2 / pwm.n / 12),
+           (pwm.j1 - pwm.j0) / 3.0);
+    printf("speed error         mean %.1f  max %.1f rpm at 3100rpm, 2Nm\n",
+           pwm.rpmErr / pwm.n, pwm.rpmErrMax);
+    printf("most duty           %.1f%%, %.0f rpm at the end (setpoint %.0f)\n",
+           100 * pwm.dutyMost, plant_rpm(), sp);
+    printf("fault               %s\n", faultName[faultCode]);
+    return pwm.dutyMost > 0.562 || pwm.rpmErr / pwm.n > 0.01 * 3100 || faultCode != FAULT_NONE;
+}
+
+/*
+ * tachout - the FR6 tach output (TACH_OUT builds).  8 presses to 3450rpm, 
+ * then 3 more to 4500rpm at 5.5s, and at each speed FR6's cycles are 
+ * counted for 2s against the revolutions the shaft really made.  Fails if 
+ * they are more than 1% apart, or on a fault.  The ISR cycles per tach 
+ * edge are the same as without it - on other builds FR6 has the 
+ * telemetry and only those are shown.
+ */
+typedef struct {
+    double from, to, revs, first, last, periodMin, periodMax;
+    unsigned cycles;
+} tachWin_t;
+
+static tachWin_t tachWin[2] = {{3.5, 5.5}, {9.5, 11.5}};
+static int fr6Level = 1;
+
+static void tachoutTick(void) {
+    plant.userPower = 1;
+    if (plant.t < 5.5) press(&plant.speedUp, 0.5, 8);
+    else press(&plant.speedUp, 5.5, 3);
+    int level = sim_output(SIM_PORTA, 1) == 1;
+    for (int i = 0; i < 2; i++) {
+        tachWin_t *w = &tachWin[i];
+        if (plant.t < w->from || plant.t >= w->to) continue;
+        w->revs += plant.omega * SIM_PLANT_CYCLES / SIM_TCY_HZ / (2 * M_PI);
+        // a cycle starts as the opto comes on
+        if (level || !fr6Level) continue;
+        if (w->cycles) {
+            double period = plant.t - w->last;
+            if (w->cycles == 1 || period < w->periodMin) w->periodMin = period;
+            if (period > w->periodMax) w->periodMax = period;
+        } else {
+            w->first = plant.t;
+        }
+        w->last = plant.t;
+        ++w->cycles;
+    }
+    fr6Level = level;
+}
+
+static int tachoutReport(void) {
+    int bad = faultCode != FAULT_NONE;
+    printTiming();
+    if (sim.isr_c1_count)
+        printf("ISR per tach edge   %.1f cycles\n",
+               (double)sim.isr_c1_cycles / sim.isr_c1_count);
+#if TACH_OUT
+    for (int i = 0; i < 2; i++) {
+        tachWin_t *w = &tachWin[i];
+        double rpm = w->revs * 60 / (w->to - w->from);
+        // whole cycles from the first start to the last
+        double hz = (w->cycles - 1) / (w->last - w->first);
+        double err = 100 * (hz * 60 / TACH_OUT_PPR - rpm) / rpm;
+        printf("%4.1f-%4.1fs          %.0f rpm, FR6 %.2f Hz = %.0f rpm (%+.2f%%), "
+               "period %.1f-%.1f ms\n", w->from, w->to, rpm, hz, hz * 60 / TACH_OUT_PPR, err,
+               1000 * w->periodMin, 1000 * w->periodMax);
+        bad |= w->cycles < 2 || fabs(err) > 1.0;
+    }
+    printf("tach output         %d cycles a revolution\n", TACH_OUT_PPR);
+#else
+    printf("tach output         off, FR6 has the telemetry\n");
+#endif
+    printf("fault               %s\n", faultName[faultCode]);
+    return bad;
+}
+
+/*
+ * eelog - the run log.  From 1s each step is pressed in turn up to 11 and
+ * back down to 4, 2.5s apart so each one holds long enough to be logged:
+ * 18 records, so the ring goes round.  Fails if the parameter block is not
+ * good or the newest record is not the setpoint.  With -e the EEPROM is
+ * kept for resume.
+ *
+ * resume - power on with nothing pressed.  With the EEPROM from eelog the
+ * motor must come back to the logged setpoint as soon as it is armed.
+ * resume-torn first cuts the newest record short, as if the power went
+ * while it was being written, so it must come back to the one before.
+ */
+static uint8_t crc8(const uint8_t *p, int n) {
+    uint8_t crc = 0;
+    while (n--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+// the newest good record in the ring, -1 if there are none
+static int newestRecord(log_t *rec) {
+    int newest = -1;
+    for (int i = 0; i < LOG_RECORDS; i++) {
+        const uint8_t *p = sim.ee + EE_LOG + i * sizeof(log_t);
+        log_t r;
+        memcpy(&r, p, sizeof r);
+        if (crc8(p, sizeof r)) continue;
+        if (newest >= 0 && (int8_t)(r.seq - rec->seq) <= 0) continue;
+        *rec = r;
+        newest = i;
+    }
+    return newest;
+}
+
+static double toRpm(uint16_t speed) {
+    return speed * 600.0 / 36 / 16;
+}
+
+static void eelogTick(void) {
+    plant.userPower = plant.t >= 0.5;
+    if (plant.t < 28.5) pressEvery(&plant.speedUp, 1.0, 11, 0.1, 2.5);
+    else pressEvery(&plant.speedDown, 28.5, 7, 0.1, 2.5);
+}
+
+// 1 if the firmware went to program memory for the data EEPROM
+static int eeFlash(void) {
+    if (!sim.ee_flash_reads && !sim.ee_flash_writes) return 0;
+    printf("program memory      %u reads, %u writes with EEPGD set\n", sim.ee_flash_reads,
+           sim.ee_flash_writes);
+    return 1;
+}
+
+static int eelogReport(void) {
+    log_t rec;
+    int slot = newestRecord(&rec), good = 0, bad;
+    uint32_t writes = 0, most = 0;
+    for (int i = 0; i < 256; i++) {
+        writes += sim.ee_writes[i];
+        if (sim.ee_writes[i] > most) most = sim.ee_writes[i];
+    }
+    for (int i = 0; i < LOG_RECORDS; i++)
+        good += !crc8(sim.ee + EE_LOG + i * sizeof(log_t), sizeof(log_t));
+    bad = crc8(sim.ee + EE_PARAMS, sizeof(params_t)) || sim.ee[EE_PARAMS] != PARAM_VERSION ||
+          slot < 0 || rec.setpoint != setpoint;
+    printTiming();
+    printTasks();
+    printf("parameters          version %u, CRC %s\n", sim.ee[EE_PARAMS],
+           crc8(sim.ee + EE_PARAMS, sizeof(params_t)) ? "bad" : "good");
+    printf("run log             %d good records of %d\n", good, LOG_RECORDS);
+    if (slot >= 0)
+        printf("newest              slot %d seq %u  %.0f rpm (setpoint %.0f)  run %.1f h\n",
+               slot, rec.seq, toRpm(rec.setpoint), toRpm(setpoint), rec.runTenths / 10.0);
+    printf("eeprom writes       %u bytes, at most %u to one byte\n", writes, most);
+    return eeFlash() | bad;
+}
+
+static log_t resumeWant;
+static int resumeSlot;
+
+static void resumeInit(void) {
+    warmCaps();
+    resumeSlot = newestRecord(&resumeWant);
+}
+
+// the last byte of the newest record never got written
+static void resumeTornInit(void) {
+    warmCaps();
+    if (newestRecord(&resumeWant) >= 0)
+        sim.ee[EE_LOG + newestRecord(&resumeWant) * sizeof(log_t) + sizeof(log_t) - 1] ^= 0xFF;
+    resumeSlot = newestRecord(&resumeWant);
+}
+
+static double resumeT = -1;
+
+static void resumeTick(void) {
+    plant.userPower = plant.t >= 0.5;
+    if (resumeT < 0 && resumeWant.setpoint &&
+        fabs(plant_rpm() - toRpm(resumeWant.setpoint)) < 0.02 * toRpm(resumeWant.setpoint))
+        resumeT = plant.t;
+}
+
+static int resumeReport(void) {
+    printTiming();
+    printStates();
+    if (eeFlash()) return 1;
+    if (resumeSlot < 0) {
+        printf("run log             empty - run eelog with -e first\n");
+        return setpoint != 0;
+    }
+    printf("logged              slot %d seq %u  %.0f rpm\n", resumeSlot, resumeWant.seq,
+           toRpm(resumeWant.setpoint));
+    printf("setpoint            %.0f rpm, %s mode\n", toRpm(setpoint),
+           speedMode == SPEED_MODE_FINE ? "fine" : "preset");
+    if (resumeT >= 0)
+        printf("within 2%%           at %.3f s, %.3f s after the relay closed\n", resumeT,
+               resumeT - plant.relayTime);
+    else if (resumeWant.setpoint)
+        printf("within 2%%           never\n");
+    return setpoint != resumeWant.setpoint || (resumeWant.setpoint && resumeT < 0);
+}
+
+/*
+ * bench-* - the benchmarks.  Each runs a fixed case and reports the figures 
+ * that show the control path getting slower, all of them lower is better.  
+ * With a file they go there as JSON as well, each with how much worse than 
+ * its baseline it may get, for benchcmp and bench-baseline.json (make 
+ * bench).  The run is repeatable, but a change that moves the ISR or the 
+ * tasks a few cycles moves the control results a little too, so those 
+ * have more room than the cycle counts.
+ *
+ * bench-precharge  cold caps to the relay closing
+ * bench-speed      0 to 4500rpm on 11 presses: the first press to CCPR1L, 
+ *                  peak current and settling
+ * bench-load       2Nm step at 3450rpm: droop and recovery
+ * bench-storm      at 4500rpm, down and up pressed in turn every 50ms with 
+ *                  5ms of bounce for 3s - the main loop and ISR under the 
+ *                  most tach edges and button events, and press to CCPR1L
+ *
+ * Every one reports the main loop period, the ISR cost, the main code's 
+ * time waiting on the ADC and task overruns from when its measurement 
+ * starts, and the ISR cycles per tach edge and press to CCPR1L where there 
+ * are any.  Press to CCPR1L is from the clean operator press to the first 
+ * change of the duty in that direction.
+ */
+static struct {
+    double t0;
+    uint64_t cycle0, isrCount0, isrCycles0, c1Count0, c1Cycles0, adcWait0;
+    uint8_t overruns0[TASKS];
+    int level, dir, onlyFirst;
+    double since;               // when the press being timed was, -1 for none
+    unsigned duty;              // the duty it has to move from
+    double pressSum, pressMax;
+    int presses, missed;
+} bench = {.since = -1};
+
+static FILE *benchJson;
+
+static unsigned regDuty(void) {
+    return sim.reg[0x015] << 2 | (sim.reg[0x017] >> 4 & 3);  // CCPR1L:DC1B
+}
+
+// the measurement starts now
+static void benchStart(void) {
+    bench.t0 = plant.t;
+    bench.cycle0 = sim.cycle;
+    bench.isrCount0 = sim.isr_count;
+    bench.isrCycles0 = sim.isr_cycles;
+    bench.c1Count0 = sim.isr_c1_count;
+    bench.c1Cycles0 = sim.isr_c1_cycles;
+    bench.adcWait0 = sim.adc_wait_cycles;
+    memcpy(bench.overruns0, taskOverruns, sizeof bench.overruns0);
+    sim.mark[0].count = sim.mark[SIM_MARK_TICK].count = 0;
+    sim.mark[0].min = sim.mark[SIM_MARK_TICK].min = UINT64_MAX;
+    sim.mark[0].max = sim.mark[SIM_MARK_TICK].max = 0;
+    sim.mark[0].sum = sim.mark[SIM_MARK_TICK].sum = 0;
+    sim.c1_latency_max = 0;
+}
+
+// every plant step - time the presses to the duty moving
+static void benchPress(void) {
+    int level = plant.speedUp ? 1 : plant.speedDown ? -1 : 0;
+    unsigned duty = regDuty();
+    if (level && level != bench.level && !(bench.onlyFirst && bench.presses)) {
+        if (bench.since >= 0) ++bench.missed;
+        bench.since = plant.t;
+        bench.dir = level;
+        bench.duty = duty;
+    }
+    bench.level = level;
+    if (bench.since < 0) return;
+    if ((bench.dir > 0 && duty > bench.duty) || (bench.dir < 0 && duty < bench.duty)) {
+        double ms = 1000 * (plant.t - bench.since);
+        bench.pressSum += ms;
+        if (ms > bench.pressMax) bench.pressMax = ms;
+        ++bench.presses;
+        bench.since = -1;
+    } else if (duty != bench.duty) {
+        bench.duty = duty;  // still ramping the other way from the last press
+    }
+}
+
+static void benchMetric(const char *name, double value, const char *unit, double tol) {
+    static int n;
+    printf("%-24s %10.3f %s\n", name, value, unit);
+    if (!benchJson) return;
+    fprintf(benchJson, "%s\n    \"%s\": {\"value\": %.6g, \"unit\": \"%s\", \"tol\": %g}",
+            n++ ? "," : "", name, value, unit, tol);
+}
+
+// the figures every benchmark has, 1 if the JSON could not be written
+static int benchCommon(const char *name) {
+    sim_mark_t *loop = &sim.mark[0], *tick = &sim.mark[SIM_MARK_TICK];
+    double secs = (sim.cycle - bench.cycle0) / (double)SIM_TCY_HZ;
+    unsigned overruns = 0;
+    for (unsigned i = 0; i < TASKS; i++) overruns += (uint8_t)(taskOverruns[i] - bench.overruns0[i]);
+    if (outFile && !(benchJson = fopen(outFile, "w"))) {
+        perror(outFile);
+        return 1;
+    }
+    if (benchJson) fprintf(benchJson, "{\n  \"%s\": {", name);
+    printf("%-24s %10.3f s\n", "measured over", secs);
+    benchMetric("main_loop_avg_us", us(loop->sum) / (loop->count - 1), "us", 0.02);
+    benchMetric("main_loop_max_us", us(loop->max), "us", 0.05);
+    benchMetric("tick_max_us", us(tick->max), "us", 0.05);
+    benchMetric("isr_cpu_pct", 100.0 * (sim.isr_cycles - bench.isrCycles0) / (sim.cycle - bench.cycle0),
+                "%", 0.02);
+    benchMetric("isr_avg_cycles", (double)(sim.isr_cycles - bench.isrCycles0) /
+                (sim.isr_count - bench.isrCount0), "cycles", 0.02);
+    benchMetric("isr_max_cycles", sim.isr_max, "cycles", 0.05);
+    benchMetric("adc_wait_us", us(sim.adc_wait_cycles - bench.adcWait0) / secs, "us/s", 0);
+    benchMetric("task_overruns", overruns, "", 0);
+    if (sim.isr_c1_count > bench.c1Count0) {
+        benchMetric("isr_cycles_per_tach", (double)(sim.isr_c1_cycles - bench.c1Cycles0) /
+                    (sim.isr_c1_count - bench.c1Count0), "cycles", 0.02);
+        benchMetric("tach_latency_max_cycles", sim.c1_latency_max, "cycles", 0.05);
+    }
+    if (bench.presses) {
+        benchMetric("press_to_duty_avg_ms", bench.pressSum / bench.presses, "ms", 0.1);
+        benchMetric("press_to_duty_max_ms", bench.pressMax, "ms", 0.1);
+    }
+    return 0;
+}
+
+// the JSON closed, and the scenario's result
+static int benchEnd(int bad) {
+    if (bench.missed) printf("presses missed      %d\n", bench.missed);
+    printf("fault               %s\n", faultName[faultCode]);
+    if (benchJson && (fprintf(benchJson, "\n  }\n}\n") < 0 || fclose(benchJson))) {
+        perror(outFile);
+        return 1;
+    }
+    return bad || bench.missed || faultCode != FAULT_NONE;
+}
+
+static void benchPrechargeTick(void) {
+    plant.userPower = plant.t >= 0.5;
+    if (plant.t >= 0.5 && bench.t0 == 0) benchStart();
+}
+
+static int benchPrechargeReport(void) {
+    if (benchCommon("bench-precharge")) return 1;
+    benchMetric("relay_close_s", plant.relayTime - 0.5, "s", 0.02);
+    return benchEnd(plant.relayTime < 0);
+}
+
+static struct {
+    double lastOut, peak, rpmBefore, rpmMin, tMin, tBack;
+} bm;
+
+static void benchSpeedTick(void) {
+    double sp = setpoint * 600.0 / 36 / 16;
+    plant.userPower = 1;
+    bench.onlyFirst = 1;
+    press(&plant.speedUp, 1.0, 11);
+    if (plant.t >= 1.0 && bench.t0 == 0) benchStart();
+    benchPress();
+    if (plant.current > bm.peak) bm.peak = plant.current;
+    if (desiredSpeedCtr < 11 || fabs(plant_rpm() - sp) > 0.01 * sp) bm.lastOut = plant.t;
+}
+
+static int benchSpeedReport(void) {
+    if (benchCommon("bench-speed")) return 1;
+    benchMetric("settle_s", bm.lastOut - 1.0, "s", 0.1);
+    benchMetric("peak_current_a", bm.peak, "A", 0.05);
+    return benchEnd(bm.lastOut > 7.5);
+}
+
+static void benchLoadTick(void) {
+    double sp = setpoint * 600.0 / 36 / 16;
+    plant.userPower = 1;
+    press(&plant.speedUp, 0.5, 8);
+    plant.loadTorque = plant.t >= 5.0 ? 2.0 : 0;
+    if (plant.t < 5.0) {
+        bm.rpmBefore = plant_rpm();
+        bm.rpmMin = 1e9;
+        return;
+    }
+    if (bench.t0 == 0) benchStart();
+    if (plant_rpm() < bm.rpmMin) {
+        bm.rpmMin = plant_rpm();
+        bm.tMin = plant.t;
+        bm.tBack = -1;
+    }
+    if (bm.tBack < 0 && fabs(plant_rpm() - sp) < 0.01 * sp) bm.tBack = plant.t;
+}
+
+static int benchLoadReport(void) {
+    if (benchCommon("bench-load")) return 1;
+    benchMetric("droop_pct", 100 * (bm.rpmBefore - bm.rpmMin) / bm.rpmBefore, "%", 0.1);
+    benchMetric("recovery_ms", bm.tBack >= 0 ? 1000 * (bm.tBack - bm.tMin) : 1e6, "ms", 0.25);
+    return benchEnd(bm.tBack < 0);
+}
+
+static void benchStormInit(void) {
+    warmCaps();
+    plant.bounce = 0.005;
+}
+
+static void benchStormTick(void) {
+    plant.userPower = 1;
+    if (plant.t < 6.0) {
+        press(&plant.speedUp, 0.5, 11);
+        return;
+    }
+    if (bench.t0 == 0) benchStart();
+    pressEvery(&plant.speedDown, 6.0, 30, 0.025, 0.1);
+    pressEvery(&plant.speedUp, 6.05, 30, 0.025, 0.1);
+    benchPress();
+}
+
+static int benchStormReport(void) {
+    if (benchCommon("bench-storm")) return 1;
+    return benchEnd(bench.presses < 60);
+}
+
+/*
+ * replay - the trace in file instead of the plant, see trace.h.  Fails if
+ * CCPR1L, DC1B, TotemControl or PowerPermissive differ at any step from
+ * the expected trace, the same one if there is no other
+ */
+static void replayInit(void) {
+    if (!outFile) {
+        fprintf(stderr, "replay: which trace?\n");
+        exit(2);
+    }
+    if (trace_replay_open(outFile, expectFile)) exit(2);
+    sim.plant = trace_replay_step;
+    sim.probe = trace_probe;
+    sim.adc_sample = trace_adc;
+}
+
+static int replayReport(void) {
+    return trace_replay_report();
+}
+
+static const scenario_t scenarios[] = {
+    {"startup", "precharge, 5x speed up, run", 52.0, NULL, startupTick, startupReport},
+    {"load", "3450rpm with a 2Nm cut from 6s to 10s", 12.0, warmCaps, loadTick, loadReport},
+    {"speedmeas", "speed measurement error at 500..4500rpm", MEAS_STEPS * MEAS_HOLD,
+     warmCaps, measTick, measReport},
+    {"adc", "background ADC sequencer rates and readings", 3.0, warmCaps, adcTick, adcReport},
+    {"buttons", "debounce with 5ms contact bounce", 4.0, buttonsInit, buttonsTick, buttonsReport},
+    {"ramp", "0 to 4500rpm, peak current and time to speed", 4.0, warmCaps, rampTick, rampReport},
+    {"fine", "fine speed mode, auto repeat", 10.0, warmCaps, fineTick, fineReport},
+    {"overcurrent", "jammed spindle, trip latency (OC_TRIP builds)", 6.0, ocInit, ocTick, ocReport},
+    {"precharge", "caps charging, time to close the relay and the inrush", 70.0,
+     prechargeInit, prechargeTick, prechargeReport},
+    {"precharge-lo", "the same on 90% mains", 70.0, prechargeLoInit, prechargeTick,
+     prechargeReport},
+    {"precharge-hi", "the same on 110% mains", 70.0, prechargeHiInit, prechargeTick,
+     prechargeReport},
+    {"precharge-open", "R55 open, charge fault", 15.0, prechargeOpenInit, prechargeTick,
+     prechargeReport},
+    {"precharge-leaky", "47k across the caps, charge fault", 30.0, prechargeLeakyInit,
+     prechargeTick, prechargeReport},
+    {"telemetry", "FR6 telemetry capture at 10kHz for fr6decode", 6.0, telemetryInit,
+     telemetryTick, telemetryReport},
+    {"rearm", "clean stop with power held, then power let go and re-armed", 9.0, warmCaps,
+     rearmTick, rearmReport},
+    {"fault-uv", "mains drops at 4s, undervoltage fault", 5.0, uvInit, faultTick, faultReport},
+    {"fault-jam", "40Nm jam at 4s, overcurrent or stall fault", 5.0, jamInit, faultTick, faultReport},
+    {"fault-overspeed", "driven to 5400rpm at 4s, overspeed fault", 5.0, overspeedInit,
+     faultTick, faultReport},
+    {"fault-tach", "tach lost at 4s, tach loss fault", 5.0, tachInit, faultTick, faultReport},
+    {"snapshot", "gated count windows and hand over with interrupts injected in the reader",
+     4.0, snapInit, snapTick, snapReport},
+    {"isr", "interrupt cost and latency with the tach at 4500rpm (ISR_PROFILE builds)", 2.0,
+     warmCaps, isrTick, isrReport},
+    {"cut", "3450rpm under the -l load profile (step, interrupted, stall or a file)", 12.0,
+     cutInit, cutTick, cutReport},
+    {"power", "load to 4.5Nm at 4500rpm, power and current held (POWER_LIMIT builds)", 13.0,
+     powerInit, powerTick, powerReport},
+    {"power-low", "load to 4.5Nm at 2400rpm, the same", 13.0, powerLowInit, powerTick, powerReport},
+    {"adcfilter", "IV error through oversampling and the IIR with ripple and noise", 8.0,
+     adcFilterInit, adcFilterTick, adcFilterReport},
+    {"pwm", "ripple, switching loss and speed under a cut at the PWM frequency", 12.0,
+     warmCaps, pwmTick, pwmReport},
+    {"tachout", "FR6 tach output against the shaft at 3450 and 4500rpm (TACH_OUT builds)",
+     11.5, warmCaps, tachoutTick, tachoutReport},
+    {"bench-precharge", "benchmark: cold caps to the relay closing", 46.0, NULL,
+     benchPrechargeTick, benchPrechargeReport},
+    {"bench-speed", "benchmark: 0 to 4500rpm, press to CCPR1L and settling", 8.0, warmCaps,
+     benchSpeedTick, benchSpeedReport},
+    {"bench-load", "benchmark: 2Nm step at 3450rpm, droop and recovery", 9.0, warmCaps,
+     benchLoadTick, benchLoadReport},
+    {"bench-storm", "benchmark: presses every 50ms at 4500rpm with bounce", 9.0, benchStormInit,
+     benchStormTick, benchStormReport},
+    {"replay", "feed the firmware a -r trace and compare its outputs (give the trace)",
+     1e6, replayInit, NULL, replayReport},
+    {"eelog", "each speed step in turn, logged round the data EEPROM ring (use -e)", 48.5,
+     warmCaps, eelogTick, eelogReport},
+    {"resume", "power on with the -e EEPROM, back to the logged speed once armed", 5.0,
+     resumeInit, resumeTick, resumeReport},
+    {"resume-torn", "the same with the newest record cut short", 5.0, resumeTornInit,
+     resumeTick, resumeReport},
+};
+
+#define NSCENARIOS (sizeof scenarios / sizeof scenarios[0])
+
+// one line of the -s time series
+static void seriesLine(void) {
+    fprintf(series, "%.3f,%.1f,%.1f,%.1f,%u,%.2f,%.2f,%.1f,%.1f,%s,%s\n", plant.t,
+            plant_rpm(), measuredSpeed * 600.0 / 36 / 16, setpoint * 600.0 / 36 / 16,
+            sim.pwm_duty, plant.loadTorque, plant.current, plant.vbus, plant.vmotor,
+            stateName[powerState], faultName[faultCode]);
+}
+
+static void world(void) {
+    plant_step();
+    scenario->tick();
+    if (series && ++seriesDiv == 1000) {
+        seriesDiv = 0;
+        seriesLine();
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *profile = NULL, *seriesFile = NULL, *eeFile = NULL, *traceFile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:s:e:r:")) != -1) {
+        if (opt == 'l') profile = optarg;
+        else if (opt == 's') seriesFile = optarg;
+        else if (opt == 'e') eeFile = optarg;
+        else if (opt == 'r') traceFile = optarg;
+        else {
+            fprintf(stderr, "usage: pf906sim [-l profile] [-s series.csv] [-e eeprom.bin] "
+                            "[-r trace] [scenario] [file]\n");
+            return 2;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    const char *name = argc > 1 ? argv[1] : "startup";
+    outFile = argc > 2 ? argv[2] : NULL;
+    expectFile = argc > 3 ? argv[3] : outFile;
+    for (unsigned i = 0; i < NSCENARIOS; i++) {
+        if (!strcmp(name, "list")) {
+            printf("%-12s %s\n", scenarios[i].name, scenarios[i].help);
+            continue;
+        }
+        if (!strcmp(name, scenarios[i].name)) scenario = &scenarios[i];
+    }
+    if (!strcmp(name, "list")) return 0;
+    if (!scenario) {
+        fprintf(stderr, "unknown scenario '%s' - try 'list'\n", name);
+        return 2;
+    }
+
+    sim_reset();
+    plant_init();
+    if (profile && plant_profile(profile)) return 2;
+    if (eeFile) {
+        FILE *f = fopen(eeFile, "rb");
+        if (f) {
+            if (fread(sim.ee, 1, sizeof sim.ee, f) != sizeof sim.ee) {
+                fprintf(stderr, "%s: want %u bytes\n", eeFile, (unsigned)sizeof sim.ee);
+                return 2;
+            }
+            fclose(f);
+        }
+    }
+    if (seriesFile) {
+        if (!(series = fopen(seriesFile, "w"))) {
+            perror(seriesFile);
+            return 2;
+        }
+        fprintf(series, "t_s,rpm,meas_rpm,set_rpm,duty,load_nm,current_a,vbus_v,vmotor_v,"
+                        "state,fault\n");
+    }
+    sim.isr = Isr;
+    sim.plant = world;
+    if (scenario->init) scenario->init();
+    if (traceFile) {
+        char what[40];
+        snprintf(what, sizeof what, "the %s scenario", scenario->name);
+        if (trace_record_open(traceFile, what)) return 2;
+        sim.probe = trace_probe;
+        sim.adc_sample = trace_adc;
+    }
+    if (sim_run(pf906_main, scenario->seconds))
+        printf("main() returned at %.3f s\n", sim_time());
+    if (traceFile && trace_record_close()) return 2;
+    if (series) fclose(series);
+    int rc = scenario->report();
+    if (eeFile) {
+        FILE *f = fopen(eeFile, "wb");
+        if (!f || fwrite(sim.ee, 1, sizeof sim.ee, f) != sizeof sim.ee) {
+            perror(eeFile);
+            return 2;
+        }
+        fclose(f);
+    }
+    return rc;
+}
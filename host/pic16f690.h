@@ -0,0 +1,871 @@
+/*
+ * File:   pic16f690.h  (host build)
+ *
+ * Stand-in for the XC8 DFP proc/pic16f690.h so PF906_base_code_v4b.c can be 
+ * compiled with gcc.  The register and bitfield names are the same as the 
+ * Microchip header (taken from the XC8 2.36 / PIC16Fxxx_DFP 1.2.33 register 
+ * map) but every SFR lives in the simulator's register file.  Each access 
+ * goes through sim_sfr() which advances the virtual clock and lets the 
+ * simulated peripherals react, so busy-waits such as 
+ * while (ADCON0bits.GO_nDONE) {}; terminate just like they do on the chip.
+ *
+ * Bitfields use unsigned char so that every union is exactly 1 byte wide.
+ * The register macros come after all the bitfield types because several 
+ * field names (ECCPAS, WPUB, ...) are also register names.
+ */
+
+#ifndef PIC16F690_HOST_H
+#define PIC16F690_HOST_H
+
+#include "sim.h"
+
+typedef union {
+    struct {
+        unsigned char C :1;
+        unsigned char DC :1;
+        unsigned char Z :1;
+        unsigned char nPD :1;
+        unsigned char nTO :1;
+        unsigned char RP :2;
+        unsigned char IRP :1;
+    };
+    struct {
+        unsigned char :5;
+        unsigned char RP0 :1;
+        unsigned char RP1 :1;
+    };
+    struct {
+        unsigned char CARRY :1;
+        unsigned char :1;
+        unsigned char ZERO :1;
+    };
+} STATUSbits_t;
+
+typedef union {
+    struct {
+        unsigned char RA0 :1;
+        unsigned char RA1 :1;
+        unsigned char RA2 :1;
+        unsigned char RA3 :1;
+        unsigned char RA4 :1;
+        unsigned char RA5 :1;
+    };
+} PORTAbits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char RB4 :1;
+        unsigned char RB5 :1;
+        unsigned char RB6 :1;
+        unsigned char RB7 :1;
+    };
+} PORTBbits_t;
+
+typedef union {
+    struct {
+        unsigned char RC0 :1;
+        unsigned char RC1 :1;
+        unsigned char RC2 :1;
+        unsigned char RC3 :1;
+        unsigned char RC4 :1;
+        unsigned char RC5 :1;
+        unsigned char RC6 :1;
+        unsigned char RC7 :1;
+    };
+} PORTCbits_t;
+
+typedef union {
+    struct {
+        unsigned char RABIF :1;
+        unsigned char INTF :1;
+        unsigned char T0IF :1;
+        unsigned char RABIE :1;
+        unsigned char INTE :1;
+        unsigned char T0IE :1;
+        unsigned char PEIE :1;
+        unsigned char GIE :1;
+    };
+} INTCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char TMR1IF :1;
+        unsigned char TMR2IF :1;
+        unsigned char CCP1IF :1;
+        unsigned char SSPIF :1;
+        unsigned char TXIF :1;
+        unsigned char RCIF :1;
+        unsigned char ADIF :1;
+    };
+    struct {
+        unsigned char T1IF :1;
+        unsigned char T2IF :1;
+    };
+} PIR1bits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char EEIF :1;
+        unsigned char C1IF :1;
+        unsigned char C2IF :1;
+        unsigned char OSFIF :1;
+    };
+} PIR2bits_t;
+
+typedef union {
+    struct {
+        unsigned char TMR1ON :1;
+        unsigned char TMR1CS :1;
+        unsigned char nT1SYNC :1;
+        unsigned char T1OSCEN :1;
+        unsigned char T1CKPS :2;
+        unsigned char TMR1GE :1;
+        unsigned char T1GINV :1;
+    };
+    struct {
+        unsigned char :4;
+        unsigned char T1CKPS0 :1;
+        unsigned char T1CKPS1 :1;
+    };
+} T1CONbits_t;
+
+typedef union {
+    struct {
+        unsigned char T2CKPS :2;
+        unsigned char TMR2ON :1;
+        unsigned char TOUTPS :4;
+    };
+    struct {
+        unsigned char T2CKPS0 :1;
+        unsigned char T2CKPS1 :1;
+        unsigned char :1;
+        unsigned char TOUTPS0 :1;
+        unsigned char TOUTPS1 :1;
+        unsigned char TOUTPS2 :1;
+        unsigned char TOUTPS3 :1;
+    };
+} T2CONbits_t;
+
+typedef union {
+    struct {
+        unsigned char SSPM :4;
+        unsigned char CKP :1;
+        unsigned char SSPEN :1;
+        unsigned char SSPOV :1;
+        unsigned char WCOL :1;
+    };
+    struct {
+        unsigned char SSPM0 :1;
+        unsigned char SSPM1 :1;
+        unsigned char SSPM2 :1;
+        unsigned char SSPM3 :1;
+    };
+} SSPCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char CCP1M :4;
+        unsigned char DC1B :2;
+        unsigned char P1M :2;
+    };
+    struct {
+        unsigned char CCP1M0 :1;
+        unsigned char CCP1M1 :1;
+        unsigned char CCP1M2 :1;
+        unsigned char CCP1M3 :1;
+        unsigned char DC1B0 :1;
+        unsigned char DC1B1 :1;
+        unsigned char P1M0 :1;
+        unsigned char P1M1 :1;
+    };
+} CCP1CONbits_t;
+
+typedef union {
+    struct {
+        unsigned char RX9D :1;
+        unsigned char OERR :1;
+        unsigned char FERR :1;
+        unsigned char ADDEN :1;
+        unsigned char CREN :1;
+        unsigned char SREN :1;
+        unsigned char RX9 :1;
+        unsigned char SPEN :1;
+    };
+} RCSTAbits_t;
+
+typedef union {
+    struct {
+        unsigned char PDC :7;
+        unsigned char PRSEN :1;
+    };
+    struct {
+        unsigned char PDC0 :1;
+        unsigned char PDC1 :1;
+        unsigned char PDC2 :1;
+        unsigned char PDC3 :1;
+        unsigned char PDC4 :1;
+        unsigned char PDC5 :1;
+        unsigned char PDC6 :1;
+    };
+} PWM1CONbits_t;
+
+typedef union {
+    struct {
+        unsigned char PSSBD :2;
+        unsigned char PSSAC :2;
+        unsigned char ECCPAS :3;
+        unsigned char ECCPASE :1;
+    };
+    struct {
+        unsigned char PSSBD0 :1;
+        unsigned char PSSBD1 :1;
+        unsigned char PSSAC0 :1;
+        unsigned char PSSAC1 :1;
+        unsigned char ECCPAS0 :1;
+        unsigned char ECCPAS1 :1;
+        unsigned char ECCPAS2 :1;
+    };
+} ECCPASbits_t;
+
+typedef union {
+    struct {
+        unsigned char ADON :1;
+        unsigned char GO_nDONE :1;
+        unsigned char CHS :4;
+        unsigned char VCFG :1;
+        unsigned char ADFM :1;
+    };
+    struct {
+        unsigned char :1;
+        unsigned char GO :1;
+        unsigned char CHS0 :1;
+        unsigned char CHS1 :1;
+        unsigned char CHS2 :1;
+        unsigned char CHS3 :1;
+    };
+    struct {
+        unsigned char :1;
+        unsigned char nDONE :1;
+    };
+    struct {
+        unsigned char :1;
+        unsigned char GO_DONE :1;
+    };
+} ADCON0bits_t;
+
+typedef union {
+    struct {
+        unsigned char PS :3;
+        unsigned char PSA :1;
+        unsigned char T0SE :1;
+        unsigned char T0CS :1;
+        unsigned char INTEDG :1;
+        unsigned char nRABPU :1;
+    };
+    struct {
+        unsigned char PS0 :1;
+        unsigned char PS1 :1;
+        unsigned char PS2 :1;
+    };
+} OPTION_REGbits_t;
+
+typedef union {
+    struct {
+        unsigned char TRISA0 :1;
+        unsigned char TRISA1 :1;
+        unsigned char TRISA2 :1;
+        unsigned char TRISA3 :1;
+        unsigned char TRISA4 :1;
+        unsigned char TRISA5 :1;
+    };
+} TRISAbits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char TRISB4 :1;
+        unsigned char TRISB5 :1;
+        unsigned char TRISB6 :1;
+        unsigned char TRISB7 :1;
+    };
+} TRISBbits_t;
+
+typedef union {
+    struct {
+        unsigned char TRISC0 :1;
+        unsigned char TRISC1 :1;
+        unsigned char TRISC2 :1;
+        unsigned char TRISC3 :1;
+        unsigned char TRISC4 :1;
+        unsigned char TRISC5 :1;
+        unsigned char TRISC6 :1;
+        unsigned char TRISC7 :1;
+    };
+} TRISCbits_t;
+
+typedef union {
+    struct {
+        unsigned char TMR1IE :1;
+        unsigned char TMR2IE :1;
+        unsigned char CCP1IE :1;
+        unsigned char SSPIE :1;
+        unsigned char TXIE :1;
+        unsigned char RCIE :1;
+        unsigned char ADIE :1;
+    };
+    struct {
+        unsigned char T1IE :1;
+        unsigned char T2IE :1;
+    };
+} PIE1bits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char EEIE :1;
+        unsigned char C1IE :1;
+        unsigned char C2IE :1;
+        unsigned char OSFIE :1;
+    };
+} PIE2bits_t;
+
+typedef union {
+    struct {
+        unsigned char nBOR :1;
+        unsigned char nPOR :1;
+        unsigned char :2;
+        unsigned char SBOREN :1;
+        unsigned char ULPWUE :1;
+    };
+} PCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char SCS :1;
+        unsigned char LTS :1;
+        unsigned char HTS :1;
+        unsigned char OSTS :1;
+        unsigned char IRCF :3;
+    };
+    struct {
+        unsigned char :4;
+        unsigned char IRCF0 :1;
+        unsigned char IRCF1 :1;
+        unsigned char IRCF2 :1;
+    };
+} OSCCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char TUN :5;
+    };
+    struct {
+        unsigned char TUN0 :1;
+        unsigned char TUN1 :1;
+        unsigned char TUN2 :1;
+        unsigned char TUN3 :1;
+        unsigned char TUN4 :1;
+    };
+} OSCTUNEbits_t;
+
+typedef union {
+    struct {
+        unsigned char MSK0 :1;
+        unsigned char MSK1 :1;
+        unsigned char MSK2 :1;
+        unsigned char MSK3 :1;
+        unsigned char MSK4 :1;
+        unsigned char MSK5 :1;
+        unsigned char MSK6 :1;
+        unsigned char MSK7 :1;
+    };
+} SSPMSKbits_t;
+
+typedef union {
+    struct {
+        unsigned char MSK0 :1;
+        unsigned char MSK1 :1;
+        unsigned char MSK2 :1;
+        unsigned char MSK3 :1;
+        unsigned char MSK4 :1;
+        unsigned char MSK5 :1;
+        unsigned char MSK6 :1;
+        unsigned char MSK7 :1;
+    };
+} MSKbits_t;
+
+typedef union {
+    struct {
+        unsigned char BF :1;
+        unsigned char UA :1;
+        unsigned char R_nW :1;
+        unsigned char S :1;
+        unsigned char P :1;
+        unsigned char D_nA :1;
+        unsigned char CKE :1;
+        unsigned char SMP :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char R :1;
+        unsigned char :2;
+        unsigned char D :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char I2C_READ :1;
+        unsigned char I2C_START :1;
+        unsigned char I2C_STOP :1;
+        unsigned char I2C_DATA :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char nW :1;
+        unsigned char :2;
+        unsigned char nA :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char nWRITE :1;
+        unsigned char :2;
+        unsigned char nADDRESS :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char R_W :1;
+        unsigned char :2;
+        unsigned char D_A :1;
+    };
+    struct {
+        unsigned char :2;
+        unsigned char READ_WRITE :1;
+        unsigned char :2;
+        unsigned char DATA_ADDRESS :1;
+    };
+} SSPSTATbits_t;
+
+typedef union {
+    struct {
+        unsigned char WPUA0 :1;
+        unsigned char WPUA1 :1;
+        unsigned char WPUA2 :1;
+        unsigned char :1;
+        unsigned char WPUA4 :1;
+        unsigned char WPUA5 :1;
+    };
+    struct {
+        unsigned char WPU0 :1;
+        unsigned char WPU1 :1;
+        unsigned char WPU2 :1;
+        unsigned char :1;
+        unsigned char WPU4 :1;
+        unsigned char WPU5 :1;
+    };
+} WPUAbits_t;
+
+typedef union {
+    struct {
+        unsigned char WPUA0 :1;
+        unsigned char WPUA1 :1;
+        unsigned char WPUA2 :1;
+        unsigned char :1;
+        unsigned char WPUA4 :1;
+        unsigned char WPUA5 :1;
+    };
+    struct {
+        unsigned char WPU0 :1;
+        unsigned char WPU1 :1;
+        unsigned char WPU2 :1;
+        unsigned char :1;
+        unsigned char WPU4 :1;
+        unsigned char WPU5 :1;
+    };
+} WPUbits_t;
+
+typedef union {
+    struct {
+        unsigned char IOCA0 :1;
+        unsigned char IOCA1 :1;
+        unsigned char IOCA2 :1;
+        unsigned char IOCA3 :1;
+        unsigned char IOCA4 :1;
+        unsigned char IOCA5 :1;
+    };
+    struct {
+        unsigned char IOC0 :1;
+        unsigned char IOC1 :1;
+        unsigned char IOC2 :1;
+        unsigned char IOC3 :1;
+        unsigned char IOC4 :1;
+        unsigned char IOC5 :1;
+    };
+} IOCAbits_t;
+
+typedef union {
+    struct {
+        unsigned char IOCA0 :1;
+        unsigned char IOCA1 :1;
+        unsigned char IOCA2 :1;
+        unsigned char IOCA3 :1;
+        unsigned char IOCA4 :1;
+        unsigned char IOCA5 :1;
+    };
+    struct {
+        unsigned char IOC0 :1;
+        unsigned char IOC1 :1;
+        unsigned char IOC2 :1;
+        unsigned char IOC3 :1;
+        unsigned char IOC4 :1;
+        unsigned char IOC5 :1;
+    };
+} IOCbits_t;
+
+typedef union {
+    struct {
+        unsigned char SWDTEN :1;
+        unsigned char WDTPS :4;
+    };
+    struct {
+        unsigned char :1;
+        unsigned char WDTPS0 :1;
+        unsigned char WDTPS1 :1;
+        unsigned char WDTPS2 :1;
+        unsigned char WDTPS3 :1;
+    };
+} WDTCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char TX9D :1;
+        unsigned char TRMT :1;
+        unsigned char BRGH :1;
+        unsigned char SENDB :1;
+        unsigned char SYNC :1;
+        unsigned char TXEN :1;
+        unsigned char TX9 :1;
+        unsigned char CSRC :1;
+    };
+    struct {
+        unsigned char :3;
+        unsigned char SENB :1;
+    };
+} TXSTAbits_t;
+
+typedef union {
+    struct {
+        unsigned char BRG0 :1;
+        unsigned char BRG1 :1;
+        unsigned char BRG2 :1;
+        unsigned char BRG3 :1;
+        unsigned char BRG4 :1;
+        unsigned char BRG5 :1;
+        unsigned char BRG6 :1;
+        unsigned char BRG7 :1;
+    };
+} SPBRGbits_t;
+
+typedef union {
+    struct {
+        unsigned char BRG8 :1;
+        unsigned char BRG9 :1;
+        unsigned char BRG10 :1;
+        unsigned char BRG11 :1;
+        unsigned char BRG12 :1;
+        unsigned char BRG13 :1;
+        unsigned char BRG14 :1;
+        unsigned char BRG15 :1;
+    };
+} SPBRGHbits_t;
+
+typedef union {
+    struct {
+        unsigned char ABDEN :1;
+        unsigned char WUE :1;
+        unsigned char :1;
+        unsigned char BRG16 :1;
+        unsigned char SCKP :1;
+        unsigned char :1;
+        unsigned char RCIDL :1;
+        unsigned char ABDOVF :1;
+    };
+} BAUDCTLbits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char ADCS :3;
+    };
+    struct {
+        unsigned char :4;
+        unsigned char ADCS0 :1;
+        unsigned char ADCS1 :1;
+        unsigned char ADCS2 :1;
+    };
+} ADCON1bits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char WPUB :4;
+    };
+    struct {
+        unsigned char :4;
+        unsigned char WPUB4 :1;
+        unsigned char WPUB5 :1;
+        unsigned char WPUB6 :1;
+        unsigned char WPUB7 :1;
+    };
+} WPUBbits_t;
+
+typedef union {
+    struct {
+        unsigned char :4;
+        unsigned char IOCB4 :1;
+        unsigned char IOCB5 :1;
+        unsigned char IOCB6 :1;
+        unsigned char IOCB7 :1;
+    };
+} IOCBbits_t;
+
+typedef union {
+    struct {
+        unsigned char VR :4;
+        unsigned char VP6EN :1;
+        unsigned char VRR :1;
+        unsigned char C2VREN :1;
+        unsigned char C1VREN :1;
+    };
+    struct {
+        unsigned char VR0 :1;
+        unsigned char VR1 :1;
+        unsigned char VR2 :1;
+        unsigned char VR3 :1;
+    };
+} VRCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char C1CH :2;
+        unsigned char C1R :1;
+        unsigned char :1;
+        unsigned char C1POL :1;
+        unsigned char C1OE :1;
+        unsigned char C1OUT :1;
+        unsigned char C1ON :1;
+    };
+    struct {
+        unsigned char C1CH0 :1;
+        unsigned char C1CH1 :1;
+    };
+} CM1CON0bits_t;
+
+typedef union {
+    struct {
+        unsigned char C2CH :2;
+        unsigned char C2R :1;
+        unsigned char :1;
+        unsigned char C2POL :1;
+        unsigned char C2OE :1;
+        unsigned char C2OUT :1;
+        unsigned char C2ON :1;
+    };
+    struct {
+        unsigned char C2CH0 :1;
+        unsigned char C2CH1 :1;
+    };
+} CM2CON0bits_t;
+
+typedef union {
+    struct {
+        unsigned char C2SYNC :1;
+        unsigned char T1GSS :1;
+        unsigned char :4;
+        unsigned char MC2OUT :1;
+        unsigned char MC1OUT :1;
+    };
+} CM2CON1bits_t;
+
+typedef union {
+    struct {
+        unsigned char ANS0 :1;
+        unsigned char ANS1 :1;
+        unsigned char ANS2 :1;
+        unsigned char ANS3 :1;
+        unsigned char ANS4 :1;
+        unsigned char ANS5 :1;
+        unsigned char ANS6 :1;
+        unsigned char ANS7 :1;
+    };
+} ANSELbits_t;
+
+typedef union {
+    struct {
+        unsigned char ANS8 :1;
+        unsigned char ANS9 :1;
+        unsigned char ANS10 :1;
+        unsigned char ANS11 :1;
+    };
+} ANSELHbits_t;
+
+typedef union {
+    struct {
+        unsigned char RD :1;
+        unsigned char WR :1;
+        unsigned char WREN :1;
+        unsigned char WRERR :1;
+        unsigned char :3;
+        unsigned char EEPGD :1;
+    };
+} EECON1bits_t;
+
+typedef union {
+    struct {
+        unsigned char STRA :1;
+        unsigned char STRB :1;
+        unsigned char STRC :1;
+        unsigned char STRD :1;
+        unsigned char STRSYNC :1;
+    };
+} PSTRCONbits_t;
+
+typedef union {
+    struct {
+        unsigned char :2;
+        unsigned char PULSR :1;
+        unsigned char PULSS :1;
+        unsigned char C2REN :1;
+        unsigned char C1SEN :1;
+        unsigned char SR :2;
+    };
+    struct {
+        unsigned char :6;
+        unsigned char SR0 :1;
+        unsigned char SR1 :1;
+    };
+} SRCONbits_t;
+
+#define INDF         (*(volatile unsigned char *)sim_sfr(0x000))
+#define TMR0         (*(volatile unsigned char *)sim_sfr(0x001))
+#define PCL          (*(volatile unsigned char *)sim_sfr(0x002))
+#define STATUS       (*(volatile unsigned char *)sim_sfr(0x003))
+#define STATUSbits   (*(volatile STATUSbits_t *)sim_sfr(0x003))
+#define FSR          (*(volatile unsigned char *)sim_sfr(0x004))
+#define PORTA        (*(volatile unsigned char *)sim_sfr(0x005))
+#define PORTAbits    (*(volatile PORTAbits_t *)sim_sfr(0x005))
+#define PORTB        (*(volatile unsigned char *)sim_sfr(0x006))
+#define PORTBbits    (*(volatile PORTBbits_t *)sim_sfr(0x006))
+#define PORTC        (*(volatile unsigned char *)sim_sfr(0x007))
+#define PORTCbits    (*(volatile PORTCbits_t *)sim_sfr(0x007))
+#define PCLATH       (*(volatile unsigned char *)sim_sfr(0x00A))
+#define INTCON       (*(volatile unsigned char *)sim_sfr(0x00B))
+#define INTCONbits   (*(volatile INTCONbits_t *)sim_sfr(0x00B))
+#define PIR1         (*(volatile unsigned char *)sim_sfr(0x00C))
+#define PIR1bits     (*(volatile PIR1bits_t *)sim_sfr(0x00C))
+#define PIR2         (*(volatile unsigned char *)sim_sfr(0x00D))
+#define PIR2bits     (*(volatile PIR2bits_t *)sim_sfr(0x00D))
+#define TMR1         (*(volatile unsigned short *)sim_sfr(0x00E))
+#define TMR1L        (*(volatile unsigned char *)sim_sfr(0x00E))
+#define TMR1H        (*(volatile unsigned char *)sim_sfr(0x00F))
+#define T1CON        (*(volatile unsigned char *)sim_sfr(0x010))
+#define T1CONbits    (*(volatile T1CONbits_t *)sim_sfr(0x010))
+#define TMR2         (*(volatile unsigned char *)sim_sfr(0x011))
+#define T2CON        (*(volatile unsigned char *)sim_sfr(0x012))
+#define T2CONbits    (*(volatile T2CONbits_t *)sim_sfr(0x012))
+#define SSPBUF       (*(volatile unsigned char *)sim_sfr(0x013))
+#define SSPCON       (*(volatile unsigned char *)sim_sfr(0x014))
+#define SSPCONbits   (*(volatile SSPCONbits_t *)sim_sfr(0x014))
+#define CCPR         (*(volatile unsigned short *)sim_sfr(0x015))
+#define CCPR1L       (*(volatile unsigned char *)sim_sfr(0x015))
+#define CCPR1H       (*(volatile unsigned char *)sim_sfr(0x016))
+#define CCP1CON      (*(volatile unsigned char *)sim_sfr(0x017))
+#define CCP1CONbits  (*(volatile CCP1CONbits_t *)sim_sfr(0x017))
+#define RCSTA        (*(volatile unsigned char *)sim_sfr(0x018))
+#define RCSTAbits    (*(volatile RCSTAbits_t *)sim_sfr(0x018))
+#define TXREG        (*(volatile unsigned char *)sim_sfr(0x019))
+#define RCREG        (*(volatile unsigned char *)sim_sfr(0x01A))
+#define PWM1CON      (*(volatile unsigned char *)sim_sfr(0x01C))
+#define PWM1CONbits  (*(volatile PWM1CONbits_t *)sim_sfr(0x01C))
+#define ECCPAS       (*(volatile unsigned char *)sim_sfr(0x01D))
+#define ECCPASbits   (*(volatile ECCPASbits_t *)sim_sfr(0x01D))
+#define ADRESH       (*(volatile unsigned char *)sim_sfr(0x01E))
+#define ADCON0       (*(volatile unsigned char *)sim_sfr(0x01F))
+#define ADCON0bits   (*(volatile ADCON0bits_t *)sim_sfr(0x01F))
+#define OPTION_REG   (*(volatile unsigned char *)sim_sfr(0x081))
+#define OPTION_REGbits (*(volatile OPTION_REGbits_t *)sim_sfr(0x081))
+#define TRISA        (*(volatile unsigned char *)sim_sfr(0x085))
+#define TRISAbits    (*(volatile TRISAbits_t *)sim_sfr(0x085))
+#define TRISB        (*(volatile unsigned char *)sim_sfr(0x086))
+#define TRISBbits    (*(volatile TRISBbits_t *)sim_sfr(0x086))
+#define TRISC        (*(volatile unsigned char *)sim_sfr(0x087))
+#define TRISCbits    (*(volatile TRISCbits_t *)sim_sfr(0x087))
+#define PIE1         (*(volatile unsigned char *)sim_sfr(0x08C))
+#define PIE1bits     (*(volatile PIE1bits_t *)sim_sfr(0x08C))
+#define PIE2         (*(volatile unsigned char *)sim_sfr(0x08D))
+#define PIE2bits     (*(volatile PIE2bits_t *)sim_sfr(0x08D))
+#define PCON         (*(volatile unsigned char *)sim_sfr(0x08E))
+#define PCONbits     (*(volatile PCONbits_t *)sim_sfr(0x08E))
+#define OSCCON       (*(volatile unsigned char *)sim_sfr(0x08F))
+#define OSCCONbits   (*(volatile OSCCONbits_t *)sim_sfr(0x08F))
+#define OSCTUNE      (*(volatile unsigned char *)sim_sfr(0x090))
+#define OSCTUNEbits  (*(volatile OSCTUNEbits_t *)sim_sfr(0x090))
+#define PR2          (*(volatile unsigned char *)sim_sfr(0x092))
+#define SSPADD       (*(volatile unsigned char *)sim_sfr(0x093))
+#define SSPMSK       (*(volatile unsigned char *)sim_sfr(0x093))
+#define MSK          (*(volatile unsigned char *)sim_sfr(0x093))
+#define SSPMSKbits   (*(volatile SSPMSKbits_t *)sim_sfr(0x093))
+#define MSKbits      (*(volatile MSKbits_t *)sim_sfr(0x093))
+#define SSPSTAT      (*(volatile unsigned char *)sim_sfr(0x094))
+#define SSPSTATbits  (*(volatile SSPSTATbits_t *)sim_sfr(0x094))
+#define WPUA         (*(volatile unsigned char *)sim_sfr(0x095))
+#define WPU          (*(volatile unsigned char *)sim_sfr(0x095))
+#define WPUAbits     (*(volatile WPUAbits_t *)sim_sfr(0x095))
+#define WPUbits      (*(volatile WPUbits_t *)sim_sfr(0x095))
+#define IOCA         (*(volatile unsigned char *)sim_sfr(0x096))
+#define IOC          (*(volatile unsigned char *)sim_sfr(0x096))
+#define IOCAbits     (*(volatile IOCAbits_t *)sim_sfr(0x096))
+#define IOCbits      (*(volatile IOCbits_t *)sim_sfr(0x096))
+#define WDTCON       (*(volatile unsigned char *)sim_sfr(0x097))
+#define WDTCONbits   (*(volatile WDTCONbits_t *)sim_sfr(0x097))
+#define TXSTA        (*(volatile unsigned char *)sim_sfr(0x098))
+#define TXSTAbits    (*(volatile TXSTAbits_t *)sim_sfr(0x098))
+#define SPBRG        (*(volatile unsigned char *)sim_sfr(0x099))
+#define SPBRGbits    (*(volatile SPBRGbits_t *)sim_sfr(0x099))
+#define SPBRGH       (*(volatile unsigned char *)sim_sfr(0x09A))
+#define SPBRGHbits   (*(volatile SPBRGHbits_t *)sim_sfr(0x09A))
+#define BAUDCTL      (*(volatile unsigned char *)sim_sfr(0x09B))
+#define BAUDCTLbits  (*(volatile BAUDCTLbits_t *)sim_sfr(0x09B))
+#define ADRESL       (*(volatile unsigned char *)sim_sfr(0x09E))
+#define ADCON1       (*(volatile unsigned char *)sim_sfr(0x09F))
+#define ADCON1bits   (*(volatile ADCON1bits_t *)sim_sfr(0x09F))
+#define EEDAT        (*(volatile unsigned char *)sim_sfr(0x10C))
+#define EEDATA       (*(volatile unsigned char *)sim_sfr(0x10C))
+#define EEADR        (*(volatile unsigned char *)sim_sfr(0x10D))
+#define EEDATH       (*(volatile unsigned char *)sim_sfr(0x10E))
+#define EEADRH       (*(volatile unsigned char *)sim_sfr(0x10F))
+#define WPUB         (*(volatile unsigned char *)sim_sfr(0x115))
+#define WPUBbits     (*(volatile WPUBbits_t *)sim_sfr(0x115))
+#define IOCB         (*(volatile unsigned char *)sim_sfr(0x116))
+#define IOCBbits     (*(volatile IOCBbits_t *)sim_sfr(0x116))
+#define VRCON        (*(volatile unsigned char *)sim_sfr(0x118))
+#define VRCONbits    (*(volatile VRCONbits_t *)sim_sfr(0x118))
+#define CM1CON0      (*(volatile unsigned char *)sim_sfr(0x119))
+#define CM1CON0bits  (*(volatile CM1CON0bits_t *)sim_sfr(0x119))
+#define CM2CON0      (*(volatile unsigned char *)sim_sfr(0x11A))
+#define CM2CON0bits  (*(volatile CM2CON0bits_t *)sim_sfr(0x11A))
+#define CM2CON1      (*(volatile unsigned char *)sim_sfr(0x11B))
+#define CM2CON1bits  (*(volatile CM2CON1bits_t *)sim_sfr(0x11B))
+#define ANSEL        (*(volatile unsigned char *)sim_sfr(0x11E))
+#define ANSELbits    (*(volatile ANSELbits_t *)sim_sfr(0x11E))
+#define ANSELH       (*(volatile unsigned char *)sim_sfr(0x11F))
+#define ANSELHbits   (*(volatile ANSELHbits_t *)sim_sfr(0x11F))
+#define EECON1       (*(volatile unsigned char *)sim_sfr(0x18C))
+#define EECON1bits   (*(volatile EECON1bits_t *)sim_sfr(0x18C))
+#define EECON2       (*(volatile unsigned char *)sim_sfr(0x18D))
+#define PSTRCON      (*(volatile unsigned char *)sim_sfr(0x19D))
+#define PSTRCONbits  (*(volatile PSTRCONbits_t *)sim_sfr(0x19D))
+#define SRCON        (*(volatile unsigned char *)sim_sfr(0x19E))
+#define SRCONbits    (*(volatile SRCONbits_t *)sim_sfr(0x19E))
+
+#endif // PIC16F690_HOST_H
@@ -0,0 +1,227 @@
+/*
+ * File:   picram.c  (host tool)
+ *
+ * Adds up the data RAM the firmware's variables take on the PIC16F690,
+ * from the debug information in a host build of it, so a change that would
+ * no longer fit shows up without XC8.
+ *
+ * usage: picram [-v] [-r reserve] firmware.o
+ *
+ * Every variable with a fixed address - the globals and any static locals
+ * - is counted at XC8's sizes: int 2 bytes, long and float 4, uint24_t 3,
+ * a pointer 2, an enum 2 and structs unpadded.  Anything const is in
+ * program memory and not counted.  XC8 also needs RAM for the compiled
+ * stack (every function's locals and arguments, overlaid), the ISR's
+ * context save and its library temporaries, which this does not see, so
+ * reserve bytes (default RAM_RESERVE) are kept back for them.  The exit
+ * status is 1 if the variables and the reserve come to more than the
+ * chip's 256 bytes.  -v lists the variables, biggest first.
+ *
+ * It reads what "readelf --debug-dump=info" prints, which it runs itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PIC_RAM     256
+#define RAM_RESERVE 40   // well over the baseline code's 37 bytes in all
+#define MAX_DIES    20000
+
+typedef struct {
+    unsigned off, type, spec;   // spec is DW_AT_specification/abstract_origin
+    int tag, depth;
+    char name[40];
+    long bound;                 // subrange upper bound + 1, -1 if none
+    long byteSize;
+    int bitField, declaration, addr;
+    unsigned long address;
+} die_t;
+
+enum { T_OTHER, T_BASE, T_TYPEDEF, T_POINTER, T_CONST, T_VOLATILE, T_ARRAY,
+       T_SUBRANGE, T_STRUCT, T_UNION, T_MEMBER, T_ENUM, T_VARIABLE, T_SUBROUTINE };
+
+static const struct { const char *name; int tag; } tags[] = {
+    {"DW_TAG_base_type", T_BASE}, {"DW_TAG_typedef", T_TYPEDEF},
+    {"DW_TAG_pointer_type", T_POINTER}, {"DW_TAG_const_type", T_CONST},
+    {"DW_TAG_volatile_type", T_VOLATILE}, {"DW_TAG_array_type", T_ARRAY},
+    {"DW_TAG_subrange_type", T_SUBRANGE}, {"DW_TAG_structure_type", T_STRUCT},
+    {"DW_TAG_union_type", T_UNION}, {"DW_TAG_member", T_MEMBER},
+    {"DW_TAG_enumeration_type", T_ENUM}, {"DW_TAG_variable", T_VARIABLE},
+    {"DW_TAG_subroutine_type", T_SUBROUTINE}
+};
+
+static die_t die[MAX_DIES];
+static int dies;
+
+static die_t *find(unsigned off) {
+    int lo = 0, hi = dies - 1;
+    while (lo <= hi) {  // in offset order as readelf prints them
+        int mid = (lo + hi) / 2;
+        if (die[mid].off == off) return &die[mid];
+        if (die[mid].off < off) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+// the value after "DW_AT_x : ", past readelf's "(indirect string ...): "
+static const char *value(const char *line) {
+    const char *v = strstr(line, ": ");
+    if (!v) return "";
+    v += 2;
+    if (*v == '(') {
+        const char *end = strstr(v, "): ");
+        if (end) v = end + 3;
+    }
+    return v;
+}
+
+static int load(const char *object) {
+    char cmd[600], line[1000];
+    snprintf(cmd, sizeof cmd, "readelf --debug-dump=info '%s'", object);
+    FILE *f = popen(cmd, "r");
+    if (!f) { perror("readelf"); return -1; }
+    die_t *d = NULL;
+    while (fgets(line, sizeof line, f)) {
+        unsigned depth, off;
+        char tag[64];
+        line[strcspn(line, "\n")] = 0;
+        if (sscanf(line, " <%u><%x>: Abbrev Number: %*d (%63[^)])", &depth, &off, tag) == 3) {
+            if (dies == MAX_DIES) { fprintf(stderr, "picram: too many DIEs\n"); return -1; }
+            d = &die[dies];
+            *d = (die_t){.off = off, .depth = (int)depth, .bound = -1, .byteSize = -1};
+            for (unsigned i = 0; i < sizeof tags / sizeof tags[0]; i++)
+                if (!strcmp(tag, tags[i].name)) d->tag = tags[i].tag;
+            ++dies;
+            continue;
+        }
+        if (!d || !strstr(line, "DW_AT_")) continue;
+        const char *v = value(line);
+        const char *op;
+        if (strstr(line, "DW_AT_name ")) snprintf(d->name, sizeof d->name, "%s", v);
+        else if (strstr(line, "DW_AT_type ")) sscanf(v, "<%x>", &d->type);
+        else if (strstr(line, "DW_AT_specification ") || strstr(line, "DW_AT_abstract_origin "))
+            sscanf(v, "<%x>", &d->spec);
+        else if (strstr(line, "DW_AT_byte_size ")) d->byteSize = strtol(v, NULL, 0);
+        else if (strstr(line, "DW_AT_bit_size ")) d->bitField = 1;
+        else if (strstr(line, "DW_AT_upper_bound ")) d->bound = strtol(v, NULL, 0) + 1;
+        else if (strstr(line, "DW_AT_count ")) d->bound = strtol(v, NULL, 0);
+        else if (strstr(line, "DW_AT_declaration ")) d->declaration = 1;
+        else if (strstr(line, "DW_AT_location ") && (op = strstr(line, "DW_OP_addr: "))) {
+            d->addr = 1;
+            d->address = strtoul(op + 12, NULL, 16);
+        }
+    }
+    if (pclose(f)) {
+        fprintf(stderr, "picram: readelf failed on %s\n", object);
+        return -1;
+    }
+    return 0;
+}
+
+// XC8's size of a type, -1 if it cannot be worked out
+static long size(unsigned off) {
+    die_t *t = find(off);
+    long n = 0, s;
+    if (!t) return -1;
+    switch (t->tag) {
+    case T_BASE:
+        if (strstr(t->name, "long long")) return 8;
+        if (strstr(t->name, "long") || !strcmp(t->name, "float") || !strcmp(t->name, "double"))
+            return 4;
+        if (strstr(t->name, "int")) return 2;  // int and short
+        return t->byteSize;
+    case T_TYPEDEF:  // the host's int32_t is an int
+        if (strstr(t->name, "int8_t")) return 1;
+        if (strstr(t->name, "int16_t")) return 2;
+        if (strstr(t->name, "int24_t")) return 3;
+        if (strstr(t->name, "int32_t")) return 4;
+        return size(t->type);
+    case T_POINTER:
+        return 2;
+    case T_ENUM:
+        return 2;
+    case T_CONST: case T_VOLATILE:
+        return size(t->type);
+    case T_ARRAY:
+        if ((s = size(t->type)) < 0) return -1;
+        n = s;
+        for (int i = (int)(t - die) + 1; i < dies && die[i].depth > t->depth; i++)
+            if (die[i].tag == T_SUBRANGE && die[i].depth == t->depth + 1) {
+                if (die[i].bound < 0) return -1;
+                n *= die[i].bound;
+            }
+        return n;
+    case T_STRUCT: case T_UNION:
+        for (int i = (int)(t - die) + 1; i < dies && die[i].depth > t->depth; i++) {
+            if (die[i].tag != T_MEMBER || die[i].depth != t->depth + 1) continue;
+            if (die[i].bitField) return t->byteSize;  // the SFR bit structs
+            if ((s = size(die[i].type)) < 0) return -1;
+            n = t->tag == T_STRUCT ? n + s : s > n ? s : n;
+        }
+        return n;
+    }
+    return -1;
+}
+
+// const all the way down to the element, so in program memory
+static int inFlash(unsigned off) {
+    die_t *t = find(off);
+    while (t && (t->tag == T_TYPEDEF || t->tag == T_VOLATILE || t->tag == T_ARRAY)) t = find(t->type);
+    return t && t->tag == T_CONST;
+}
+
+typedef struct { const char *name; long size; unsigned long address; } var_t;
+
+static int bySize(const void *a, const void *b) {
+    const var_t *x = a, *y = b;
+    return x->size != y->size ? (y->size > x->size) - (y->size < x->size) : strcmp(x->name, y->name);
+}
+
+int main(int argc, char **argv) {
+    int opt, verbose = 0;
+    long reserve = RAM_RESERVE;
+    while ((opt = getopt(argc, argv, "vr:")) != -1) {
+        if (opt == 'v') verbose = 1;
+        else if (opt == 'r') reserve = strtol(optarg, NULL, 0);
+        else {
+            fprintf(stderr, "usage: picram [-v] [-r reserve] firmware.o\n");
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: picram [-v] [-r reserve] firmware.o\n");
+        return 2;
+    }
+    if (load(argv[optind])) return 2;
+
+    static var_t var[MAX_DIES];
+    int vars = 0;
+    long total = 0;
+    for (int i = 0; i < dies; i++) {
+        die_t *d = &die[i], *from = d;
+        if (d->tag != T_VARIABLE || !d->addr) continue;
+        // a definition can take its name and type from the declaration
+        while (!from->type && from->spec && (from = find(from->spec)) != NULL) {}
+        if (!from || !from->type) continue;
+        int seen = 0;  // an inlined copy of a static local
+        for (int j = 0; j < vars && !seen; j++) seen = var[j].address == d->address;
+        if (seen || inFlash(from->type)) continue;
+        long s = size(from->type);
+        if (s < 0) {
+            fprintf(stderr, "picram: %s: cannot size its type\n", from->name);
+            return 2;
+        }
+        var[vars++] = (var_t){d->name[0] ? d->name : from->name, s, d->address};
+        total += s;
+    }
+    qsort(var, vars, sizeof var[0], bySize);
+    if (verbose)
+        for (int i = 0; i < vars; i++) printf("%5ld  %s\n", var[i].size, var[i].name);
+    printf("variables           %ld bytes in %d\n", total, vars);
+    printf("with the reserve    %ld of %d bytes, %ld spare\n", total + reserve, PIC_RAM,
+           PIC_RAM - total - reserve);
+    return total + reserve > PIC_RAM;
+}
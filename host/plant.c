@@ -0,0 +1,231 @@
+/*
+ * File:   plant.c  (host build)
+ *
+ * Averaged model of the PF906 power stage and motor - the PWM is treated
+ * as its mean voltage (so there is no ripple - except on the IV sense line
+ * with plant.ivRipple) and the chopper is single quadrant (current cannot
+ * reverse through the freewheel diode).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "plant.h"
+
+#define DT ((double)SIM_PLANT_CYCLES / SIM_TCY_HZ)
+
+plant_t plant;
+plant_profile_t plantProfile;
+
+void plant_init(void) {
+    plant = (plant_t){
+        .vmains = 320.0,
+        .rPrecharge = 47e3,
+        .cBus = 1000e-6,
+        .rRelay = 0.5,
+        .ke = 180.0 / (4700.0 * 2 * M_PI / 60.0),
+        .ra = 1.5,
+        .la = 8e-3,
+        .j = 0.01,
+        .b = 0.00117,
+        .slots = 36,
+        .tSwitch = 1e-6,
+        .hvScale = 4.2 / 320.0,
+        .mvScale = 3.6 / 200.0,
+        .ivScale = 3.2 / 10.5,
+        .relayTime = -1,
+    };
+    // idle inputs: speed buttons are active low, power request active high
+    sim_input(SIM_PORTB, 4, 1);
+    sim_input(SIM_PORTB, 5, 1);
+    sim_input(SIM_PORTB, 6, 1);
+    sim_input(SIM_PORTC, 2, 1);
+    sim_input(SIM_PORTC, 7, 0);
+}
+
+double plant_rpm(void) {
+    return plant.omega * 60.0 / (2 * M_PI);
+}
+
+/*
+ * Built in load profiles, in the same form as a profile file.  The motor
+ * is rated about 3.8Nm (2.5HP at 4700rpm), the scenarios bring it up to
+ * speed by 3s
+ *
+ *   step         2Nm cut from 5s to 9s
+ *   interrupted  2Nm in 0.3s bursts with 0.2s gaps from 5s, as when turning
+ *                a shaft with a keyway or flats on it
+ *   stall        load rising from 0 to 12Nm over 3s from 5s, so the motor 
+ *                runs out of torque and stalls
+ */
+static const struct { const char *name, *points; } profiles[] = {
+    {"step", "0 0\n5 0\n5 2\n9 2\n9 0\n"},
+    {"interrupted", "0 0\n5 0\n5 2\n5.3 2\n5.3 0\n5.5 0\n5.5 2\n5.8 2\n5.8 0\n"
+                    "6 0\n6 2\n6.3 2\n6.3 0\n6.5 0\n6.5 2\n6.8 2\n6.8 0\n"
+                    "7 0\n7 2\n7.3 2\n7.3 0\n7.5 0\n7.5 2\n7.8 2\n7.8 0\n"},
+    {"stall", "0 0\n5 0\n8 12\n"},
+};
+
+static int addPoint(const char *line) {
+    double t, nm;
+    char extra;
+    while (*line == ' ' || *line == '\t') line++;
+    if (*line == '#' || *line == '\n' || *line == '\r' || !*line) return 0;
+    int n = sscanf(line, "%lf %lf %c", &t, &nm, &extra);
+    if (n < 2 || (n == 3 && extra != '#')) return -1;
+    if (plantProfile.n == PLANT_PROFILE_POINTS) return -1;
+    if (plantProfile.n && t < plantProfile.t[plantProfile.n - 1]) return -1;
+    // the load starts where the line up to the first torque begins
+    if (nm != 0 && plantProfile.start < 0)
+        plantProfile.start = plantProfile.n ? plantProfile.t[plantProfile.n - 1] : t;
+    plantProfile.t[plantProfile.n] = t;
+    plantProfile.nm[plantProfile.n++] = nm;
+    return 0;
+}
+
+// load a built in profile or a profile file, 0 if it is good
+int plant_profile(const char *name) {
+    plantProfile = (plant_profile_t){.start = -1};
+    for (unsigned i = 0; i < sizeof profiles / sizeof profiles[0]; i++) {
+        if (strcmp(name, profiles[i].name)) continue;
+        char line[40];
+        for (const char *p = profiles[i].points; *p; p = strchr(p, '\n') + 1) {
+            snprintf(line, sizeof line, "%.*s", (int)(strchr(p, '\n') - p), p);
+            addPoint(line);
+        }
+        return 0;
+    }
+    FILE *f = fopen(name, "r");
+    if (!f) { perror(name); return -1; }
+    char line[200];
+    int bad = 0, lineNo = 0;
+    while (!bad && fgets(line, sizeof line, f)) {
+        ++lineNo;
+        bad = addPoint(line);
+    }
+    fclose(f);
+    if (bad) fprintf(stderr, "%s:%d: want \"seconds Nm\" in time order\n", name, lineNo);
+    else if (!plantProfile.n) fprintf(stderr, "%s: no points\n", name), bad = -1;
+    return bad;
+}
+
+// the profile's torque at t, held at the first and last points
+double plant_profile_torque(double t) {
+    const plant_profile_t *p = &plantProfile;
+    if (t < p->t[0]) return p->nm[0];
+    int i = 1;
+    while (i < p->n && p->t[i] <= t) i++;
+    if (i == p->n) return p->nm[p->n - 1];
+    return p->nm[i - 1] + (p->nm[i] - p->nm[i - 1]) * (t - p->t[i - 1]) / (p->t[i] - p->t[i - 1]);
+}
+
+/*
+ * Button contacts - for plant.bounce seconds after the operator input 
+ * changes the contact makes and breaks at random, ~50us at a time.  A fixed
+ * seed keeps runs repeatable
+ */
+typedef struct { int level; double since; int out; } contact_t;
+static contact_t contacts[3];  // speed up, speed down, user power
+static unsigned bounceSeed = 12345;
+
+static int contact(contact_t *c, int level) {
+    if (level != c->level) { c->level = level; c->since = plant.t; }
+    if (plant.t - c->since >= plant.bounce) return c->out = level;
+    bounceSeed = bounceSeed * 1103515245u + 12345u;
+    if (((bounceSeed >> 16) & 63) == 0) c->out = !c->out;
+    return c->out;
+}
+
+/*
+ * The current the PWM ripple puts either side of the average - it climbs 
+ * while the switch is on from the start of the period and falls while it
+ * is off, a triangle plant.ripple high
+ */
+static double rippleCurrent(double on) {
+    double rise = plant.ripple;
+    double phase = sim_pwm_phase(), i;
+    if (phase < on) i = plant.current - rise / 2 + rise * phase / on;
+    else i = plant.current + rise / 2 - rise * (phase - on) / (1 - on);
+    return i > 0 ? i : 0;
+}
+
+// gaussian, plant.noise rms
+static unsigned noiseSeed = 54321;
+
+static double uniform(void) {
+    noiseSeed = noiseSeed * 1103515245u + 12345u;
+    return ((noiseSeed >> 8) + 0.5) / 16777216.0;
+}
+
+static double noise(void) {
+    if (plant.noise == 0) return 0;
+    return plant.noise * sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+void plant_step(void) {
+    plant.t += DT;
+
+    // RLA2 is powered through the user request and PowerPermissive (RB7)
+    int relay = plant.userPower && sim_output(SIM_PORTB, 7) == 1;
+    if (relay && !plant.relay) plant.relayTime = plant.t;
+    plant.relay = relay;
+
+    // the gate drive only runs while TotemControl (RA5) is high
+    double on = sim_output(SIM_PORTA, 5) == 1 ? sim_pwm_on() : 0.0;
+    double emf = plant.ke * plant.omega;
+    double vapplied = on * plant.vbus;
+    plant.current += (vapplied - emf - plant.ra * plant.current) / plant.la * DT;
+    if (plant.current < 0) plant.current = 0;
+    plant.vmotor = plant.current > 0 ? vapplied : emf;
+
+    // bus: precharge through R55 while the user holds power on
+    double icharge = 0.0;
+    if (plant.relay) {
+        icharge = (plant.vmains - plant.vbus) / plant.rRelay;
+        if (icharge > plant.relayPeak) plant.relayPeak = icharge;
+        plant.relayI2t += icharge * icharge * DT;
+    } else if (plant.userPower) {
+        icharge = (plant.vmains - plant.vbus) / plant.rPrecharge;
+    }
+    if (plant.rLeak > 0) icharge -= plant.vbus / plant.rLeak;
+    plant.vbus += (icharge - on * plant.current) / plant.cBus * DT;
+    if (plant.vbus < 0) plant.vbus = 0;
+
+    /*
+     * The ripple the averaged current hides, (vbus - emf - Ra i) D T / La, 
+     * and the IGBT switching loss: each period it switches the current 
+     * against the bus for tSwitch, half of it lost on average
+     */
+    double period = (sim.reg[0x092] + 1.0) / SIM_TCY_HZ;  // PR2, Timer 2 at 1:1
+    plant.ripple = 0;
+    if (plant.current > 0 && on > 0 && on < 1) {
+        plant.ripple = (plant.vbus - emf - plant.ra * plant.current) * on * period / plant.la;
+        plant.switchJ += 0.5 * plant.vbus * plant.current * plant.tSwitch * DT / period;
+    }
+
+    if (plantProfile.n) plant.loadTorque = plant_profile_torque(plant.t);
+    double iv = plant.current;
+    if (plant.ivRipple && iv > 0 && on > 0 && on < 1) iv = rippleCurrent(on);
+
+    double torque = plant.ke * plant.current - plant.b * plant.omega;
+    if (plant.omega > 0 || torque > plant.loadTorque) torque -= plant.loadTorque;
+    plant.omega += torque / plant.j * DT;
+    if (plant.omega < 0) plant.omega = 0;
+    if (plant.forceRpm > 0) plant.omega = plant.forceRpm * 2 * M_PI / 60.0;
+    plant.theta += plant.omega * DT;
+    if (plant.theta > 2 * M_PI) plant.theta -= 2 * M_PI;
+
+    // tach opto: light through each slot gives a rounded wave on RC3
+    sim.an[7] = plant.tachLost ? 0.2 : 0.7 + 0.5 * sin(plant.slots * plant.theta);
+
+    sim.an[5] = plant.vbus * plant.hvScale + noise();    // HV on RC1/AN5
+    sim.an[2] = plant.vmotor * plant.mvScale + noise();  // MV on RA2/AN2
+    sim.an[4] = iv * plant.ivScale + noise();            // IV on RC0/AN4
+    if (plant.ivOnRc2) sim.an[6] = sim.an[4];     // and on RC2/AN6/C12IN2-
+
+    sim_input(SIM_PORTB, 5, !contact(&contacts[1], plant.speedDown));
+    sim_input(SIM_PORTB, 6, !contact(&contacts[0], plant.speedUp));
+    sim_input(SIM_PORTC, 7, contact(&contacts[2], plant.userPower));
+}
@@ -0,0 +1,89 @@
+/*
+ * File:   plant.h  (host build)
+ *
+ * The PF906 board and motor as seen from the PIC pins.  Parameters come
+ * from the comments in PF906_base_code_v4b.c: 320VDC bus, 180V / 4700RPM
+ * 2.5HP motor, 36 slot tach disk, R55 47k precharge resistor.
+ *
+ * plant_step() is installed as sim.plant and runs every 1us of virtual
+ * time.  It reads the PIC outputs (PWM, TotemControl, PowerPermissive),
+ * updates the physics and drives the PIC inputs (buttons, tach opto on
+ * RC3, HV/MV/IV sense voltages).
+ *
+ * The cutting load can follow a torque profile instead of being set by
+ * the scenario - a list of "seconds Nm" points joined by straight lines,
+ * with two points at the same time for a step.  plant_profile() takes one
+ * of the built in profiles (see plant.c) or a file of them, one point per
+ * line and '#' to the end of a line a comment.
+ */
+
+#ifndef PLANT_H
+#define PLANT_H
+
+typedef struct {
+    // supply
+    double vmains;      // rectified mains on the bus [V]
+    double rPrecharge;  // R55 [ohm]
+    double cBus;        // DC bus capacitor bank [F]
+    double rRelay;      // bus charging path once RLA2 closes [ohm]
+    double rLeak;       // leakage across the caps, 0 for none [ohm]
+    // motor
+    double ke;          // back emf constant [V s/rad], also Nm/A
+    double ra;          // armature + R8/R8A [ohm]
+    double la;          // armature inductance [H]
+    double j;           // motor, belt and spindle inertia [kg m^2]
+    double b;           // viscous friction [Nm s/rad]
+    int    slots;       // openings in the tach disk
+    double tSwitch;     // IGBT turn on + turn off time, for the switching loss [s]
+    // sense scaling at the PIC pins
+    double hvScale;     // V per bus V    (4.2V at 320V)
+    double mvScale;     // V per motor V  (3.6V at 200V)
+    double ivScale;     // V per motor A  (3.2V at 10.5A)
+    int    ivOnRc2;     // IV jumpered to RC2 for the overcurrent trip (OC_TRIP)
+    int    ivRipple;    // put the PWM ripple on IV, the averaged current otherwise
+    double noise;       // rms noise on the MV, IV and HV sense lines [V]
+
+    // operator inputs, set by the scenario
+    int    userPower;   // FR7 power request held
+    int    speedUp;     // FR1 pressed
+    int    speedDown;   // FR2 pressed
+    double loadTorque;  // cutting load on the spindle [Nm], or from the profile
+    double forceRpm;    // >0 spins the shaft at this speed regardless
+    double bounce;      // contacts chatter for this long after a change [s]
+    int    tachLost;    // tach opto dark, as if its LED or wiring failed
+
+    // state
+    double t;           // seconds
+    double vbus;
+    double omega;       // rad/s
+    double current;     // motor current [A]
+    double ripple;      // PWM ripple on the current, peak to peak [A]
+    double switchJ;     // energy lost switching the IGBT so far [J]
+    double vmotor;      // average motor terminal voltage [V]
+    double theta;       // shaft angle [rad]
+    int    relay;       // RLA2 closed
+    double relayTime;   // when RLA2 closed, -1 before
+    double relayPeak;   // highest current through RLA2 [A]
+    double relayI2t;    // and its I^2t [A^2 s]
+} plant_t;
+
+#define PLANT_PROFILE_POINTS 64
+
+typedef struct {
+    int    n;           // points, 0 when the scenario sets loadTorque itself
+    double t[PLANT_PROFILE_POINTS];
+    double nm[PLANT_PROFILE_POINTS];
+    double start;       // the first time the load is not zero, -1 for never
+} plant_profile_t;
+
+extern plant_profile_t plantProfile;
+
+extern plant_t plant;
+
+void   plant_init(void);
+void   plant_step(void);
+double plant_rpm(void);
+int    plant_profile(const char *name);
+double plant_profile_torque(double t);
+
+#endif // PLANT_H
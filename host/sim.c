@@ -0,0 +1,468 @@
+/*
+ * File:   sim.c  (host build)
+ *
+ * Virtual PIC16F690 - register file, virtual clock, peripherals and
+ * interrupt dispatch.  Register addresses and bit positions follow the
+ * datasheet DS40001262F; page numbers below refer to it.
+ */
+
+#include <string.h>
+#include "sim.h"
+
+sim_t sim;
+
+// SFR addresses used by the peripheral models
+#define R_TMR0      0x001
+#define R_PORTA     0x005
+#define R_PORTB     0x006
+#define R_PORTC     0x007
+#define R_INTCON    0x00B
+#define R_PIR1      0x00C
+#define R_PIR2      0x00D
+#define R_TMR1L     0x00E
+#define R_TMR1H     0x00F
+#define R_T1CON     0x010
+#define R_TMR2      0x011
+#define R_T2CON     0x012
+#define R_CCPR1L    0x015
+#define R_CCPR1H    0x016
+#define R_CCP1CON   0x017
+#define R_PWM1CON   0x01C
+#define R_ECCPAS    0x01D
+#define R_ADRESH    0x01E
+#define R_ADCON0    0x01F
+#define R_OPTION    0x081
+#define R_TRISA     0x085
+#define R_TRISB     0x086
+#define R_TRISC     0x087
+#define R_PIE1      0x08C
+#define R_PIE2      0x08D
+#define R_PR2       0x092
+#define R_ADRESL    0x09E
+#define R_ADCON1    0x09F
+#define R_EEDAT     0x10C
+#define R_EEADR     0x10D
+#define R_VRCON     0x118
+#define R_CM1CON0   0x119
+#define R_CM2CON0   0x11A
+#define R_CM2CON1   0x11B
+#define R_ANSEL     0x11E
+#define R_ANSELH    0x11F
+#define R_EECON1    0x18C
+
+#define BIT(r, b)   ((sim.reg[r] >> (b)) & 1)
+#define SET(r, b)   (sim.reg[r] |= (uint8_t)(1 << (b)))
+#define CLR(r, b)   (sim.reg[r] &= (uint8_t)~(1 << (b)))
+
+/*
+ * analog select bit for every port pin, as ANSEL:ANSELH bit number, -1 for
+ * pins without an analog function.  Analog pins read back 0 digitally
+ */
+static const int8_t anselOf[3][8] = {
+    { 0,  1,  2, -1,  3, -1, -1, -1},  // RA0..RA5
+    {-1, -1, -1, -1, 10, 11, -1, -1},  // RB4, RB5
+    { 4,  5,  6,  7, -1, -1,  8,  9},  // RC0..RC3, RC6, RC7
+};
+
+void sim_reset(void) {
+    memset(&sim, 0, sizeof sim);
+    memset(sim.ee, 0xFF, sizeof sim.ee);  // erased EEPROM
+    sim.vdd = 5.0;
+    // power-on reset values that differ from 0 (page 36-39)
+    sim.reg[R_OPTION] = 0xFF;
+    sim.reg[R_TRISA] = 0x3F;
+    sim.reg[R_TRISB] = 0xF0;
+    sim.reg[R_TRISC] = 0xFF;
+    sim.reg[R_PR2] = 0xFF;
+    sim.reg[R_ANSEL] = 0xFF;
+    sim.reg[R_ANSELH] = 0x0F;
+    sim.reg[R_CM2CON1] = 0x02;
+    sim.reg[R_EECON1] = 0x80;  // EEPGD is unknown at power on, so set
+    sim.plant_div = SIM_PLANT_CYCLES;
+    sim.cmp_force[0] = sim.cmp_force[1] = -1;
+    for (int i = 0; i < SIM_MARKS; i++) sim.mark[i].min = UINT64_MAX;
+}
+
+double sim_time(void) {
+    return (double)sim.cycle / SIM_TCY_HZ;
+}
+
+int sim_output(int port, int bit) {
+    if ((sim.reg[R_TRISA + port] >> bit) & 1) return -1;
+    return (sim.reg[R_PORTA + port] >> bit) & 1;
+}
+
+void sim_input(int port, int bit, int level) {
+    if (level) sim.pin[port] |= (uint8_t)(1 << bit);
+    else       sim.pin[port] &= (uint8_t)~(1 << bit);
+}
+
+// input pins follow the outside world, output pins keep their latch value
+static void syncPorts(void) {
+    unsigned ansel = sim.reg[R_ANSEL] | (sim.reg[R_ANSELH] << 8);
+    for (int p = 0; p < 3; p++) {
+        uint8_t tris = sim.reg[R_TRISA + p];
+        uint8_t in = sim.pin[p];
+        for (int b = 0; b < 8; b++)
+            if (anselOf[p][b] >= 0 && ((ansel >> anselOf[p][b]) & 1))
+                in &= (uint8_t)~(1 << b);
+        sim.reg[R_PORTA + p] = (uint8_t)((sim.latch[p] & ~tris) | (in & tris));
+    }
+}
+
+/*
+ * Timer0 - 8 bit, Fosc/4 when T0CS = 0, prescaler 1:2..1:256 when PSA = 0
+ * A write to TMR0 clears the prescaler and inhibits the count for 2 cycles
+ * (page 80)
+ */
+static void timer0(void) {
+    uint8_t opt = sim.reg[R_OPTION];
+    if (opt & 0x20) return;  // T0CS - counting T0CKI, not modelled
+    if (sim.tmr0_inhibit) { --sim.tmr0_inhibit; return; }
+    if (!(opt & 0x08)) {     // PSA = 0, prescaler assigned to Timer0
+        if (++sim.tmr0_pre < (2u << (opt & 0x07))) return;
+        sim.tmr0_pre = 0;
+    }
+    if (++sim.reg[R_TMR0] == 0) SET(R_INTCON, 2);  // T0IF
+}
+
+// Timer1 - 16 bit, Fosc/4 with a 1/2/4/8 prescaler (page 83)
+static void timer1(void) {
+    uint8_t con = sim.reg[R_T1CON];
+    if (!(con & 0x01) || (con & 0x02)) return;  // off, or external clock
+    if (++sim.tmr1_pre < (1u << ((con >> 4) & 3))) return;
+    sim.tmr1_pre = 0;
+    if (++sim.reg[R_TMR1L] == 0 && ++sim.reg[R_TMR1H] == 0) SET(R_PIR1, 0);
+}
+
+/*
+ * ECCP auto-shutdown (page 139).  ECCPAS<2:0> selects the comparator
+ * outputs that force the PWM pins to their PSSAC state.  With PRSEN set the
+ * shutdown clears itself at the next period once the source has gone away.
+ * The data sheet gives no time from the event to the pins, so it is taken
+ * as SIM_SHUTDOWN_CYCLES, the next Tcy
+ */
+static int shutdownSource(void) {
+    uint8_t src = (sim.reg[R_ECCPAS] >> 4) & 7;
+    return ((src & 1) && sim.c1out) || ((src & 2) && sim.c2out);
+}
+
+static void autoShutdown(void) {
+    if (!sim.shutdown_due && shutdownSource() && !BIT(R_ECCPAS, 7))
+        sim.shutdown_due = sim.cycle + SIM_SHUTDOWN_CYCLES;
+    if (!sim.shutdown_due || sim.cycle < sim.shutdown_due) return;
+    sim.shutdown_due = 0;
+    SET(R_ECCPAS, 7);
+    sim.shutdown_cycle = sim.cycle;
+}
+
+/*
+ * Timer2 and the PWM time base - TMR2 counts to PR2 then resets, which
+ * starts a new PWM period, latches the duty cycle from CCPR1L:DC1B and
+ * clocks the postscaler that sets TMR2IF (page 89 and 131)
+ */
+static void timer2(void) {
+    uint8_t con = sim.reg[R_T2CON];
+    if (!(con & 0x04)) return;
+    uint8_t ps = con & 3;
+    if (++sim.tmr2_pre < (ps == 0 ? 1u : ps == 1 ? 4u : 16u)) return;
+    sim.tmr2_pre = 0;
+    if (sim.reg[R_TMR2] != sim.reg[R_PR2]) { ++sim.reg[R_TMR2]; return; }
+    sim.reg[R_TMR2] = 0;
+    sim.reg[R_CCPR1H] = sim.reg[R_CCPR1L];
+    sim.pwm_duty = (uint16_t)((sim.reg[R_CCPR1L] << 2) | ((sim.reg[R_CCP1CON] >> 4) & 3));
+    if (BIT(R_PWM1CON, 7) && !shutdownSource()) CLR(R_ECCPAS, 7);  // PRSEN
+    if (++sim.tmr2_post > ((con >> 3) & 0x0F)) {
+        sim.tmr2_post = 0;
+        SET(R_PIR1, 1);  // TMR2IF
+    }
+}
+
+double sim_pwm_on(void) {
+    uint8_t ccp = sim.reg[R_CCP1CON];
+    int driven = !BIT(R_TRISC, 5);
+    if (!driven) return 0.0;
+    if ((ccp & 0x0C) != 0x0C) // not in PWM mode - RC5 is a port pin
+        return BIT(R_PORTC, 5) ? 0.0 : 1.0;  // switch is on when RC5 is low
+    if (BIT(R_ECCPAS, 7))     // shut down - P1A driven to its PSSAC state
+        return ((sim.reg[R_ECCPAS] >> 2) & 3) == 0 ? 1.0 : 0.0;
+    double duty = sim.pwm_duty / (4.0 * (sim.reg[R_PR2] + 1));
+    if (duty > 1.0) duty = 1.0;
+    // CCP1M = 11x0: P1A active low - low for the duty time, switch on
+    return (ccp & 0x02) ? duty : 1.0 - duty;
+}
+
+// where the PWM is in its period, 0 at the start of the on time
+double sim_pwm_phase(void) {
+    return sim.reg[R_TMR2] / (sim.reg[R_PR2] + 1.0);
+}
+
+/*
+ * ADC (page 105) - setting GO starts a conversion on the channel that was
+ * being acquired.  11 TAD later the result lands in ADRESH:ADRESL, GO
+ * clears and ADIF is set.  Conversions started less than 5us (Tacq, page
+ * 250) after the channel was selected are counted as under-acquired
+ */
+static const uint8_t tadDiv[8] = {1, 4, 16, 0, 2, 8, 32, 0}; // in 2/Fosc units
+static void adc(void) {
+    uint8_t con0 = sim.reg[R_ADCON0];
+    uint8_t chs = (con0 >> 2) & 0x0F;
+    if (!(con0 & 0x01)) {  // ADC off - acquisition restarts when it is on
+        sim.adc_busy = 0;
+        sim.adc_chs = 0xFF;
+        CLR(R_ADCON0, 1);
+        return;
+    }
+    if (chs != sim.adc_chs) { sim.adc_chs = chs; sim.adc_acq_start = sim.cycle; }
+    if (!sim.adc_busy) {
+        if (!(con0 & 0x02)) return;
+        unsigned tad = tadDiv[(sim.reg[R_ADCON1] >> 4) & 7];
+        if (tad == 0) tad = 16;  // FRC, ~4us
+        sim.adc_busy = 1;
+        sim.adc_conv_chs = chs;
+        sim.adc_left = (uint16_t)(11 * tad / 2 + 1);
+        if (sim.cycle - sim.adc_acq_start < 10) ++sim.adc_short_acq;
+        double v = chs < 12 ? sim.an[chs] : 0.0;
+        if (v < 0) v = 0;
+        if (v > sim.vdd) v = sim.vdd;
+        sim.adc_result = (uint16_t)(v / sim.vdd * 1023.0 + 0.5);
+        if (sim.adc_sample) sim.adc_result = sim.adc_sample(chs, sim.adc_result);
+        return;
+    }
+    if (--sim.adc_left) return;
+    sim.adc_busy = 0;
+    ++sim.adc_conversions;
+    ++sim.adc_chan_conversions[sim.adc_conv_chs];
+    if (con0 & 0x80) {  // ADFM right justified
+        sim.reg[R_ADRESH] = (uint8_t)(sim.adc_result >> 8);
+        sim.reg[R_ADRESL] = (uint8_t)sim.adc_result;
+    } else {
+        sim.reg[R_ADRESH] = (uint8_t)(sim.adc_result >> 2);
+        sim.reg[R_ADRESL] = (uint8_t)(sim.adc_result << 6);
+    }
+    CLR(R_ADCON0, 1);
+    SET(R_PIR1, 6);  // ADIF
+}
+
+/*
+ * Comparators C1 and C2 with the voltage reference (page 93-104)
+ * C12INx- inputs are RA1, RC1, RC2, RC3 (AN1, AN5, AN6, AN7).  The inputs
+ * are compared at each plant step and an output follows a change after
+ * the response time, 400ns at most (CM04), SIM_CMP_RESPONSE_CYCLES
+ */
+static const uint8_t cinMinus[4] = {1, 5, 6, 7};
+
+static double cvref(void) {
+    uint8_t vr = sim.reg[R_VRCON];
+    if (vr & 0x20) return sim.vdd * (vr & 0x0F) / 24.0;       // VRR low range
+    return sim.vdd / 4.0 + sim.vdd * (vr & 0x0F) / 32.0;
+}
+
+static uint8_t compare(uint8_t con, double vplus, int vrefEnable) {
+    if (!(con & 0x80)) return 0;
+    if (con & 0x04) vplus = vrefEnable ? cvref() : 0.6;  // CxR: CxVREF
+    uint8_t out = vplus > sim.an[cinMinus[con & 3]];
+    return (uint8_t)(out ^ ((con >> 4) & 1));                  // CxPOL
+}
+
+static void comparators(void) {
+    uint8_t o[2];
+    o[0] = compare(sim.reg[R_CM1CON0], sim.an[0], BIT(R_VRCON, 7));
+    o[1] = compare(sim.reg[R_CM2CON0], sim.an[4], BIT(R_VRCON, 6));
+    for (int i = 0; i < 2; i++) {
+        if (sim.cmp_force[i] >= 0) o[i] = (uint8_t)sim.cmp_force[i];
+        if (o[i] == sim.cmp_next[i]) continue;
+        sim.cmp_next[i] = o[i];
+        sim.cmp_due[i] = sim.cycle + SIM_CMP_RESPONSE_CYCLES;
+    }
+}
+
+// every Tcy - the outputs that have got there, their flags and bits
+static void comparatorOutputs(void) {
+    for (int i = 0; i < 2; i++)
+        if (sim.cmp_due[i] && sim.cycle >= sim.cmp_due[i]) sim.cmp_due[i] = 0;
+    uint8_t o1 = sim.cmp_due[0] ? sim.c1out : sim.cmp_next[0];
+    uint8_t o2 = sim.cmp_due[1] ? sim.c2out : sim.cmp_next[1];
+    if (o1 != sim.c1out) {
+        sim.c1out = o1;
+        SET(R_PIR2, 5);  // C1IF
+        if (!sim.c1_since) sim.c1_since = sim.cycle;
+    }
+    if (o2 != sim.c2out) {
+        sim.c2out = o2;
+        SET(R_PIR2, 6);  // C2IF
+    }
+    sim.reg[R_CM1CON0] = (uint8_t)((sim.reg[R_CM1CON0] & ~0x40) | (o1 << 6));
+    sim.reg[R_CM2CON0] = (uint8_t)((sim.reg[R_CM2CON0] & ~0x40) | (o2 << 6));
+    sim.reg[R_CM2CON1] = (uint8_t)((sim.reg[R_CM2CON1] & 0x3F) | (o1 << 7) | (o2 << 6));
+}
+
+/*
+ * data EEPROM (page 117) - reads are immediate, writes take ~5ms then EEIF.
+ * With EEPGD set RD and WR are program memory, which is not modelled: a
+ * read gives a byte that is not the EEPROM's and a write goes nowhere, 
+ * and both are counted
+ */
+static void eeprom(void) {
+    uint8_t con = sim.reg[R_EECON1];
+    if (con & 0x01) {
+        if (con & 0x80) {
+            sim.reg[R_EEDAT] = (uint8_t)(sim.reg[R_EEADR] ^ 0x5A);
+            ++sim.ee_flash_reads;
+        } else {
+            sim.reg[R_EEDAT] = sim.ee[sim.reg[R_EEADR]];
+        }
+        CLR(R_EECON1, 0);
+    }
+    if (!sim.ee_busy) {
+        if ((con & 0x06) != 0x06) return;  // WR with WREN
+        if (con & 0x80) {
+            ++sim.ee_flash_writes;
+            CLR(R_EECON1, 1);
+            return;
+        }
+        sim.ee_busy = 1;
+        sim.ee_left = SIM_EE_WRITE_CYCLES;
+        sim.ee_addr = sim.reg[R_EEADR];
+        sim.ee_data = sim.reg[R_EEDAT];
+        return;
+    }
+    if (--sim.ee_left) return;
+    sim.ee_busy = 0;
+    sim.ee[sim.ee_addr] = sim.ee_data;
+    ++sim.ee_writes[sim.ee_addr];
+    CLR(R_EECON1, 1);
+    SET(R_PIR2, 4);  // EEIF
+}
+
+static void step(void) {
+    ++sim.cycle;
+    // how long the tach edge waited for the ISR to clear C1IF
+    if (sim.c1_since && !BIT(R_PIR2, 5)) {
+        uint64_t wait = sim.cycle - sim.c1_since;
+        if (wait > sim.c1_latency_max) sim.c1_latency_max = wait;
+        sim.c1_latency_sum += wait;
+        ++sim.c1_serviced;
+        sim.c1_since = 0;
+    }
+    timer0();
+    timer1();
+    timer2();
+    adc();
+    eeprom();
+    if (--sim.plant_div == 0) {
+        sim.plant_div = SIM_PLANT_CYCLES;
+        if (sim.plant) sim.plant();
+        comparators();
+    }
+    comparatorOutputs();
+    autoShutdown();
+    if (sim.plant_div == SIM_PLANT_CYCLES && sim.probe) sim.probe();
+    if (sim.cycle >= sim.stop) longjmp(sim.exit, 1);
+}
+
+static int irqPending(void) {
+    uint8_t intcon = sim.reg[R_INTCON];
+    if (!(intcon & 0x80)) return 0;
+    if ((intcon >> 3) & intcon & 0x07) return 1;  // T0IE/INTE/RABIE
+    if (!(intcon & 0x40)) return 0;
+    return (sim.reg[R_PIE1] & sim.reg[R_PIR1]) || (sim.reg[R_PIE2] & sim.reg[R_PIR2]);
+}
+
+static void advance(unsigned long n);
+
+// hardware clears GIE and vectors to 0x0004, RETFIE sets it again
+static void interrupt(void) {
+    uint64_t start = sim.cycle;
+    int tach = BIT(R_PIR2, 5) && BIT(R_PIE2, 5);
+    sim.in_isr = 1;
+    CLR(R_INTCON, 7);
+    advance(SIM_ISR_ENTRY_CYCLES);
+    sim.isr();
+    advance(SIM_ISR_EXIT_CYCLES);
+    SET(R_INTCON, 7);
+    sim.in_isr = 0;
+    uint64_t len = sim.cycle - start;
+    ++sim.isr_count;
+    sim.isr_cycles += len;
+    if (len > sim.isr_max) sim.isr_max = len;
+    if (tach) {
+        ++sim.isr_c1_count;
+        sim.isr_c1_cycles += len;
+    }
+}
+
+static void advance(unsigned long n) {
+    while (n--) {
+        step();
+        if (!sim.in_isr && sim.isr && irqPending()) interrupt();
+    }
+}
+
+volatile unsigned char *sim_sfr(unsigned addr) {
+    // a write to TMR0 since the last access clears the prescaler
+    if (sim.last_addr == R_TMR0 && sim.reg[R_TMR0] != sim.last_val) {
+        sim.tmr0_pre = 0;
+        sim.tmr0_inhibit = 2;
+    }
+    // and a write to TMR1H or TMR1L clears its prescaler
+    if ((sim.last_addr == R_TMR1L || sim.last_addr == R_TMR1H) &&
+        sim.reg[sim.last_addr] != sim.last_val)
+        sim.tmr1_pre = 0;
+    // a write to a port goes to its latch, which drives the pin once TRIS
+    // makes it an output
+    if (sim.last_addr >= R_PORTA && sim.last_addr <= R_PORTC &&
+        sim.reg[sim.last_addr] != sim.last_val)
+        sim.latch[sim.last_addr - R_PORTA] = sim.reg[sim.last_addr];
+    // the main code waiting on GO/DONE rather than leaving it to the ISR
+    if (addr == R_ADCON0 && sim.adc_busy && !sim.in_isr)
+        sim.adc_wait_cycles += SIM_CYCLES_PER_SFR;
+    advance(SIM_CYCLES_PER_SFR);
+    syncPorts();
+    sim.last_addr = addr;
+    sim.last_val = sim.reg[addr];
+    return &sim.reg[addr];
+}
+
+void sim_delay(unsigned long cycles) {
+    advance(cycles);
+}
+
+// the firmware is between 2 instructions - let the harness get in first
+void sim_preempt(int id) {
+    if (sim.preempt && !sim.in_isr) sim.preempt(id);
+}
+
+// run the ISR now if an enabled interrupt is pending, 1 if it ran
+int sim_irq(void) {
+    if (sim.in_isr || !sim.isr || !irqPending()) return 0;
+    interrupt();
+    return 1;
+}
+
+void sim_mark(int id) {
+    sim_mark_t *m = &sim.mark[id];
+    if (m->count) {
+        uint64_t d = sim.cycle - m->last;
+        if (d < m->min) m->min = d;
+        if (d > m->max) m->max = d;
+        m->sum += d;
+    }
+    ++m->count;
+    m->last = sim.cycle;
+}
+
+/*
+ * run the firmware until the virtual clock reaches the requested time.
+ * main() never returns on the PIC, so the run ends by longjmp from step()
+ * and cannot be resumed - one run per process
+ */
+int sim_run(void (*entry)(void), double seconds) {
+    sim.stop = sim.cycle + (uint64_t)(seconds * SIM_TCY_HZ);
+    if (setjmp(sim.exit) == 0) {
+        entry();
+        return 1;  // main() returned - on the PIC this is a soft reset
+    }
+    sim.in_isr = 0;
+    return 0;
+}
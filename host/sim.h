@@ -0,0 +1,131 @@
+/*
+ * File:   sim.h  (host build)
+ *
+ * Virtual PIC16F690 for the gcc host build.  The register file is a plain
+ * byte array indexed by the datasheet address, and the firmware reaches it
+ * through sim_sfr() (see pic16f690.h).  Every SFR access costs a couple of
+ * instruction cycles on the virtual clock, _delay() burns cycles directly,
+ * and while the clock runs the peripherals the firmware uses are stepped:
+ *
+ *   Timer0, Timer1, Timer2/ECCP PWM (incl. auto-shutdown), the ADC,
+ *   comparators 1 and 2 with the voltage reference, the data EEPROM and
+ *   the interrupt logic (GIE/PEIE, PIE1/PIR1, PIE2/PIR2, INTCON).
+ *
+ * The outside world (buttons, tach opto, analog sense voltages) is driven
+ * through sim.pinA/B/C and sim.an[] by a plant callback - see plant.h - or
+ * played back from a trace with the comparator outputs and ADC results 
+ * given directly - see trace.h.
+ *
+ * Timing is only approximate: code that does not touch an SFR takes no
+ * virtual time.  Treat loop periods and ISR cycle counts as lower bounds
+ * that are good for comparing one firmware change against another.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#define SIM_TCY_HZ           2000000UL  // 8MHz internal osc, Fosc/4
+#define SIM_CYCLES_PER_SFR   2   // bank select + the access itself
+#define SIM_ISR_ENTRY_CYCLES 14  // 3-4 Tcy latency + XC8 context save
+#define SIM_ISR_EXIT_CYCLES  10  // context restore + RETFIE
+#define SIM_PLANT_CYCLES     2   // plant and comparators update every 1us
+#define SIM_MARKS            8   // number of SIM_MARK() ids tracked
+#define SIM_EE_WRITE_CYCLES  10000UL // 5ms typical EEPROM write time
+#define SIM_CMP_RESPONSE_CYCLES 1 // comparator response, 400ns max, to a Tcy
+#define SIM_SHUTDOWN_CYCLES  1   // ECCP auto-shutdown to the pins, next Tcy
+
+// port numbers for the pin helpers
+enum { SIM_PORTA = 0, SIM_PORTB, SIM_PORTC };
+
+typedef struct {
+    uint64_t count;
+    uint64_t last;          // cycle of the last hit
+    uint64_t min, max, sum; // interval between hits, in cycles
+} sim_mark_t;
+
+typedef struct {
+    uint8_t  reg[0x200];    // SFR file indexed by datasheet address
+    uint8_t  ee[256];       // data EEPROM
+    uint64_t cycle;         // virtual clock in Tcy (0.5us)
+    uint64_t stop;          // sim_run() returns when cycle reaches this
+    jmp_buf  exit;
+
+    // the outside world - levels on the input pins and analog voltages
+    uint8_t  pin[3];        // PORTA, PORTB, PORTC input levels
+    double   an[12];        // voltage on AN0..AN11
+    double   vdd;           // ADC and CVREF reference
+
+    void   (*isr)(void);    // the firmware interrupt routine
+    void   (*plant)(void);  // called every SIM_PLANT_CYCLES
+    void   (*preempt)(int id); // called at each SIM_PREEMPT() point
+    void   (*probe)(void);  // after the plant and the comparators
+    uint16_t (*adc_sample)(uint8_t chs, uint16_t code); // may change each result
+    int8_t   cmp_force[2];  // C1OUT, C2OUT regardless of the inputs, -1 for none
+
+    // peripheral internals
+    unsigned last_addr;     // last SFR accessed, for write detection
+    uint8_t  last_val;
+    uint8_t  latch[3];      // PORTA..C output latches, written even on inputs
+    uint8_t  tmr0_inhibit;
+    uint16_t tmr0_pre, tmr1_pre, tmr2_pre;
+    uint8_t  tmr2_post;
+    uint16_t pwm_duty;      // 10 bit duty latched at the period start
+    uint8_t  adc_busy;
+    uint16_t adc_left;      // cycles until the conversion completes
+    uint16_t adc_result;
+    uint8_t  adc_conv_chs;  // channel being converted
+    uint8_t  adc_chs;       // channel being acquired
+    uint64_t adc_acq_start; // cycle the current acquisition started
+    uint8_t  c1out, c2out;
+    uint8_t  cmp_next[2];   // what C1OUT, C2OUT are heading for
+    uint64_t cmp_due[2];    //  and the cycle they get there, 0 when they have
+    uint64_t shutdown_due;  // cycle a shutdown event reaches the pins, or 0
+    uint8_t  ee_busy;
+    uint32_t ee_left;
+    uint8_t  ee_addr, ee_data;
+    int      plant_div;
+    int      in_isr;
+
+    // statistics
+    uint64_t isr_count;
+    uint64_t isr_cycles;    // total cycles spent in the ISR incl. overhead
+    uint64_t isr_max;       // longest single ISR
+    uint64_t isr_c1_count;  // ISRs entered with C1IF pending, a tach edge,
+    uint64_t isr_c1_cycles; //  and their cycles
+    uint64_t adc_wait_cycles; // main code reading ADCON0 mid conversion
+    uint64_t adc_conversions;
+    uint64_t adc_short_acq; // conversions started with < 5us acquisition
+    uint64_t adc_chan_conversions[16];
+    uint64_t shutdown_cycle; // when ECCP auto-shutdown last tripped
+    uint64_t c1_since;      // cycle C1IF was set, 0 when clear
+    uint64_t c1_latency_max; // longest C1IF has stayed set before the ISR
+    uint64_t c1_latency_sum; //  cleared it, and the total over c1_serviced
+    uint64_t c1_serviced;
+    uint32_t ee_writes[256]; // writes to each data EEPROM byte
+    uint32_t ee_flash_reads; // RD and WR with EEPGD set, which go to
+    uint32_t ee_flash_writes; //  program memory instead
+    sim_mark_t mark[SIM_MARKS];
+} sim_t;
+
+extern sim_t sim;
+
+// called by the firmware through pic16f690.h / xc.h
+volatile unsigned char *sim_sfr(unsigned addr);
+void sim_delay(unsigned long cycles);
+void sim_mark(int id);
+void sim_preempt(int id);
+
+// called by the harness
+void   sim_reset(void);
+int    sim_run(void (*entry)(void), double seconds);
+double sim_time(void);
+int    sim_output(int port, int bit);  // latch level, -1 if the pin is an input
+void   sim_input(int port, int bit, int level);
+double sim_pwm_on(void);   // fraction of time the power switch is on
+double sim_pwm_phase(void); // 0..1 through the PWM period
+int    sim_irq(void);      // take a pending interrupt now, from a preempt hook
+
+#endif // SIM_H
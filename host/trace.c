@@ -0,0 +1,275 @@
+/*
+ * File:   trace.c  (host build)
+ *
+ * Trace record and replay - see trace.h for the format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "trace.h"
+
+// the signals in a trace, the inputs first
+enum {
+    SIG_RB4, SIG_RB5, SIG_RB6, SIG_RC2, SIG_RC7, SIG_C1OUT, SIG_C2OUT,
+    SIG_CCPR1L, SIG_DC1B, SIG_RA5, SIG_RB7, SIGNALS,
+    SIG_OUTPUTS = SIG_CCPR1L,
+    SIG_AN = 100,    // + channel
+    SIG_EE = 200, SIG_END
+};
+
+static const char *sigName[SIGNALS] = {
+    "RB4", "RB5", "RB6", "RC2", "RC7", "C1OUT", "C2OUT", "CCPR1L", "DC1B", "RA5", "RB7"
+};
+static const struct { uint8_t port, bit; } sigPin[SIG_C1OUT] = {
+    {SIM_PORTB, 4}, {SIM_PORTB, 5}, {SIM_PORTB, 6}, {SIM_PORTC, 2}, {SIM_PORTC, 7}
+};
+
+#define AN_CHANNELS 12
+#define UNKNOWN -2
+
+static int level(int sig) {
+    switch (sig) {
+    case SIG_C1OUT:  return sim.cmp_next[0];  // before the response time
+    case SIG_C2OUT:  return sim.cmp_next[1];
+    case SIG_CCPR1L: return sim.reg[0x015];
+    case SIG_DC1B:   return sim.reg[0x017] >> 4 & 3;  // CCP1CON<5:4>
+    case SIG_RA5:    return sim_output(SIM_PORTA, 5);
+    case SIG_RB7:    return sim_output(SIM_PORTB, 7);
+    default:         return sim.pin[sigPin[sig].port] >> sigPin[sig].bit & 1;
+    }
+}
+
+/*
+ * Recording
+ */
+static FILE *rec;
+static const char *recName;
+static uint64_t recCycle;
+static int recLevel[SIGNALS], recAn[AN_CHANNELS];
+
+static void put(const char *name, int channel, long value) {
+    fprintf(rec, "%llu %s", (unsigned long long)(sim.cycle - recCycle), name);
+    if (channel >= 0) fprintf(rec, "%d", channel);
+    fprintf(rec, " %ld\n", value);
+    recCycle = sim.cycle;
+}
+
+int trace_record_open(const char *file, const char *what) {
+    if (!(rec = fopen(file, "w"))) {
+        perror(file);
+        return -1;
+    }
+    recName = file;
+    recCycle = sim.cycle;
+    for (int i = 0; i < SIGNALS; i++) recLevel[i] = UNKNOWN;
+    for (int i = 0; i < AN_CHANNELS; i++) recAn[i] = UNKNOWN;
+    fprintf(rec, "# pf906 trace, %s\n0 EE ", what);
+    for (unsigned i = 0; i < sizeof sim.ee; i++) fprintf(rec, "%02x", sim.ee[i]);
+    fprintf(rec, "\n");
+    return 0;
+}
+
+int trace_record_close(void) {
+    if (!rec) return 0;
+    fprintf(rec, "%llu END\n", (unsigned long long)(sim.cycle - recCycle));
+    if (fclose(rec)) {
+        perror(recName);
+        return -1;
+    }
+    rec = NULL;
+    return 0;
+}
+
+/*
+ * Replay - one cursor for the inputs and one for the expected outputs,
+ * each reading every line for the cycle count but keeping only its own
+ */
+typedef struct {
+    FILE *f;
+    const char *name;
+    int line;
+    uint64_t cycle;     // of the event read
+    int sig;            // SIG_xx, SIG_AN + channel, SIG_EE or SIG_END
+    long value;
+    uint8_t ee[256];
+} cursor_t;
+
+static cursor_t in, want;
+static int replaying, inAn[AN_CHANNELS], wantLevel[SIGNALS];
+static uint64_t inputEvents, outputEvents;
+static struct {
+    uint64_t cycles;    // samples different, 1 per plant step
+    unsigned runs;      // times it went different
+    int bad;
+} diff[SIGNALS];
+static unsigned diffShown;
+#define DIFFS_SHOWN 10
+
+static int parseEe(cursor_t *c, const char *hex) {
+    for (unsigned i = 0; i < sizeof c->ee; i++) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return -1;
+        c->ee[i] = (uint8_t)byte;
+    }
+    return 0;
+}
+
+// the next line into c, 0 at the end of the file or on an error
+static int next(cursor_t *c) {
+    char line[600], name[16], value[520];
+    unsigned long long delta;
+    int ch;
+    while (fgets(line, sizeof line, c->f)) {
+        ++c->line;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        int n = sscanf(line, "%llu %15s %519s", &delta, name, value);
+        c->cycle += delta;
+        c->value = 0;
+        if (n == 2 && !strcmp(name, "END")) {
+            c->sig = SIG_END;
+            return 1;
+        }
+        if (n != 3) break;
+        if (!strcmp(name, "EE")) {
+            if (parseEe(c, value)) break;
+            c->sig = SIG_EE;
+            return 1;
+        }
+        c->value = strtol(value, NULL, 10);
+        if (sscanf(name, "AN%d", &ch) == 1 && ch >= 0 && ch < AN_CHANNELS) {
+            c->sig = SIG_AN + ch;
+            return 1;
+        }
+        for (c->sig = 0; c->sig < SIGNALS; c->sig++)
+            if (!strcmp(name, sigName[c->sig])) return 1;
+        break;
+    }
+    if (!feof(c->f)) fprintf(stderr, "%s:%d: not a trace line\n", c->name, c->line);
+    else fprintf(stderr, "%s: no END, stopping at the last line\n", c->name);
+    c->sig = SIG_END;
+    return 0;
+}
+
+static int openCursor(cursor_t *c, const char *file) {
+    *c = (cursor_t){.name = file, .sig = -1};
+    if (!(c->f = fopen(file, "r"))) {
+        perror(file);
+        return -1;
+    }
+    return 0;
+}
+
+int trace_replay_open(const char *file, const char *expected) {
+    if (openCursor(&in, file) || openCursor(&want, expected)) return -1;
+    next(&in);
+    if (in.sig == SIG_EE) {
+        memcpy(sim.ee, in.ee, sizeof sim.ee);
+        next(&in);
+    }
+    next(&want);
+    for (int i = 0; i < AN_CHANNELS; i++) inAn[i] = UNKNOWN;
+    for (int i = 0; i < SIGNALS; i++) wantLevel[i] = UNKNOWN;
+    replaying = 1;
+    return 0;
+}
+
+/*
+ * Apply the inputs up to now.  From the ADC, in the middle of a step,
+ * that is only the results for now - the pins and comparators for now
+ * come after it, at the plant step
+ */
+static void replayInputs(int fromAdc) {
+    while (in.sig != SIG_END && (in.cycle < sim.cycle ||
+           (in.cycle == sim.cycle && (!fromAdc || in.sig >= SIG_AN)))) {
+        if (in.sig >= SIG_AN && in.sig < SIG_AN + AN_CHANNELS) {
+            inAn[in.sig - SIG_AN] = (int)in.value;
+            ++inputEvents;
+        } else if (in.sig == SIG_C1OUT || in.sig == SIG_C2OUT) {
+            sim.cmp_force[in.sig - SIG_C1OUT] = (int8_t)in.value;
+            ++inputEvents;
+        } else if (in.sig < SIG_C1OUT) {
+            sim_input(sigPin[in.sig].port, sigPin[in.sig].bit, (int)in.value);
+            ++inputEvents;
+        }
+        next(&in);
+    }
+    // the end of the trace is the end of the run
+    if (in.sig == SIG_END && !fromAdc) sim.stop = in.cycle > sim.cycle ? in.cycle : sim.cycle;
+}
+
+void trace_replay_step(void) {
+    replayInputs(0);
+}
+
+uint16_t trace_adc(uint8_t chs, uint16_t code) {
+    if (replaying) {
+        replayInputs(1);
+        if (chs < AN_CHANNELS && inAn[chs] != UNKNOWN) code = (uint16_t)inAn[chs];
+    }
+    if (rec && chs < AN_CHANNELS && recAn[chs] != code) {
+        recAn[chs] = code;
+        put("AN", chs, code);
+    }
+    return code;
+}
+
+static void compare(void) {
+    while (want.sig != SIG_END && want.cycle <= sim.cycle) {
+        if (want.sig >= SIG_OUTPUTS && want.sig < SIGNALS) {
+            wantLevel[want.sig] = (int)want.value;
+            ++outputEvents;
+        }
+        next(&want);
+    }
+    for (int s = SIG_OUTPUTS; s < SIGNALS; s++) {
+        int got = level(s);
+        if (wantLevel[s] == UNKNOWN || got == wantLevel[s]) {
+            diff[s].bad = 0;
+            continue;
+        }
+        ++diff[s].cycles;
+        if (diff[s].bad) continue;
+        diff[s].bad = 1;
+        ++diff[s].runs;
+        if (diffShown++ < DIFFS_SHOWN)
+            printf("%10.6f s  cycle %llu  %s %d, expected %d\n", sim_time(),
+                   (unsigned long long)sim.cycle, sigName[s], got, wantLevel[s]);
+    }
+}
+
+void trace_probe(void) {
+    if (replaying) compare();
+    if (!rec) return;
+    for (int s = 0; s < SIGNALS; s++) {
+        int now = level(s);
+        if (now == recLevel[s]) continue;
+        recLevel[s] = now;
+        put(sigName[s], -1, now);
+    }
+}
+
+int trace_replay_report(void) {
+    int bad = 0;
+    printf("replayed            %.3f s, %llu input changes\n", sim_time(),
+           (unsigned long long)inputEvents);
+    printf("outputs compared    %llu changes expected from %s\n",
+           (unsigned long long)outputEvents, want.name);
+    for (int s = SIG_OUTPUTS; s < SIGNALS; s++) {
+        printf("%-8s            ", sigName[s]);
+        if (diff[s].runs)
+            printf("%u differences, %.3f ms in all\n", diff[s].runs,
+                   diff[s].cycles * SIM_PLANT_CYCLES * 1e3 / SIM_TCY_HZ);
+        else
+            printf("as expected\n");
+        bad |= diff[s].runs != 0;
+    }
+    if (in.cycle != want.cycle || want.sig != SIG_END) {
+        printf("the expected trace ends at %.6f s\n", (double)want.cycle / SIM_TCY_HZ);
+        bad = 1;
+    }
+    fclose(in.f);
+    fclose(want.f);
+    return bad;
+}
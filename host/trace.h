@@ -0,0 +1,49 @@
+/*
+ * File:   trace.h  (host build)
+ *
+ * Record and replay of what goes in and out of the PIC, so a run - or a
+ * capture from the board - can be fed to the firmware again cycle for
+ * cycle and what it drives compared with what it drove before.
+ *
+ * A trace is text, one change per line, each line the Tcy (0.5us) since
+ * the line before, the signal and its new level:
+ *
+ *   # pf906 trace, the bench-storm scenario
+ *   0 EE ffffff...          the data EEPROM at the start, 256 bytes in hex
+ *   2 RB5 1                 inputs: RB4 RB5 RB6 RC2 RC7 pin levels,
+ *   0 C1OUT 0                 C1OUT C2OUT the comparator outputs (the tach
+ *   613 AN2 301               on RC3 and IV on RC2) and ANn an ADC result
+ *   0 CCPR1L 60             outputs: CCPR1L, DC1B, RA5 (TotemControl) and
+ *   48 RA5 1                  RB7 (PowerPermissive), -1 while it is an input
+ *   ...
+ *   16 END                  the end of the run
+ *
+ * The pins and comparators are as they were after each plant step, every
+ * 2 Tcy - for the comparators what they decided then, which the outputs
+ * follow after the response time (see sim.c).  An ADC result is the code a conversion starting then got, and
+ * holds for that channel until the next - it is only written when it
+ * changes.  The outputs are also sampled every plant step.
+ *
+ * trace_record_open() writes one while the scenario runs.  For replay
+ * the trace takes the place of the plant: trace_replay_step() is sim.plant,
+ * setting the pins and forcing the comparators as they were, and
+ * trace_adc() gives each conversion the code its channel last had.  The
+ * expected outputs are read from the same or another trace with a cursor
+ * of their own, so neither is ever in memory.  A replay is only exact on
+ * the same build, with nothing else (preempt hooks and the like) added.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+int      trace_record_open(const char *file, const char *what);
+int      trace_record_close(void);
+int      trace_replay_open(const char *file, const char *expected);
+void     trace_replay_step(void);    // sim.plant while replaying
+int      trace_replay_report(void);  // 1 if the outputs were not as expected
+void     trace_probe(void);          // sim.probe, records and compares
+uint16_t trace_adc(uint8_t chs, uint16_t code);  // sim.adc_sample
+
+#endif // TRACE_H
@@ -0,0 +1,29 @@
+/*
+ * File:   xc.h  (host build)
+ *
+ * Minimal stand-in for the XC8 <xc.h> so the firmware compiles with gcc.
+ * It pulls in the simulated register map and maps the XC8 intrinsics used
+ * by the firmware onto the simulator:
+ *
+ *  __interrupt()   - the ISR becomes a plain function that sim.c calls
+ *                    when an enabled interrupt flag is set and GIE is on
+ *  _delay(n)       - burns n instruction cycles of virtual time, servicing 
+ *                    the peripherals (and interrupts) as it goes
+ *  __delay_ms/us   - same formula as pic.h, so they depend on _XTAL_FREQ
+ */
+
+#ifndef XC_HOST_H
+#define XC_HOST_H
+
+#include "pic16f690.h"
+
+#define __interrupt(...)
+#define __nop()             sim_delay(1)
+#define _delay(x)           sim_delay((unsigned long)(x))
+#define __delay_us(x)       _delay((unsigned long)((x)*(_XTAL_FREQ/4000000.0)))
+#define __delay_ms(x)       _delay((unsigned long)((x)*(_XTAL_FREQ/4000.0)))
+
+#define di()                (INTCONbits.GIE = 0)
+#define ei()                (INTCONbits.GIE = 1)
+
+#endif // XC_HOST_H